@@ -0,0 +1,106 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host/ble_hs.h"
+
+#include "dlog.h"
+#include "flight_rec.h"
+#include "gatt_svr.h"
+#include "hid_func.h"
+#include "central.h"
+
+#define CENTRAL_MTU         185
+#define CENTRAL_DRAIN_MS    2000
+
+static atomic_uint Received;
+static central_rx_hook_t Rx_hook;
+
+static void
+central_rx(uint16_t conn_handle, uint16_t attr_handle, bool indication, const uint8_t *data, uint16_t len)
+{
+    central_rx_hook_t hook = Rx_hook;
+
+    (void)data;
+    (void)len;
+    if (hook) {
+        hook(conn_handle, attr_handle, indication);
+    }
+    atomic_fetch_add_explicit(&Received, 1, memory_order_relaxed);
+}
+
+/* the part of GAP event handler in ble_func.c which the HID pipeline needs */
+static int
+central_gap_event(struct ble_gap_event *event, void *arg)
+{
+    (void)arg;
+    if (event->type == BLE_GAP_EVENT_NOTIFY_TX) {
+        hid_notify_tx(event->notify_tx.conn_handle, event->notify_tx.attr_handle,
+            event->notify_tx.indication, event->notify_tx.status);
+    }
+    return 0;
+}
+
+void
+central_init(void)
+{
+    dlog_init();
+    flight_rec_init();
+    ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
+    if (gatt_svr_init() != 0) {
+        fprintf(stderr, "gatt_svr_init failed\n");
+        abort();
+    }
+    shim_ble_set_tx_cb(central_rx);
+    shim_ble_set_gap_cb(central_gap_event, NULL);
+}
+
+void
+central_connect(uint16_t conn_handle, bool indicate)
+{
+    static const int input_reports[] = {
+        HANDLE_HID_MOUSE_REPORT,
+        HANDLE_HID_KB_IN_REPORT,
+        HANDLE_HID_CC_REPORT,
+        HANDLE_HID_NKRO_REPORT,
+    };
+    struct ble_gap_conn_desc desc;
+
+    shim_ble_connect(conn_handle, CENTRAL_MTU);
+    if (ble_gap_conn_find(conn_handle, &desc) != 0) {
+        abort();
+    }
+    hid_clean_vars(&desc);
+    for (size_t i = 0; i < sizeof(input_reports) / sizeof(input_reports[0]); ++i) {
+        hid_set_notify(conn_handle, Svc_char_handles[input_reports[i]], !indicate, indicate);
+    }
+}
+
+void
+central_disconnect(uint16_t conn_handle)
+{
+    shim_ble_disconnect(conn_handle);
+    hid_set_disconnected(conn_handle);
+}
+
+void
+central_drain(void)
+{
+    for (int ms = 0; ms < CENTRAL_DRAIN_MS && hid_input_busy(0); ++ms) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+}
+
+unsigned
+central_received(void)
+{
+    return atomic_load_explicit(&Received, memory_order_relaxed);
+}
+
+void
+central_set_rx_hook(central_rx_hook_t hook)
+{
+    Rx_hook = hook;
+}
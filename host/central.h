@@ -0,0 +1,26 @@
+#ifndef H_HOST_CENTRAL_
+#define H_HOST_CENTRAL_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Fake central for host benchmark and tests. central_init() registers GATT
+services of the firmware, NOTIFY_TX events of the shim go to hid_notify_tx()
+like from the GAP event handler of ble_func.c. Every received notification and
+indication is counted, optional hook sees them first.
+*/
+
+typedef void (*central_rx_hook_t)(uint16_t conn_handle, uint16_t attr_handle, bool indication);
+
+extern void central_init(void);
+/* connects and subscribes to input reports by notifications or indications */
+extern void central_connect(uint16_t conn_handle, bool indicate);
+extern void central_disconnect(uint16_t conn_handle);
+/* waits until coalesced reports are flushed and sent */
+extern void central_drain(void);
+/* notifications and indications received */
+extern unsigned central_received(void);
+extern void central_set_rx_hook(central_rx_hook_t hook);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+HID pipeline benchmark on Linux. Firmware HID, GPIO and GATT code runs against
+the shims, one fake central (central.c) is connected and subscribed to input
+reports. Every scenario prints one JSON line:
+calls per second, CPU cycles per call (TSC cycles on x86, not ESP32 cycles),
+mbufs allocated per call (ATT reads count the request mbuf of the stack) and
+notifications sent to the central. GPIO scenario bounces the button pins of
+gpio_func.c through the fake ISR and measures ISR cycles per edge and time
+from the last edge to the debounced event. Probe counters of hid_perf are
+printed after the scenarios.
+
+    hid_bench [events per scenario]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "xtensa/hal.h"
+
+#include "btn_ring.h"
+#include "central.h"
+#include "gatt_svr.h"
+#include "gpio_func.h"
+#include "hid_codes.h"
+#include "hid_func.h"
+#include "hid_perf.h"
+
+#define BENCH_CONN_HANDLE   1
+/* press and release cycles of GPIO scenario, every one takes two debounce windows */
+#define BENCH_GPIO_CYCLES   25
+/* edges of one contact bounce */
+#define BENCH_GPIO_BOUNCES  5
+
+static int64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+bench_keyboard(uint32_t i)
+{
+    return hid_keyboard_change_key(HID_KEY_A + (i / 2) % 26, !(i & 1));
+}
+
+static int
+bench_mouse(uint32_t i)
+{
+    // every 8th call presses or releases the left button, others move
+    if (i % 8 == 7) {
+        return hid_mouse_change_key(HID_MOUSE_LEFT, 0, 0, !(i & 8));
+    }
+    return hid_mouse_change_key(0, (i & 1) ? 3 : -3, 1, false);
+}
+
+static int
+bench_cc(uint32_t i)
+{
+    return hid_cc_change_key(HID_CONSUMER_VOLUME_UP, !(i & 1));
+}
+
+/* ATT read of the input report: ble_svc_report_access and hid_read_buffer */
+static int
+bench_report_read(uint32_t i)
+{
+    static const int reports[] = {
+        HANDLE_HID_KB_IN_REPORT,
+        HANDLE_HID_MOUSE_REPORT,
+        HANDLE_HID_FEATURE_REPORT,
+    };
+    uint8_t data[64];
+    uint16_t len = sizeof(data);
+
+    return shim_gatt_read(BENCH_CONN_HANDLE, Svc_char_handles[reports[i % 3]], data, &len);
+}
+
+/* ATT read of HID service characteristics: hid_svr_chr_access */
+static int
+bench_hid_access(uint32_t i)
+{
+    uint8_t data[64];
+    uint16_t len = sizeof(data);
+
+    return shim_gatt_read(BENCH_CONN_HANDLE,
+        Svc_char_handles[(i & 1) ? HANDLE_HID_PROTO_MODE : HANDLE_HID_INFORMATION], data, &len);
+}
+
+/* button pins of Hid_buttons in gpio_func.c */
+static const gpio_num_t Bench_pins[] = { 13, 12 };
+#define BENCH_PINS_COUNT (sizeof(Bench_pins) / sizeof(Bench_pins[0]))
+
+static struct btn_ring Buttons_ring;
+
+/* bounces all pins to level, returns cycles spent in the fake ISR */
+static uint64_t
+gpio_bounce(int level, uint32_t *edges)
+{
+    uint64_t cycles = 0;
+
+    for (int bounce = BENCH_GPIO_BOUNCES - 1; bounce >= 0; --bounce) {
+        for (size_t pin = 0; pin < BENCH_PINS_COUNT; ++pin) {
+            // odd bounces go back to the old level, the last one stays at the new level
+            uint32_t start = xthal_get_ccount();
+
+            shim_gpio_input(Bench_pins[pin], (bounce & 1) ? !level : level);
+            cycles += xthal_get_ccount() - start;
+            (*edges)++;
+        }
+    }
+    return cycles;
+}
+
+/* waits for debounced events of all pins and sends them to HID like app_main does */
+static uint32_t
+gpio_collect(bool pressed, int64_t *settle_ns_max)
+{
+    struct btn_event events[BTN_RING_SIZE];
+    int64_t start_ns = now_ns();
+    uint32_t collected = 0;
+
+    while (collected < BENCH_PINS_COUNT && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100))) {
+        int count = btn_ring_drain(&Buttons_ring, events, BTN_RING_SIZE);
+
+        for (int i = 0; i < count; ++i) {
+            bool event_pressed = !(events[i].button & BUTTON_RELEASED_BIT);
+
+            if (event_pressed != pressed || (events[i].button & BUTTON_TYPE_MASK) != BUTTON_TYPE_CC) {
+                fprintf(stderr, "unexpected button event %08X\n", events[i].button);
+                abort();
+            }
+            hid_cc_change_key(events[i].button & 0xffff, event_pressed);
+        }
+        collected += count;
+    }
+    if (now_ns() - start_ns > *settle_ns_max) {
+        *settle_ns_max = now_ns() - start_ns;
+    }
+    return collected;
+}
+
+/* returns false if some debounced event was lost */
+static bool
+bench_gpio(void)
+{
+    uint32_t edges = 0, events = 0;
+    uint64_t isr_cycles = 0;
+    int64_t settle_ns_total = 0, settle_ns_max = 0;
+    unsigned notifications = central_received();
+
+    btn_ring_init(&Buttons_ring, xTaskGetCurrentTaskHandle());
+    xTaskCreate(gpio_btn_task, "gpio_btn_task", 2048, &Buttons_ring, 10, NULL);
+    for (size_t pin = 0; pin < BENCH_PINS_COUNT; ++pin) {
+        while (!shim_gpio_isr_ready(Bench_pins[pin])) {
+            vTaskDelay(pdMS_TO_TICKS(1));
+        }
+    }
+
+    for (int cycle = 0; cycle < BENCH_GPIO_CYCLES; ++cycle) {
+        for (int pressed = 1; pressed >= 0; --pressed) {
+            int64_t start_ns;
+
+            // pull-up: pressed button is level 0
+            isr_cycles += gpio_bounce(!pressed, &edges);
+            start_ns = now_ns();
+            events += gpio_collect(pressed, &settle_ns_max);
+            settle_ns_total += now_ns() - start_ns;
+        }
+    }
+    central_drain();
+    notifications = central_received() - notifications;
+
+    printf("{\"bench\":\"gpio_isr\",\"edges\":%u,\"events\":%u,\"expected_events\":%u,"
+        "\"cycles_per_edge\":%.1f,\"settle_us_avg\":%.0f,\"settle_us_max\":%.0f,"
+        "\"ring_overflows\":%u,\"notifications\":%u}\n",
+        edges, events, (uint32_t)(BENCH_GPIO_CYCLES * 2 * BENCH_PINS_COUNT),
+        (double)isr_cycles / edges, settle_ns_total / 1e3 / (BENCH_GPIO_CYCLES * 2),
+        settle_ns_max / 1e3, btn_ring_overflows(&Buttons_ring), notifications);
+    return events == BENCH_GPIO_CYCLES * 2 * BENCH_PINS_COUNT;
+}
+
+static const struct bench {
+    const char *name;
+    int (*call)(uint32_t i);
+} Benches[] = {
+    { "hid_keyboard_change_key",    bench_keyboard },
+    { "hid_mouse_change_key",       bench_mouse },
+    { "hid_cc_change_key",          bench_cc },
+    { "report_read",                bench_report_read },
+    { "hid_access_read",            bench_hid_access },
+};
+
+static void
+bench_run(const struct bench *bench, uint32_t events)
+{
+    uint32_t errors = 0;
+    uint32_t allocs = shim_mbuf_allocs();
+    unsigned notifications = central_received();
+    int64_t start_ns = now_ns();
+    uint32_t start_cycles = xthal_get_ccount();
+
+    for (uint32_t i = 0; i < events; ++i) {
+        errors += bench->call(i) != 0;
+    }
+
+    uint32_t cycles = xthal_get_ccount() - start_cycles;
+    int64_t elapsed_ns = now_ns() - start_ns;
+
+    central_drain();
+    allocs = shim_mbuf_allocs() - allocs;
+    notifications = central_received() - notifications;
+
+    printf("{\"bench\":\"%s\",\"events\":%u,\"errors\":%u,\"events_per_sec\":%.0f,"
+        "\"cycles_per_call\":%.1f,\"ns_per_call\":%.1f,\"mbuf_allocs\":%u,"
+        "\"allocs_per_event\":%.3f,\"notifications\":%u}\n",
+        bench->name, events, errors, elapsed_ns ? events * 1e9 / elapsed_ns : 0.0,
+        (double)cycles / events, (double)elapsed_ns / events, allocs,
+        (double)allocs / events, notifications);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t events = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+
+    if (!events) {
+        fprintf(stderr, "usage: %s [events per scenario]\n", argv[0]);
+        return 2;
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    central_init();
+    hid_perf_init();
+    central_connect(BENCH_CONN_HANDLE, false);
+
+    for (size_t i = 0; i < sizeof(Benches) / sizeof(Benches[0]); ++i) {
+        bench_run(&Benches[i], events);
+    }
+    bool gpio_ok = bench_gpio();
+
+    hid_perf_print();
+    return gpio_ok ? 0 : 1;
+}
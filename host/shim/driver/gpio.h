@@ -0,0 +1,70 @@
+#ifndef H_SHIM_DRIVER_GPIO_
+#define H_SHIM_DRIVER_GPIO_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+Fake GPIO matrix: levels are kept in memory. Tests change input levels with
+shim_gpio_input(), it calls the ISR handler of the pin like the hardware
+does when interrupt type matches the edge.
+*/
+
+typedef int gpio_num_t;
+
+#define GPIO_NUM_MAX 40
+#define GPIO_SEL_BIT(gpio) (1ULL << (gpio))
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+    GPIO_INTR_LOW_LEVEL,
+    GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+
+typedef enum {
+    GPIO_MODE_DISABLE,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT,
+    GPIO_MODE_OUTPUT_OD,
+    GPIO_MODE_INPUT_OUTPUT_OD,
+    GPIO_MODE_INPUT_OUTPUT,
+} gpio_mode_t;
+
+typedef enum { GPIO_PULLUP_DISABLE, GPIO_PULLUP_ENABLE } gpio_pullup_t;
+typedef enum { GPIO_PULLDOWN_DISABLE, GPIO_PULLDOWN_ENABLE } gpio_pulldown_t;
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    gpio_pullup_t pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+typedef void (*gpio_isr_t)(void *arg);
+
+extern esp_err_t gpio_config(const gpio_config_t *config);
+extern esp_err_t gpio_reset_pin(gpio_num_t gpio);
+extern void gpio_pad_select_gpio(uint8_t gpio);
+extern esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode);
+extern esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
+extern int gpio_get_level(gpio_num_t gpio);
+extern esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t intr_type);
+extern esp_err_t gpio_intr_enable(gpio_num_t gpio);
+extern esp_err_t gpio_intr_disable(gpio_num_t gpio);
+extern esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+extern void gpio_uninstall_isr_service(void);
+extern esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t isr, void *arg);
+extern esp_err_t gpio_isr_handler_remove(gpio_num_t gpio);
+
+/* drives input pin as a button or a bouncing contact would, runs ISR of the pin for the edge */
+extern void shim_gpio_input(gpio_num_t gpio, int level);
+/* true when ISR handler of the pin is installed and its interrupt is enabled */
+extern bool shim_gpio_isr_ready(gpio_num_t gpio);
+
+#endif
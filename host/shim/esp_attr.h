@@ -0,0 +1,8 @@
+#ifndef H_SHIM_ESP_ATTR_
+#define H_SHIM_ESP_ATTR_
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef H_SHIM_ESP_LOG_
+#define H_SHIM_ESP_LOG_
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+/* logs go to stderr, so stdout has bench and test results only */
+extern void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+extern uint32_t esp_log_timestamp(void);
+/* messages above level are dropped, ESP_LOG_WARN at start */
+extern void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+#define ESP_LOGE(tag, format, ...) esp_log_write(ESP_LOG_ERROR, tag, format "\n", ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_write(ESP_LOG_WARN, tag, format "\n", ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_write(ESP_LOG_INFO, tag, format "\n", ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_log_write(ESP_LOG_DEBUG, tag, format "\n", ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esp_log_write(ESP_LOG_VERBOSE, tag, format "\n", ##__VA_ARGS__)
+#define ESP_EARLY_LOGI ESP_LOGI
+#define ESP_EARLY_LOGW ESP_LOGW
+#define ESP_EARLY_LOGE ESP_LOGE
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef H_SHIM_ESP_NIMBLE_HCI_
+#define H_SHIM_ESP_NIMBLE_HCI_
+
+#include "host/ble_hs.h"
+
+#endif
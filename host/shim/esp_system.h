@@ -0,0 +1,21 @@
+#ifndef H_SHIM_ESP_SYSTEM_
+#define H_SHIM_ESP_SYSTEM_
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+} esp_reset_reason_t;
+
+/* aborts the host process */
+extern void esp_restart(void) __attribute__((noreturn));
+extern esp_reset_reason_t esp_reset_reason(void);
+
+#endif
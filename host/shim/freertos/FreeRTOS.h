@@ -0,0 +1,58 @@
+#ifndef H_SHIM_FREERTOS_
+#define H_SHIM_FREERTOS_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_system.h"
+
+/*
+FreeRTOS on POSIX threads: every task is a thread, task notifications,
+semaphores and queues are condition variables. Critical sections of all muxes are one
+recursive mutex, like interrupts disabled on a single core, so code which
+holds a portMUX can not be preempted by another portMUX holder.
+*/
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+#define pdTRUE          1
+#define pdFALSE         0
+#define pdPASS          1
+#define pdFAIL          0
+#define portMAX_DELAY   ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS (1000 / CONFIG_FREERTOS_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)((uint64_t)(ms) * CONFIG_FREERTOS_HZ / 1000))
+#define portNUM_PROCESSORS 2
+#define tskNO_AFFINITY  0x7fffffff
+#define tskIDLE_PRIORITY 0
+#define configMAX_PRIORITIES 25
+
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+
+extern void shim_critical_enter(portMUX_TYPE *mux);
+extern void shim_critical_exit(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux)         shim_critical_enter(mux)
+#define portEXIT_CRITICAL(mux)          shim_critical_exit(mux)
+#define portENTER_CRITICAL_ISR(mux)     shim_critical_enter(mux)
+#define portEXIT_CRITICAL_ISR(mux)      shim_critical_exit(mux)
+#define portENTER_CRITICAL_SAFE(mux)    shim_critical_enter(mux)
+#define portEXIT_CRITICAL_SAFE(mux)     shim_critical_exit(mux)
+#define portYIELD_FROM_ISR()            do { } while (0)
+
+extern int xPortGetCoreID(void);
+
+#endif
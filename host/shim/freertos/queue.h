@@ -0,0 +1,15 @@
+#ifndef H_SHIM_FREERTOS_QUEUE_
+#define H_SHIM_FREERTOS_QUEUE_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct shim_queue *QueueHandle_t;
+
+extern QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+extern void vQueueDelete(QueueHandle_t queue);
+/* copies item to the back, waits for room at most ticks */
+extern BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+extern BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+extern BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef H_SHIM_FREERTOS_SEMPHR_
+#define H_SHIM_FREERTOS_SEMPHR_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct shim_semaphore *SemaphoreHandle_t;
+
+extern SemaphoreHandle_t xSemaphoreCreateBinary(void);
+/* not recursive, the owner is not tracked */
+extern SemaphoreHandle_t xSemaphoreCreateMutex(void);
+extern BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+extern BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+extern BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+
+#endif
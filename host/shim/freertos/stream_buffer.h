@@ -0,0 +1,15 @@
+#ifndef H_SHIM_FREERTOS_STREAM_BUFFER_
+#define H_SHIM_FREERTOS_STREAM_BUFFER_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct shim_stream_buffer *StreamBufferHandle_t;
+
+extern StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger_level);
+extern size_t xStreamBufferSend(StreamBufferHandle_t sb, const void *data, size_t len, TickType_t ticks);
+/* waits for trigger_level bytes at most ticks, returns what is there then */
+extern size_t xStreamBufferReceive(StreamBufferHandle_t sb, void *data, size_t len, TickType_t ticks);
+extern size_t xStreamBufferSpacesAvailable(StreamBufferHandle_t sb);
+extern BaseType_t xStreamBufferReset(StreamBufferHandle_t sb);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef H_SHIM_FREERTOS_TASK_
+#define H_SHIM_FREERTOS_TASK_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct shim_task *TaskHandle_t;
+
+/* tasks are detached threads, priority and stack size are ignored */
+extern BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                              void *arg, UBaseType_t priority, TaskHandle_t *out_task);
+extern BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                          void *arg, UBaseType_t priority, TaskHandle_t *out_task,
+                                          BaseType_t core);
+extern void vTaskDelete(TaskHandle_t task);
+extern void vTaskDelay(TickType_t ticks);
+extern TickType_t xTaskGetTickCount(void);
+extern TickType_t xTaskGetTickCountFromISR(void);
+/* threads not created by xTaskCreate get a handle on the first call */
+extern TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+extern BaseType_t xTaskNotifyGive(TaskHandle_t task);
+extern void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+extern uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+#endif
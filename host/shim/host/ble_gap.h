@@ -0,0 +1,6 @@
+#ifndef H_SHIM_HOST_BLE_GAP_
+#define H_SHIM_HOST_BLE_GAP_
+
+#include "host/ble_hs.h"
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef H_SHIM_BLE_HS_
+#define H_SHIM_BLE_HS_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+/*
+NimBLE host API used by the HID code. There is no radio: GATT services get
+ATT handles in registration order, notifications and indications go to the
+callback of the fake central (shim_ble_set_tx_cb) and its connections are
+made by shim_ble_connect. BLE_GAP_EVENT_NOTIFY_TX comes like from NimBLE:
+inside ble_gattc_notify_custom() and ble_gattc_indicate_custom() with the
+result of the send, failed ones included, and later from the host thread
+when the central confirms an indication.
+*/
+
+/* mbuf is one flat buffer here */
+struct os_mbuf {
+    uint8_t *om_data;
+    uint16_t om_len;
+    uint16_t om_size;
+};
+
+#define OS_MBUF_PKTLEN(om) ((om)->om_len)
+
+extern int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+extern int os_mbuf_free_chain(struct os_mbuf *om);
+extern struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+extern int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len);
+
+/* UUIDs */
+typedef struct {
+    uint8_t type;
+} ble_uuid_t;
+
+typedef struct {
+    ble_uuid_t u;
+    uint16_t value;
+} ble_uuid16_t;
+
+typedef struct {
+    ble_uuid_t u;
+    uint8_t value[16];
+} ble_uuid128_t;
+
+#define BLE_UUID_TYPE_16    16
+#define BLE_UUID_TYPE_128   128
+#define BLE_UUID_STR_LEN    37
+
+#define BLE_UUID16_INIT(uuid16) { .u = { .type = BLE_UUID_TYPE_16 }, .value = (uuid16) }
+#define BLE_UUID128_INIT(uuid128...) { .u = { .type = BLE_UUID_TYPE_128 }, .value = { uuid128 } }
+#define BLE_UUID16_DECLARE(uuid16) ((ble_uuid_t *) (&(ble_uuid16_t) BLE_UUID16_INIT(uuid16)))
+#define BLE_UUID128_DECLARE(uuid128...) ((ble_uuid_t *) (&(ble_uuid128_t) BLE_UUID128_INIT(uuid128)))
+
+extern uint16_t ble_uuid_u16(const ble_uuid_t *uuid);
+extern char *ble_uuid_to_str(const ble_uuid_t *uuid, char *dst);
+
+/* errors */
+#define BLE_HS_EALREADY     2
+#define BLE_HS_EINVAL       3
+#define BLE_HS_ENOENT       5
+#define BLE_HS_ENOMEM       6
+#define BLE_HS_ENOTCONN     7
+#define BLE_HS_ETIMEOUT     13
+#define BLE_HS_EDONE        14
+#define BLE_HS_EBUSY        15
+
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+#define BLE_HS_FOREVER          INT32_MAX
+#define BLE_HS_IO_NO_INPUT_OUTPUT 3
+
+#define BLE_ATT_ERR_WRITE_NOT_PERMITTED     0x03
+#define BLE_ATT_ERR_REQ_NOT_SUPPORTED       0x06
+#define BLE_ATT_ERR_INVALID_OFFSET          0x07
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN  0x0d
+#define BLE_ATT_ERR_UNLIKELY                0x0e
+#define BLE_ATT_ERR_INSUFFICIENT_RES        0x11
+
+#define BLE_ATT_F_READ          0x01
+#define BLE_ATT_F_WRITE         0x02
+#define BLE_ATT_F_READ_ENC      0x04
+#define BLE_ATT_F_READ_AUTHEN   0x08
+#define BLE_ATT_F_READ_AUTHOR   0x10
+#define BLE_ATT_F_WRITE_ENC     0x20
+#define BLE_ATT_F_WRITE_AUTHEN  0x40
+#define BLE_ATT_F_WRITE_AUTHOR  0x80
+
+#define BLE_ATT_MTU_DFLT        23
+
+extern uint16_t ble_att_mtu(uint16_t conn_handle);
+
+/* GAP */
+typedef struct {
+    uint8_t type;
+    uint8_t val[6];
+} ble_addr_t;
+
+struct ble_gap_sec_state {
+    unsigned encrypted:1;
+    unsigned authenticated:1;
+    unsigned bonded:1;
+    unsigned key_size:5;
+};
+
+struct ble_gap_conn_desc {
+    struct ble_gap_sec_state sec_state;
+    ble_addr_t our_identity_addr;
+    ble_addr_t our_ota_addr;
+    ble_addr_t peer_identity_addr;
+    ble_addr_t peer_ota_addr;
+    uint16_t conn_handle;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+    uint8_t role;
+    uint8_t master_clock_accuracy;
+};
+
+struct ble_gap_upd_params {
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint16_t latency;
+    uint16_t supervision_timeout;
+    uint16_t min_ce_len;
+    uint16_t max_ce_len;
+};
+
+#define BLE_GAP_CONN_ITVL_MS(t) ((t) * 1000 / 1250)
+#define BLE_GAP_SUPERVISION_TIMEOUT_MS(t) ((t) / 10)
+
+extern int ble_gap_conn_find(uint16_t conn_handle, struct ble_gap_conn_desc *out_desc);
+/* takes new parameters at once, as if the central has accepted them */
+extern int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params);
+
+/* the only GAP event raised here */
+#define BLE_GAP_EVENT_NOTIFY_TX 13
+
+struct ble_gap_event {
+    uint8_t type;
+    union {
+        struct {
+            int status;
+            uint16_t conn_handle;
+            uint16_t attr_handle;
+            uint8_t indication:1;
+        } notify_tx;
+    };
+};
+
+typedef int ble_gap_event_fn(struct ble_gap_event *event, void *arg);
+
+/* GATT */
+#define BLE_GATT_CHR_F_BROADCAST        0x0001
+#define BLE_GATT_CHR_F_READ             0x0002
+#define BLE_GATT_CHR_F_WRITE_NO_RSP     0x0004
+#define BLE_GATT_CHR_F_WRITE            0x0008
+#define BLE_GATT_CHR_F_NOTIFY           0x0010
+#define BLE_GATT_CHR_F_INDICATE         0x0020
+#define BLE_GATT_CHR_F_READ_ENC         0x0200
+#define BLE_GATT_CHR_F_READ_AUTHEN      0x0400
+#define BLE_GATT_CHR_F_READ_AUTHOR      0x0800
+#define BLE_GATT_CHR_F_WRITE_ENC        0x1000
+#define BLE_GATT_CHR_F_WRITE_AUTHEN     0x2000
+#define BLE_GATT_CHR_F_WRITE_AUTHOR     0x4000
+
+#define BLE_GATT_ACCESS_OP_READ_CHR     0
+#define BLE_GATT_ACCESS_OP_WRITE_CHR    1
+#define BLE_GATT_ACCESS_OP_READ_DSC     2
+#define BLE_GATT_ACCESS_OP_WRITE_DSC    3
+
+#define BLE_GATT_SVC_TYPE_END           0
+#define BLE_GATT_SVC_TYPE_PRIMARY       1
+#define BLE_GATT_SVC_TYPE_SECONDARY     2
+
+#define BLE_GATT_REGISTER_OP_SVC        1
+#define BLE_GATT_REGISTER_OP_CHR        2
+#define BLE_GATT_REGISTER_OP_DSC        3
+
+struct ble_gatt_access_ctxt;
+typedef int ble_gatt_access_fn(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+typedef uint16_t ble_gatt_chr_flags;
+
+struct ble_gatt_dsc_def {
+    const ble_uuid_t *uuid;
+    uint8_t att_flags;
+    uint8_t min_key_size;
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+};
+
+struct ble_gatt_chr_def {
+    const ble_uuid_t *uuid;
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+    struct ble_gatt_dsc_def *descriptors;
+    ble_gatt_chr_flags flags;
+    uint8_t min_key_size;
+    uint16_t *val_handle;
+};
+
+struct ble_gatt_svc_def {
+    uint8_t type;
+    const ble_uuid_t *uuid;
+    const struct ble_gatt_svc_def **includes;
+    const struct ble_gatt_chr_def *characteristics;
+};
+
+struct ble_gatt_access_ctxt {
+    uint8_t op;
+    struct os_mbuf *om;
+    union {
+        const struct ble_gatt_chr_def *chr;
+        const struct ble_gatt_dsc_def *dsc;
+    };
+};
+
+struct ble_gatt_register_ctxt {
+    uint8_t op;
+    union {
+        struct {
+            uint16_t handle;
+            const struct ble_gatt_svc_def *svc_def;
+        } svc;
+        struct {
+            uint16_t def_handle;
+            uint16_t val_handle;
+            const struct ble_gatt_chr_def *chr_def;
+            const struct ble_gatt_svc_def *svc_def;
+        } chr;
+        struct {
+            uint16_t handle;
+            const struct ble_gatt_dsc_def *dsc_def;
+            const struct ble_gatt_chr_def *chr_def;
+            const struct ble_gatt_svc_def *svc_def;
+        } dsc;
+    };
+};
+
+typedef void ble_gatt_register_fn(struct ble_gatt_register_ctxt *ctxt, void *arg);
+
+extern int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs);
+/* handles are given at once, register callback of ble_hs_cfg is called for every attribute */
+extern int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs);
+extern int ble_gattc_notify_custom(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om);
+extern int ble_gattc_indicate_custom(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om);
+
+struct ble_hs_cfg {
+    void (*reset_cb)(int reason);
+    void (*sync_cb)(void);
+    ble_gatt_register_fn *gatts_register_cb;
+    void *gatts_register_arg;
+    void *store_status_cb;
+    uint8_t sm_io_cap;
+    unsigned sm_oob_data_flag:1;
+    unsigned sm_bonding:1;
+    unsigned sm_mitm:1;
+    unsigned sm_sc:1;
+    uint8_t sm_our_key_dist;
+    uint8_t sm_their_key_dist;
+};
+
+extern struct ble_hs_cfg ble_hs_cfg;
+
+/* fake central, see shim_ble.c */
+
+/* called for every notification (indication false) and indication sent to the central */
+typedef void (*shim_ble_tx_cb_t)(uint16_t conn_handle, uint16_t attr_handle, bool indication,
+                                 const uint8_t *data, uint16_t len);
+
+extern void shim_ble_set_tx_cb(shim_ble_tx_cb_t cb);
+/* GAP event callback of all connections, like the one given to ble_gap_adv_start() */
+extern void shim_ble_set_gap_cb(ble_gap_event_fn *cb, void *arg);
+/* next count notifications and indications fail in the stack with rc, BLE_HS_ENOMEM like out of mbufs */
+extern void shim_ble_fail_tx(unsigned count, int rc);
+/* encrypted connection of the central with ATT MTU, 0 if it is not there */
+extern void shim_ble_connect(uint16_t conn_handle, uint16_t mtu);
+extern void shim_ble_disconnect(uint16_t conn_handle);
+/* runs access callback of the attribute like ATT read/write request, returns ATT error or 0 */
+extern int shim_gatt_read(uint16_t conn_handle, uint16_t attr_handle, uint8_t *data, uint16_t *len);
+extern int shim_gatt_write(uint16_t conn_handle, uint16_t attr_handle, const uint8_t *data, uint16_t len);
+/* mbufs allocated since start */
+extern uint32_t shim_mbuf_allocs(void);
+
+#endif
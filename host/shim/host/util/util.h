@@ -0,0 +1,6 @@
+#ifndef H_SHIM_HOST_UTIL_UTIL_
+#define H_SHIM_HOST_UTIL_UTIL_
+
+#include "host/ble_hs.h"
+
+#endif
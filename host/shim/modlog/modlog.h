@@ -0,0 +1,6 @@
+#ifndef H_SHIM_MODLOG_MODLOG_
+#define H_SHIM_MODLOG_MODLOG_
+
+#include "host/ble_hs.h"
+
+#endif
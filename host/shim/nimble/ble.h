@@ -0,0 +1,6 @@
+#ifndef H_SHIM_NIMBLE_BLE_
+#define H_SHIM_NIMBLE_BLE_
+
+#include "host/ble_hs.h"
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef H_SHIM_NIMBLE_NIMBLE_PORT_
+#define H_SHIM_NIMBLE_NIMBLE_PORT_
+
+#include "host/ble_hs.h"
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef H_SHIM_NVS_
+#define H_SHIM_NVS_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+#endif
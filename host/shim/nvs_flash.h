@@ -0,0 +1,6 @@
+#ifndef H_SHIM_NVS_FLASH_
+#define H_SHIM_NVS_FLASH_
+
+#include "nvs.h"
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef H_SHIM_SDKCONFIG_
+#define H_SHIM_SDKCONFIG_
+
+/*
+Configuration of the host build, defaults of main/Kconfig.projbuild except:
+GPIO ISR time and HID pipeline are profiled, profile is printed by the bench
+and not by the period timer, input latency is traced, keyboard matrix is off
+so buttons have GPIO ISRs.
+*/
+
+#define CONFIG_IDF_TARGET_ESP32 1
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#define CONFIG_BT_NIMBLE_SVC_GAP_DEVICE_NAME "nimble_kbd"
+#define CONFIG_BT_NIMBLE_GAP_DEVICE_NAME_MAX_LEN 31
+
+#define CONFIG_EXAMPLE_IO_TYPE 3
+#define CONFIG_EXAMPLE_BONDING 1
+#define CONFIG_EXAMPLE_MITM 1
+#define CONFIG_EXAMPLE_USE_SC 1
+#define CONFIG_BLINK_GPIO 16
+#define CONFIG_BUTTON_DEBOUNCE_US 5000
+#define CONFIG_GPIO_ISR_PROFILE 1
+#define CONFIG_HID_PERF 1
+#define CONFIG_HID_PERF_PERIOD_S 3600
+#define CONFIG_HID_LATENCY 1
+#define CONFIG_DLOG_RING_SIZE 128
+#define CONFIG_FLIGHT_REC_RECORDS 1024
+#define CONFIG_BATTERY_SAMPLE_MS 10000
+#define CONFIG_BATTERY_HYSTERESIS 2
+#define CONFIG_HID_COALESCE_MAX_US 15000
+#define CONFIG_HID_TX_CREDITS 4
+#define CONFIG_HID_DELIVERY_NOTIFY 1
+#define CONFIG_CONN_FAST_ITVL_MIN 6
+#define CONFIG_CONN_FAST_ITVL_MAX 12
+#define CONFIG_CONN_SLOW_ITVL_MIN 48
+#define CONFIG_CONN_SLOW_ITVL_MAX 60
+#define CONFIG_CONN_SLOW_LATENCY 20
+#define CONFIG_CONN_SUPERVISION_TIMEOUT 600
+#define CONFIG_CONN_IDLE_MS 5000
+#define CONFIG_ADV_DIRECTED_MS 3840
+#define CONFIG_ADV_ACCEPT_LIST_MS 30000
+#define CONFIG_TYPING_LAYOUT_US 1
+#define CONFIG_TYPING_BUFFER_SIZE 1024
+
+#endif
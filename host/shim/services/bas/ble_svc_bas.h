@@ -0,0 +1,9 @@
+#ifndef H_SHIM_BLE_SVC_BAS_
+#define H_SHIM_BLE_SVC_BAS_
+
+#include "host/ble_hs.h"
+
+#define BLE_SVC_BAS_UUID16                      0x180F
+#define BLE_SVC_BAS_CHR_UUID16_BATTERY_LEVEL    0x2A19
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef H_SHIM_BLE_SVC_GAP_
+#define H_SHIM_BLE_SVC_GAP_
+
+#include "host/ble_hs.h"
+
+extern void ble_svc_gap_init(void);
+
+#endif
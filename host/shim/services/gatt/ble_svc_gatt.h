@@ -0,0 +1,8 @@
+#ifndef H_SHIM_BLE_SVC_GATT_
+#define H_SHIM_BLE_SVC_GATT_
+
+#include "host/ble_hs.h"
+
+extern void ble_svc_gatt_init(void);
+
+#endif
@@ -0,0 +1,496 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "host/ble_hs.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+
+#define SHIM_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define SHIM_MAX_ATTRS 256
+
+struct ble_hs_cfg ble_hs_cfg;
+
+static struct {
+    bool connected;
+    uint16_t mtu;
+    struct ble_gap_conn_desc desc;
+} Conns[SHIM_MAX_CONNECTIONS];
+
+/* attribute table, index is ATT handle */
+static struct {
+    const struct ble_gatt_chr_def *chr;     // characteristic value
+    const struct ble_gatt_dsc_def *dsc;     // descriptor
+} Attrs[SHIM_MAX_ATTRS];
+
+static uint16_t Next_handle = 1;
+static shim_ble_tx_cb_t Tx_cb;
+static ble_gap_event_fn *Gap_cb;
+static void *Gap_arg;
+static atomic_uint Mbuf_allocs;
+
+/* failures injected by shim_ble_fail_tx() */
+static atomic_uint Fail_count;
+static atomic_int Fail_rc;
+
+/* one indication in flight per connection */
+#define SHIM_MAX_CONFIRMS SHIM_MAX_CONNECTIONS
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool started;
+    unsigned head;
+    unsigned count;
+    struct {
+        uint16_t conn_handle;
+        uint16_t attr_handle;
+    } pending[SHIM_MAX_CONFIRMS];
+} Confirms = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* GATT accesses come from one NimBLE host task on the device */
+static pthread_mutex_t Host_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* mbufs */
+
+static struct os_mbuf *
+mbuf_alloc(uint16_t size)
+{
+    struct os_mbuf *om = calloc(1, sizeof(*om));
+
+    if (om && !(om->om_data = malloc(size ? size : 1))) {
+        free(om);
+        return NULL;
+    }
+    if (om) {
+        om->om_size = size ? size : 1;
+        atomic_fetch_add_explicit(&Mbuf_allocs, 1, memory_order_relaxed);
+    }
+    return om;
+}
+
+uint32_t
+shim_mbuf_allocs(void)
+{
+    return atomic_load_explicit(&Mbuf_allocs, memory_order_relaxed);
+}
+
+int
+os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+    if (om->om_len + len > om->om_size) {
+        uint16_t size = om->om_len + len;
+        uint8_t *grown = realloc(om->om_data, size);
+
+        if (!grown) {
+            return BLE_HS_ENOMEM;
+        }
+        om->om_data = grown;
+        om->om_size = size;
+    }
+    memcpy(om->om_data + om->om_len, data, len);
+    om->om_len += len;
+    return 0;
+}
+
+int
+os_mbuf_free_chain(struct os_mbuf *om)
+{
+    if (om) {
+        free(om->om_data);
+        free(om);
+    }
+    return 0;
+}
+
+struct os_mbuf *
+ble_hs_mbuf_from_flat(const void *buf, uint16_t len)
+{
+    struct os_mbuf *om = mbuf_alloc(len);
+
+    if (om && os_mbuf_append(om, buf, len) != 0) {
+        os_mbuf_free_chain(om);
+        om = NULL;
+    }
+    return om;
+}
+
+int
+ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len)
+{
+    uint16_t len = om->om_len < max_len ? om->om_len : max_len;
+
+    memcpy(flat, om->om_data, len);
+    if (out_copy_len) {
+        *out_copy_len = len;
+    }
+    return len < om->om_len ? BLE_HS_EINVAL : 0;
+}
+
+/* UUIDs */
+
+uint16_t
+ble_uuid_u16(const ble_uuid_t *uuid)
+{
+    return uuid->type == BLE_UUID_TYPE_16 ? ((const ble_uuid16_t *)uuid)->value : 0;
+}
+
+char *
+ble_uuid_to_str(const ble_uuid_t *uuid, char *dst)
+{
+    if (uuid->type == BLE_UUID_TYPE_16) {
+        sprintf(dst, "0x%04x", ((const ble_uuid16_t *)uuid)->value);
+    } else {
+        const uint8_t *u8 = ((const ble_uuid128_t *)uuid)->value;
+
+        // little endian value, printed most significant byte first
+        sprintf(dst, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+            u8[15], u8[14], u8[13], u8[12], u8[11], u8[10], u8[9], u8[8],
+            u8[7], u8[6], u8[5], u8[4], u8[3], u8[2], u8[1], u8[0]);
+    }
+    return dst;
+}
+
+/* GAP */
+
+static int
+conn_idx(uint16_t conn_handle)
+{
+    for (int i = 0; i < SHIM_MAX_CONNECTIONS; ++i) {
+        if (Conns[i].connected && Conns[i].desc.conn_handle == conn_handle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void
+shim_ble_connect(uint16_t conn_handle, uint16_t mtu)
+{
+    for (int i = 0; i < SHIM_MAX_CONNECTIONS; ++i) {
+        if (!Conns[i].connected) {
+            memset(&Conns[i], 0, sizeof(Conns[i]));
+            Conns[i].connected = true;
+            Conns[i].mtu = mtu ? mtu : BLE_ATT_MTU_DFLT;
+            Conns[i].desc.conn_handle = conn_handle;
+            Conns[i].desc.conn_itvl = BLE_GAP_CONN_ITVL_MS(15);
+            Conns[i].desc.supervision_timeout = BLE_GAP_SUPERVISION_TIMEOUT_MS(6000);
+            Conns[i].desc.sec_state.encrypted = 1;
+            Conns[i].desc.sec_state.bonded = 1;
+            Conns[i].desc.sec_state.key_size = 16;
+            return;
+        }
+    }
+    fprintf(stderr, "%s: no room for connection %d\n", __func__, conn_handle);
+    abort();
+}
+
+void
+shim_ble_disconnect(uint16_t conn_handle)
+{
+    int i = conn_idx(conn_handle);
+
+    if (i >= 0) {
+        Conns[i].connected = false;
+    }
+}
+
+int
+ble_gap_conn_find(uint16_t conn_handle, struct ble_gap_conn_desc *out_desc)
+{
+    int i = conn_idx(conn_handle);
+
+    if (i < 0) {
+        return BLE_HS_ENOTCONN;
+    }
+    if (out_desc) {
+        *out_desc = Conns[i].desc;
+    }
+    return 0;
+}
+
+int
+ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params)
+{
+    int i = conn_idx(conn_handle);
+
+    if (i < 0) {
+        return BLE_HS_ENOTCONN;
+    }
+    Conns[i].desc.conn_itvl = params->itvl_max;
+    Conns[i].desc.conn_latency = params->latency;
+    Conns[i].desc.supervision_timeout = params->supervision_timeout;
+    return 0;
+}
+
+uint16_t
+ble_att_mtu(uint16_t conn_handle)
+{
+    int i = conn_idx(conn_handle);
+
+    return i < 0 ? 0 : Conns[i].mtu;
+}
+
+/* GATT server */
+
+void
+ble_svc_gap_init(void)
+{
+}
+
+void
+ble_svc_gatt_init(void)
+{
+}
+
+int
+ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs)
+{
+    (void)defs;
+    return 0;
+}
+
+static void
+register_cb(struct ble_gatt_register_ctxt *ctxt)
+{
+    if (ble_hs_cfg.gatts_register_cb) {
+        ble_hs_cfg.gatts_register_cb(ctxt, ble_hs_cfg.gatts_register_arg);
+    }
+}
+
+/* handles are given as NimBLE does: service, then every characteristic
+   declaration and value, its CCCD when it notifies or indicates, its descriptors */
+int
+ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs)
+{
+    for (const struct ble_gatt_svc_def *svc = svcs; svc->type != BLE_GATT_SVC_TYPE_END; ++svc) {
+        struct ble_gatt_register_ctxt ctxt = { .op = BLE_GATT_REGISTER_OP_SVC };
+
+        ctxt.svc.handle = Next_handle++;
+        ctxt.svc.svc_def = svc;
+        register_cb(&ctxt);
+
+        for (int i = 0; svc->includes && svc->includes[i]; ++i) {
+            Next_handle++;
+        }
+
+        for (const struct ble_gatt_chr_def *chr = svc->characteristics; chr && chr->uuid; ++chr) {
+            ctxt = (struct ble_gatt_register_ctxt) { .op = BLE_GATT_REGISTER_OP_CHR };
+            ctxt.chr.def_handle = Next_handle++;
+            ctxt.chr.val_handle = Next_handle++;
+            ctxt.chr.chr_def = chr;
+            ctxt.chr.svc_def = svc;
+            if (ctxt.chr.val_handle >= SHIM_MAX_ATTRS) {
+                return BLE_HS_ENOMEM;
+            }
+            Attrs[ctxt.chr.val_handle].chr = chr;
+            if (chr->val_handle) {
+                *chr->val_handle = ctxt.chr.val_handle;
+            }
+            register_cb(&ctxt);
+
+            if (chr->flags & (BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE)) {
+                Next_handle++;
+            }
+
+            for (const struct ble_gatt_dsc_def *dsc = chr->descriptors; dsc && dsc->uuid; ++dsc) {
+                ctxt = (struct ble_gatt_register_ctxt) { .op = BLE_GATT_REGISTER_OP_DSC };
+                ctxt.dsc.handle = Next_handle++;
+                ctxt.dsc.dsc_def = dsc;
+                ctxt.dsc.chr_def = chr;
+                ctxt.dsc.svc_def = svc;
+                if (ctxt.dsc.handle >= SHIM_MAX_ATTRS) {
+                    return BLE_HS_ENOMEM;
+                }
+                Attrs[ctxt.dsc.handle].dsc = dsc;
+                register_cb(&ctxt);
+            }
+        }
+    }
+    return 0;
+}
+
+static int
+gatt_access(uint16_t conn_handle, uint16_t attr_handle, bool write, struct os_mbuf *om)
+{
+    struct ble_gatt_access_ctxt ctxt = { .om = om };
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+    int rc;
+
+    if (attr_handle >= SHIM_MAX_ATTRS || (!Attrs[attr_handle].chr && !Attrs[attr_handle].dsc)) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    if (Attrs[attr_handle].chr) {
+        ctxt.op = write ? BLE_GATT_ACCESS_OP_WRITE_CHR : BLE_GATT_ACCESS_OP_READ_CHR;
+        ctxt.chr = Attrs[attr_handle].chr;
+        access_cb = ctxt.chr->access_cb;
+        arg = ctxt.chr->arg;
+    } else {
+        ctxt.op = write ? BLE_GATT_ACCESS_OP_WRITE_DSC : BLE_GATT_ACCESS_OP_READ_DSC;
+        ctxt.dsc = Attrs[attr_handle].dsc;
+        access_cb = ctxt.dsc->access_cb;
+        arg = ctxt.dsc->arg;
+    }
+
+    pthread_mutex_lock(&Host_lock);
+    rc = access_cb(conn_handle, attr_handle, &ctxt, arg);
+    pthread_mutex_unlock(&Host_lock);
+    return rc;
+}
+
+int
+shim_gatt_read(uint16_t conn_handle, uint16_t attr_handle, uint8_t *data, uint16_t *len)
+{
+    struct os_mbuf *om = mbuf_alloc(*len);
+    int rc;
+
+    if (!om) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    rc = gatt_access(conn_handle, attr_handle, false, om);
+    if (rc == 0) {
+        ble_hs_mbuf_to_flat(om, data, *len, len);
+    }
+    os_mbuf_free_chain(om);
+    return rc;
+}
+
+int
+shim_gatt_write(uint16_t conn_handle, uint16_t attr_handle, const uint8_t *data, uint16_t len)
+{
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    int rc;
+
+    if (!om) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    rc = gatt_access(conn_handle, attr_handle, true, om);
+    os_mbuf_free_chain(om);
+    return rc;
+}
+
+/* GATT client procedures of the server: notifications and indications */
+
+void
+shim_ble_set_tx_cb(shim_ble_tx_cb_t cb)
+{
+    Tx_cb = cb;
+}
+
+void
+shim_ble_set_gap_cb(ble_gap_event_fn *cb, void *arg)
+{
+    Gap_arg = arg;
+    Gap_cb = cb;
+}
+
+void
+shim_ble_fail_tx(unsigned count, int rc)
+{
+    atomic_store(&Fail_rc, rc);
+    atomic_store(&Fail_count, count);
+}
+
+static void
+notify_tx_event(int status, uint16_t conn_handle, uint16_t attr_handle, bool indication)
+{
+    struct ble_gap_event event = {
+        .type = BLE_GAP_EVENT_NOTIFY_TX,
+        .notify_tx = {
+            .status = status,
+            .conn_handle = conn_handle,
+            .attr_handle = attr_handle,
+            .indication = indication,
+        },
+    };
+
+    if (Gap_cb) {
+        Gap_cb(&event, Gap_arg);
+    }
+}
+
+/* confirms indications in order, like NimBLE host task gets them from the central */
+static void *
+confirm_thread(void *param)
+{
+    (void)param;
+    pthread_mutex_lock(&Confirms.lock);
+    for (;;) {
+        while (!Confirms.count) {
+            pthread_cond_wait(&Confirms.cond, &Confirms.lock);
+        }
+        uint16_t conn_handle = Confirms.pending[Confirms.head].conn_handle;
+        uint16_t attr_handle = Confirms.pending[Confirms.head].attr_handle;
+
+        Confirms.head = (Confirms.head + 1) % SHIM_MAX_CONFIRMS;
+        Confirms.count--;
+        pthread_mutex_unlock(&Confirms.lock);
+        notify_tx_event(BLE_HS_EDONE, conn_handle, attr_handle, true);
+        pthread_mutex_lock(&Confirms.lock);
+    }
+    return NULL;
+}
+
+static void
+confirm_later(uint16_t conn_handle, uint16_t attr_handle)
+{
+    pthread_mutex_lock(&Confirms.lock);
+    if (!Confirms.started) {
+        pthread_create(&Confirms.thread, NULL, confirm_thread, NULL);
+        pthread_detach(Confirms.thread);
+        Confirms.started = true;
+    }
+    if (Confirms.count == SHIM_MAX_CONFIRMS) {
+        fprintf(stderr, "%s: more indications in flight than connections\n", __func__);
+        abort();
+    }
+    Confirms.pending[(Confirms.head + Confirms.count) % SHIM_MAX_CONFIRMS].conn_handle = conn_handle;
+    Confirms.pending[(Confirms.head + Confirms.count) % SHIM_MAX_CONFIRMS].attr_handle = attr_handle;
+    Confirms.count++;
+    pthread_cond_signal(&Confirms.cond);
+    pthread_mutex_unlock(&Confirms.lock);
+}
+
+static int
+gatt_tx(uint16_t conn_handle, uint16_t attr_handle, bool indication, struct os_mbuf *om)
+{
+    shim_ble_tx_cb_t cb = Tx_cb;
+    unsigned fails = atomic_load(&Fail_count);
+    int rc = 0;
+
+    if (conn_idx(conn_handle) < 0) {
+        rc = BLE_HS_ENOTCONN;
+    } else if (fails && atomic_compare_exchange_strong(&Fail_count, &fails, fails - 1)) {
+        rc = atomic_load(&Fail_rc);
+    } else if (cb) {
+        cb(conn_handle, attr_handle, indication, om->om_data, om->om_len);
+    }
+    // stack owns the mbuf, also when it fails
+    os_mbuf_free_chain(om);
+
+    // application is told about every attempt before the call returns
+    notify_tx_event(rc, conn_handle, attr_handle, indication);
+    if (indication && rc == 0) {
+        confirm_later(conn_handle, attr_handle);
+    }
+    return rc;
+}
+
+int
+ble_gattc_notify_custom(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om)
+{
+    return gatt_tx(conn_handle, attr_handle, false, om);
+}
+
+int
+ble_gattc_indicate_custom(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om)
+{
+    return gatt_tx(conn_handle, attr_handle, true, om);
+}
@@ -0,0 +1,369 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+
+/* log */
+
+static esp_log_level_t Log_level = ESP_LOG_WARN;
+
+void
+esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void)tag;
+    Log_level = level;
+}
+
+uint32_t
+esp_log_timestamp(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void
+esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    va_list args;
+
+    if (level > Log_level) {
+        return;
+    }
+    fprintf(stderr, "%c (%u) %s: ", "NEWIDV"[level], esp_log_timestamp(), tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+/* system */
+
+void
+esp_restart(void)
+{
+    fprintf(stderr, "esp_restart() called\n");
+    abort();
+}
+
+esp_reset_reason_t
+esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+
+/* timers */
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t expire_us;          // 0 while stopped
+    uint64_t period_us;         // 0 for one-shot
+    struct esp_timer *next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool started;
+    struct esp_timer *list;
+} Timers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int64_t Start_us;
+
+static int64_t
+monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* process start is the boot, time starts from 1 like after the bootloader */
+__attribute__((constructor)) static void
+boot_time_init(void)
+{
+    Start_us = monotonic_us() - 1;
+}
+
+int64_t
+esp_timer_get_time(void)
+{
+    return monotonic_us() - Start_us;
+}
+
+/* runs expired timers, callbacks are called without the timer lock like in esp_timer task */
+static void *
+timer_thread(void *param)
+{
+    (void)param;
+    pthread_mutex_lock(&Timers.lock);
+    for (;;) {
+        struct esp_timer *earliest = NULL;
+        int64_t now = esp_timer_get_time();
+
+        for (struct esp_timer *t = Timers.list; t; t = t->next) {
+            if (t->expire_us && (!earliest || t->expire_us < earliest->expire_us)) {
+                earliest = t;
+            }
+        }
+        if (!earliest) {
+            pthread_cond_wait(&Timers.cond, &Timers.lock);
+            continue;
+        }
+        if (earliest->expire_us > now) {
+            struct timespec ts;
+            int64_t wait_ns = (earliest->expire_us - now) * 1000;
+
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            wait_ns += ts.tv_nsec;
+            ts.tv_sec += wait_ns / 1000000000LL;
+            ts.tv_nsec = wait_ns % 1000000000LL;
+            pthread_cond_timedwait(&Timers.cond, &Timers.lock, &ts);
+            continue;
+        }
+
+        earliest->expire_us = earliest->period_us ? earliest->expire_us + earliest->period_us : 0;
+        pthread_mutex_unlock(&Timers.lock);
+        earliest->callback(earliest->arg);
+        pthread_mutex_lock(&Timers.lock);
+    }
+    return NULL;
+}
+
+esp_err_t
+esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle)
+{
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+
+    pthread_mutex_lock(&Timers.lock);
+    if (!Timers.started) {
+        pthread_condattr_t attr;
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&Timers.cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_create(&Timers.thread, NULL, timer_thread, NULL);
+        pthread_detach(Timers.thread);
+        Timers.started = true;
+    }
+    timer->next = Timers.list;
+    Timers.list = timer;
+    pthread_mutex_unlock(&Timers.lock);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t
+timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    esp_err_t rc = ESP_OK;
+
+    pthread_mutex_lock(&Timers.lock);
+    if (timer->expire_us) {
+        rc = ESP_ERR_INVALID_STATE;
+    } else {
+        // expire time 0 means stopped, so a timer started at time 0 expires 1 us later
+        timer->expire_us = esp_timer_get_time() + timeout_us + !timeout_us;
+        timer->period_us = period_us;
+        pthread_cond_signal(&Timers.cond);
+    }
+    pthread_mutex_unlock(&Timers.lock);
+    return rc;
+}
+
+esp_err_t
+esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t
+esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return timer_start(timer, period, period);
+}
+
+esp_err_t
+esp_timer_stop(esp_timer_handle_t timer)
+{
+    esp_err_t rc = ESP_OK;
+
+    pthread_mutex_lock(&Timers.lock);
+    if (!timer->expire_us) {
+        rc = ESP_ERR_INVALID_STATE;
+    }
+    timer->expire_us = 0;
+    pthread_mutex_unlock(&Timers.lock);
+    return rc;
+}
+
+/* GPIO */
+
+static struct {
+    int level;
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    gpio_isr_t isr;
+    void *isr_arg;
+} Gpio[GPIO_NUM_MAX];
+
+static bool Isr_service = false;
+
+esp_err_t
+gpio_config(const gpio_config_t *config)
+{
+    for (int i = 0; i < GPIO_NUM_MAX; ++i) {
+        if (config->pin_bit_mask & GPIO_SEL_BIT(i)) {
+            Gpio[i].intr_type = config->intr_type;
+            Gpio[i].intr_enabled = config->intr_type != GPIO_INTR_DISABLE;
+            if (config->pull_up_en) {
+                Gpio[i].level = 1;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t
+gpio_reset_pin(gpio_num_t gpio)
+{
+    Gpio[gpio].intr_type = GPIO_INTR_DISABLE;
+    Gpio[gpio].intr_enabled = false;
+    return ESP_OK;
+}
+
+void
+gpio_pad_select_gpio(uint8_t gpio)
+{
+    (void)gpio;
+}
+
+esp_err_t
+gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode)
+{
+    (void)gpio;
+    (void)mode;
+    return ESP_OK;
+}
+
+esp_err_t
+gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    Gpio[gpio].level = level != 0;
+    return ESP_OK;
+}
+
+int
+gpio_get_level(gpio_num_t gpio)
+{
+    return Gpio[gpio].level;
+}
+
+esp_err_t
+gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t intr_type)
+{
+    Gpio[gpio].intr_type = intr_type;
+    return ESP_OK;
+}
+
+esp_err_t
+gpio_intr_enable(gpio_num_t gpio)
+{
+    Gpio[gpio].intr_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t
+gpio_intr_disable(gpio_num_t gpio)
+{
+    Gpio[gpio].intr_enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t
+gpio_install_isr_service(int intr_alloc_flags)
+{
+    (void)intr_alloc_flags;
+    if (Isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    Isr_service = true;
+    return ESP_OK;
+}
+
+void
+gpio_uninstall_isr_service(void)
+{
+    Isr_service = false;
+}
+
+esp_err_t
+gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t isr, void *arg)
+{
+    if (!Isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    Gpio[gpio].isr = isr;
+    Gpio[gpio].isr_arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t
+gpio_isr_handler_remove(gpio_num_t gpio)
+{
+    Gpio[gpio].isr = NULL;
+    return ESP_OK;
+}
+
+bool
+shim_gpio_isr_ready(gpio_num_t gpio)
+{
+    return Isr_service && Gpio[gpio].isr && Gpio[gpio].intr_enabled;
+}
+
+void
+shim_gpio_input(gpio_num_t gpio, int level)
+{
+    int old = Gpio[gpio].level;
+    bool fire = false;
+
+    Gpio[gpio].level = level != 0;
+    switch (Gpio[gpio].intr_type) {
+        case GPIO_INTR_POSEDGE:
+            fire = !old && level;
+            break;
+        case GPIO_INTR_NEGEDGE:
+            fire = old && !level;
+            break;
+        case GPIO_INTR_ANYEDGE:
+            fire = old != !!level;
+            break;
+        case GPIO_INTR_LOW_LEVEL:
+            fire = !level;
+            break;
+        case GPIO_INTR_HIGH_LEVEL:
+            fire = level;
+            break;
+        default:
+            break;
+    }
+    if (fire && Gpio[gpio].intr_enabled && Isr_service && Gpio[gpio].isr) {
+        Gpio[gpio].isr(Gpio[gpio].isr_arg);
+    }
+}
@@ -0,0 +1,461 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+
+struct shim_task {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;            // task notification value, counting
+    TaskFunction_t fn;
+    void *arg;
+};
+
+struct shim_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned count;
+};
+
+struct shim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;           // next item to read
+    UBaseType_t used;
+    uint8_t *items;
+};
+
+struct shim_stream_buffer {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t size;
+    size_t trigger;
+    size_t head;                // next byte to read
+    size_t used;
+    uint8_t *data;
+};
+
+static __thread struct shim_task *Current_task;
+
+/* all portMUX critical sections */
+static pthread_mutex_t Critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void
+shim_critical_enter(portMUX_TYPE *mux)
+{
+    pthread_mutex_lock(&Critical_lock);
+    mux->count++;
+}
+
+void
+shim_critical_exit(portMUX_TYPE *mux)
+{
+    mux->count--;
+    pthread_mutex_unlock(&Critical_lock);
+}
+
+int
+xPortGetCoreID(void)
+{
+    return 0;
+}
+
+/* absolute CLOCK_MONOTONIC deadline after ticks */
+static struct timespec
+deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns += ts.tv_nsec;
+    ts.tv_sec += ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    return ts;
+}
+
+static void
+cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* waits on cond with lock held, false on timeout */
+static bool
+cond_wait_ticks(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline)
+{
+    if (!deadline) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static struct shim_task *
+task_new(TaskFunction_t fn, void *arg)
+{
+    struct shim_task *task = calloc(1, sizeof(*task));
+
+    if (task) {
+        pthread_mutex_init(&task->lock, NULL);
+        cond_init(&task->cond);
+        task->fn = fn;
+        task->arg = arg;
+    }
+    return task;
+}
+
+static void *
+task_thread(void *param)
+{
+    Current_task = param;
+    Current_task->fn(Current_task->arg);
+    return NULL;
+}
+
+BaseType_t
+xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                        void *arg, UBaseType_t priority, TaskHandle_t *out_task, BaseType_t core)
+{
+    struct shim_task *task = task_new(fn, arg);
+    pthread_t thread;
+
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+    (void)core;
+
+    if (!task || pthread_create(&thread, NULL, task_thread, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (out_task) {
+        *out_task = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t
+xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+            void *arg, UBaseType_t priority, TaskHandle_t *out_task)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, out_task, tskNO_AFFINITY);
+}
+
+void
+vTaskDelete(TaskHandle_t task)
+{
+    if (!task || task == Current_task) {
+        pthread_exit(NULL);
+    }
+}
+
+void
+vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = deadline_after(ticks);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+TickType_t
+xTaskGetTickCount(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)((ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000) / portTICK_PERIOD_MS);
+}
+
+TickType_t
+xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+
+TaskHandle_t
+xTaskGetCurrentTaskHandle(void)
+{
+    if (!Current_task) {
+        Current_task = task_new(NULL, NULL);
+    }
+    return Current_task;
+}
+
+BaseType_t
+xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void
+vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken) {
+        *woken = pdFALSE;
+    }
+}
+
+uint32_t
+ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct shim_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = deadline_after(ticks);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while (!task->notify && ticks &&
+           cond_wait_ticks(&task->cond, &task->lock, ticks == portMAX_DELAY ? NULL : &deadline)) {
+    }
+    value = task->notify;
+    if (value) {
+        task->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+static SemaphoreHandle_t
+semaphore_new(unsigned count)
+{
+    struct shim_semaphore *sem = calloc(1, sizeof(*sem));
+
+    if (sem) {
+        pthread_mutex_init(&sem->lock, NULL);
+        cond_init(&sem->cond);
+        sem->count = count;
+    }
+    return sem;
+}
+
+SemaphoreHandle_t
+xSemaphoreCreateBinary(void)
+{
+    return semaphore_new(0);
+}
+
+SemaphoreHandle_t
+xSemaphoreCreateMutex(void)
+{
+    return semaphore_new(1);
+}
+
+BaseType_t
+xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    BaseType_t rc = pdFALSE;
+
+    pthread_mutex_lock(&sem->lock);
+    while (!sem->count && ticks &&
+           cond_wait_ticks(&sem->cond, &sem->lock, ticks == portMAX_DELAY ? NULL : &deadline)) {
+    }
+    if (sem->count) {
+        sem->count--;
+        rc = pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return rc;
+}
+
+BaseType_t
+xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    BaseType_t rc = pdFALSE;
+
+    pthread_mutex_lock(&sem->lock);
+    if (!sem->count) {
+        sem->count = 1;
+        pthread_cond_signal(&sem->cond);
+        rc = pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return rc;
+}
+
+BaseType_t
+xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+    if (woken) {
+        *woken = pdFALSE;
+    }
+    return xSemaphoreGive(sem);
+}
+
+QueueHandle_t
+xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct shim_queue *queue = calloc(1, sizeof(*queue));
+
+    if (queue && !(queue->items = malloc((size_t)length * item_size))) {
+        free(queue);
+        queue = NULL;
+    }
+    if (queue) {
+        pthread_mutex_init(&queue->lock, NULL);
+        cond_init(&queue->not_empty);
+        cond_init(&queue->not_full);
+        queue->length = length;
+        queue->item_size = item_size;
+    }
+    return queue;
+}
+
+void
+vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t
+xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    BaseType_t rc = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->used == queue->length && ticks &&
+           cond_wait_ticks(&queue->not_full, &queue->lock, ticks == portMAX_DELAY ? NULL : &deadline)) {
+    }
+    if (queue->used < queue->length) {
+        UBaseType_t tail = (queue->head + queue->used++) % queue->length;
+
+        memcpy(queue->items + (size_t)tail * queue->item_size, item, queue->item_size);
+        pthread_cond_signal(&queue->not_empty);
+        rc = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return rc;
+}
+
+BaseType_t
+xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+    if (woken) {
+        *woken = pdFALSE;
+    }
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t
+xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    BaseType_t rc = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->used && ticks &&
+           cond_wait_ticks(&queue->not_empty, &queue->lock, ticks == portMAX_DELAY ? NULL : &deadline)) {
+    }
+    if (queue->used) {
+        memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->used--;
+        pthread_cond_signal(&queue->not_full);
+        rc = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return rc;
+}
+
+StreamBufferHandle_t
+xStreamBufferCreate(size_t size, size_t trigger_level)
+{
+    struct shim_stream_buffer *sb = calloc(1, sizeof(*sb));
+
+    if (sb && !(sb->data = malloc(size))) {
+        free(sb);
+        sb = NULL;
+    }
+    if (sb) {
+        pthread_mutex_init(&sb->lock, NULL);
+        cond_init(&sb->cond);
+        sb->size = size;
+        sb->trigger = trigger_level ? trigger_level : 1;
+    }
+    return sb;
+}
+
+size_t
+xStreamBufferSend(StreamBufferHandle_t sb, const void *data, size_t len, TickType_t ticks)
+{
+    const uint8_t *src = data;
+    size_t sent = 0;
+
+    // sender never waits here, callers check free space first
+    (void)ticks;
+    pthread_mutex_lock(&sb->lock);
+    while (sent < len && sb->used < sb->size) {
+        sb->data[(sb->head + sb->used++) % sb->size] = src[sent++];
+    }
+    pthread_cond_signal(&sb->cond);
+    pthread_mutex_unlock(&sb->lock);
+    return sent;
+}
+
+size_t
+xStreamBufferReceive(StreamBufferHandle_t sb, void *data, size_t len, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    uint8_t *dst = data;
+    size_t received = 0;
+
+    pthread_mutex_lock(&sb->lock);
+    while (sb->used < sb->trigger && ticks &&
+           cond_wait_ticks(&sb->cond, &sb->lock, ticks == portMAX_DELAY ? NULL : &deadline)) {
+    }
+    while (received < len && sb->used) {
+        dst[received++] = sb->data[sb->head];
+        sb->head = (sb->head + 1) % sb->size;
+        sb->used--;
+    }
+    pthread_mutex_unlock(&sb->lock);
+    return received;
+}
+
+size_t
+xStreamBufferSpacesAvailable(StreamBufferHandle_t sb)
+{
+    size_t space;
+
+    pthread_mutex_lock(&sb->lock);
+    space = sb->size - sb->used;
+    pthread_mutex_unlock(&sb->lock);
+    return space;
+}
+
+BaseType_t
+xStreamBufferReset(StreamBufferHandle_t sb)
+{
+    pthread_mutex_lock(&sb->lock);
+    sb->head = sb->used = 0;
+    pthread_mutex_unlock(&sb->lock);
+    return pdPASS;
+}
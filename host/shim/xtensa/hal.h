@@ -0,0 +1,21 @@
+#ifndef H_SHIM_XTENSA_HAL_
+#define H_SHIM_XTENSA_HAL_
+
+#include <stdint.h>
+#include <time.h>
+
+/* CPU cycle counter: TSC on x86, nanoseconds elsewhere */
+static inline uint32_t
+xthal_get_ccount(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+#endif
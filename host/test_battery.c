@@ -0,0 +1,139 @@
+/*
+Battery filter test with a synthetic discharge trace: cell voltage falls from
+full to empty, every sample has reading noise, TX load dips and failed ADC
+reads. Reported level must never go up while discharging, must move by the
+hysteresis at least (except to empty), must not react to dips and must end
+at 0. Prints one JSON line.
+
+    test_battery [samples]
+*/
+
+#include <stdlib.h>
+
+#include "battery.h"
+#include "test.h"
+
+#define HYSTERESIS      2
+#define FULL_MV         4200
+#define EMPTY_MV        3300
+#define NOISE_MV        8
+/* readings of one sample taken during radio TX */
+#define DIPS            3
+#define DIP_MV          250
+
+static uint32_t Seed = 1;
+
+static int
+noise(int amplitude)
+{
+    Seed = Seed * 1103515245 + 12345;
+    return (int)((Seed >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+/* one sample of BATTERY_OVERSAMPLE readings of cell at mv */
+static void
+sample(int *readings, int mv, int sample_idx)
+{
+    for (int i = 0; i < BATTERY_OVERSAMPLE; ++i) {
+        readings[i] = mv + noise(NOISE_MV);
+    }
+    for (int i = 0; i < DIPS; ++i) {
+        readings[(sample_idx + i * 4) % BATTERY_OVERSAMPLE] -= DIP_MV;
+    }
+    if (sample_idx % 7 == 0) {
+        // ADC read failed
+        readings[sample_idx % BATTERY_OVERSAMPLE] = -1;
+    }
+}
+
+static void
+test_median(void)
+{
+    int mv[] = { 5, -3, 9, 1, 1, 7, 2 };
+
+    CHECK(battery_median(mv, 7) == 2);
+    for (int i = 1; i < 7; ++i) {
+        CHECK(mv[i - 1] <= mv[i]);
+    }
+}
+
+/* TX dips in less than half of readings do not move the level of a resting cell */
+static void
+test_dips(void)
+{
+    struct battery_filter filter;
+    int readings[BATTERY_OVERSAMPLE];
+    int level;
+
+    battery_filter_init(&filter);
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < BATTERY_OVERSAMPLE; ++j) {
+            readings[j] = j < BATTERY_OVERSAMPLE / 2 ? 3000 : 3900;
+        }
+        level = battery_filter_step(&filter, readings, BATTERY_OVERSAMPLE, HYSTERESIS);
+        CHECK(level == battery_mv_to_percent(3900));
+    }
+
+    // no valid readings, level stays
+    for (int j = 0; j < BATTERY_OVERSAMPLE; ++j) {
+        readings[j] = -1;
+    }
+    CHECK(battery_filter_step(&filter, readings, BATTERY_OVERSAMPLE, HYSTERESIS) == level);
+}
+
+int
+main(int argc, char **argv)
+{
+    int samples = argc > 1 ? atoi(argv[1]) : 5000;
+    struct battery_filter filter;
+    int readings[BATTERY_OVERSAMPLE];
+    int level, last_level = -1, changes = 0, min_step = 100;
+
+    CHECK(samples > 0);
+    test_median();
+    test_dips();
+
+    battery_filter_init(&filter);
+    CHECK(filter.level == -1);
+
+    int64_t start_ns = test_now_ns();
+
+    // linear discharge, then a while at empty
+    for (int i = 0; i < samples + samples / 10; ++i) {
+        int mv = i < samples ? FULL_MV - (FULL_MV - EMPTY_MV) * i / samples : EMPTY_MV;
+
+        sample(readings, mv, i);
+        level = battery_filter_step(&filter, readings, BATTERY_OVERSAMPLE, HYSTERESIS);
+        CHECK(level >= 0 && level <= 100);
+        if (last_level >= 0 && level != last_level) {
+            CHECK(level < last_level);
+            if (level != 0) {
+                CHECK(last_level - level >= HYSTERESIS);
+            }
+            if (last_level - level < min_step) {
+                min_step = last_level - level;
+            }
+            changes++;
+        }
+        last_level = level;
+    }
+
+    int64_t elapsed_ns = test_now_ns() - start_ns;
+
+    CHECK(level == 0);
+    // level can not change more often than hysteresis allows
+    CHECK(changes <= 100 / HYSTERESIS + 1);
+
+    // charger is plugged in: full is reported as soon as it is reached
+    for (int i = 0; i < 100 && level != 100; ++i) {
+        sample(readings, FULL_MV + 50, i);
+        level = battery_filter_step(&filter, readings, BATTERY_OVERSAMPLE, HYSTERESIS);
+    }
+    CHECK(level == 100);
+
+    printf("{\"test\":\"battery_discharge\",\"samples\":%d,\"level_changes\":%d,\"min_step\":%d,"
+        "\"final_level\":%d,\"ns_per_step\":%.1f}\n",
+        samples, changes, min_step, last_level,
+        (double)elapsed_ns / (samples + samples / 10));
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+Button ring SPSC test: producer thread pushes numbered events as fast as it can,
+consumer drains them and checks that none is lost, doubled or reordered.
+Full ring is retried by producer and counted as overflow. The same runs through
+a FreeRTOS queue of the shim (xQueueSend/xQueueReceive), the handoff the ring
+has replaced. Both consumers sleep until woken like app_main does: the ring one
+on task notification given after push, the queue one in xQueueReceive.
+Handoff latency is measured with one event in flight at a time, from push to
+receive, for every event. Prints one JSON line with both paths.
+
+    test_btn_ring [events]
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "btn_ring.h"
+#include "test.h"
+
+/* events of the latency run, one in flight at a time */
+#define TEST_LATENCY_EVENTS 20000
+
+struct handoff {
+    const char *name;
+    void (*init)(void);
+    void (*send)(const struct btn_event *event);
+    /* waits for events, returns number moved to out */
+    int (*receive)(struct btn_event *out, int max_events);
+};
+
+static struct btn_ring Ring;
+static TaskHandle_t Consumer;
+static uint32_t Push_failures;
+static QueueHandle_t Queue;
+
+static const struct handoff *Path;
+static uint32_t Events;
+static bool Paced;
+static int64_t *Sent_ns;
+/* events received, the paced producer waits for it */
+static atomic_uint Received;
+
+static void
+ring_init(void)
+{
+    btn_ring_init(&Ring, Consumer);
+    Push_failures = 0;
+}
+
+static void
+ring_send(const struct btn_event *event)
+{
+    while (!btn_ring_push(&Ring, event)) {
+        Push_failures++;
+        sched_yield();
+    }
+    xTaskNotifyGive(Ring.consumer);
+}
+
+static int
+ring_receive(struct btn_event *out, int max_events)
+{
+    int count;
+
+    while (!(count = btn_ring_drain(&Ring, out, max_events))) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    return count;
+}
+
+static void
+queue_init(void)
+{
+    if (Queue) {
+        vQueueDelete(Queue);
+    }
+    Queue = xQueueCreate(BTN_RING_SIZE, sizeof(struct btn_event));
+    CHECK(Queue);
+}
+
+static void
+queue_send(const struct btn_event *event)
+{
+    CHECK(xQueueSend(Queue, event, portMAX_DELAY) == pdTRUE);
+}
+
+static int
+queue_receive(struct btn_event *out, int max_events)
+{
+    (void)max_events;
+    CHECK(xQueueReceive(Queue, out, portMAX_DELAY) == pdTRUE);
+    return 1;
+}
+
+static const struct handoff Paths[] = {
+    { "ring",   ring_init,  ring_send,  ring_receive },
+    { "queue",  queue_init, queue_send, queue_receive },
+};
+
+static void *
+producer(void *arg)
+{
+    (void)arg;
+    for (uint32_t i = 0; i < Events; ++i) {
+        struct btn_event event = { .button = i, .edge_us = i * 3, .debounced_us = ~i };
+
+        while (Paced && atomic_load_explicit(&Received, memory_order_acquire) != i) {
+            sched_yield();
+        }
+        Sent_ns[i] = test_now_ns();
+        Path->send(&event);
+    }
+    return NULL;
+}
+
+static int
+compare_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* consumer side of one run, returns elapsed ns; latencies are sorted into Sent_ns */
+static int64_t
+run(const struct handoff *path, uint32_t events, bool paced, uint32_t *receives)
+{
+    struct btn_event out[BTN_RING_SIZE];
+    pthread_t thread;
+    uint32_t next = 0;
+
+    Path = path;
+    Events = events;
+    Paced = paced;
+    atomic_store(&Received, 0);
+    path->init();
+    *receives = 0;
+
+    int64_t start_ns = test_now_ns();
+
+    CHECK(pthread_create(&thread, NULL, producer, NULL) == 0);
+    while (next < events) {
+        int count = path->receive(out, BTN_RING_SIZE);
+        int64_t now_ns = test_now_ns();
+
+        CHECK(count > 0 && count <= BTN_RING_SIZE);
+        for (int i = 0; i < count; ++i, ++next) {
+            // torn or stale slot shows up as a mismatch of any field
+            CHECK(out[i].button == next);
+            CHECK(out[i].edge_us == next * 3);
+            CHECK(out[i].debounced_us == ~next);
+            Sent_ns[next] = now_ns - Sent_ns[next];
+        }
+        (*receives)++;
+        atomic_store_explicit(&Received, next, memory_order_release);
+    }
+    pthread_join(thread, NULL);
+
+    int64_t elapsed_ns = test_now_ns() - start_ns;
+
+    qsort(Sent_ns, events, sizeof(Sent_ns[0]), compare_ns);
+    return elapsed_ns;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t events = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+    uint32_t latency_events = events < TEST_LATENCY_EVENTS ? events : TEST_LATENCY_EVENTS;
+    uint32_t receives, overflows = 0;
+
+    CHECK(events > 0);
+    Sent_ns = malloc(events * sizeof(Sent_ns[0]));
+    CHECK(Sent_ns);
+    Consumer = xTaskGetCurrentTaskHandle();
+
+    printf("{\"test\":\"btn_ring_spsc\",\"events\":%u,\"latency_events\":%u", events, latency_events);
+    for (size_t p = 0; p < sizeof(Paths) / sizeof(Paths[0]); ++p) {
+        const struct handoff *path = &Paths[p];
+        int64_t elapsed_ns = run(path, events, false, &receives);
+
+        if (path->init == ring_init) {
+            struct btn_event rest;
+
+            CHECK(btn_ring_drain(&Ring, &rest, 1) == 0);
+            CHECK(btn_ring_overflows(&Ring) == Push_failures);
+            overflows = Push_failures;
+        }
+        printf(",\"%s_events_per_sec\":%.0f,\"%s_ns_per_event\":%.1f,\"%s_receives\":%u",
+            path->name, elapsed_ns ? events * 1e9 / elapsed_ns : 0.0,
+            path->name, (double)elapsed_ns / events, path->name, receives);
+
+        run(path, latency_events, true, &receives);
+        printf(",\"%s_p50_ns\":%lld,\"%s_p99_ns\":%lld",
+            path->name, (long long)Sent_ns[latency_events / 2],
+            path->name, (long long)Sent_ns[(uint64_t)latency_events * 99 / 100]);
+    }
+    printf(",\"ring_overflows\":%u}\n", overflows);
+    free(Sent_ns);
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+Debounce engine test on a simulated microsecond clock: rattle inside the
+window gives one settled event, settle time is found across the wrap of
+the 32-bit clock, refused events are retried and an edge coming while the
+button is read keeps it rattling. Prints one JSON line.
+*/
+
+#include "debounce.h"
+#include "test.h"
+
+#define WINDOW_US 5000
+
+static uint32_t Now_us;
+static int Settled[2];
+static bool Accept = true;
+static int Edge_in_callback = -1;
+static struct debounce Db;
+
+static uint32_t
+sim_clock(void)
+{
+    return Now_us;
+}
+
+static bool
+settled(int button_idx, void *arg)
+{
+    (void)arg;
+    if (Edge_in_callback == button_idx) {
+        // contact moves again while its level is being read
+        Edge_in_callback = -1;
+        debounce_edge(&Db, button_idx);
+    }
+    if (!Accept) {
+        return false;
+    }
+    Settled[button_idx]++;
+    return true;
+}
+
+static void
+setup(struct debounce_button *buttons, uint32_t start_us)
+{
+    Now_us = start_us;
+    Settled[0] = Settled[1] = 0;
+    Accept = true;
+    Edge_in_callback = -1;
+    debounce_init(&Db, buttons, 2, sim_clock);
+    buttons[0].window_us = WINDOW_US;
+    buttons[1].window_us = WINDOW_US * 2;
+}
+
+static void
+test_rattle(uint32_t start_us)
+{
+    struct debounce_button buttons[2];
+
+    setup(buttons, start_us);
+    CHECK(debounce_poll(&Db, settled, NULL) == DEBOUNCE_IDLE);
+
+    // only the first edge of rattling wakes the poller up
+    CHECK(debounce_edge(&Db, 0));
+    for (int i = 0; i < 20; ++i) {
+        Now_us += 200;
+        CHECK(!debounce_edge(&Db, 0));
+        CHECK(debounce_poll(&Db, settled, NULL) == WINDOW_US);
+    }
+    Now_us += WINDOW_US - 1;
+    CHECK(debounce_poll(&Db, settled, NULL) == 1);
+    CHECK(Settled[0] == 0);
+    Now_us += 1;
+    CHECK(debounce_poll(&Db, settled, NULL) == DEBOUNCE_IDLE);
+    CHECK(Settled[0] == 1);
+    CHECK(Settled[1] == 0);
+
+    // late poll settles it once too
+    CHECK(debounce_edge(&Db, 0));
+    Now_us += WINDOW_US * 10;
+    CHECK(debounce_poll(&Db, settled, NULL) == DEBOUNCE_IDLE);
+    CHECK(Settled[0] == 2);
+}
+
+/* two buttons: poll waits for the earliest one */
+static void
+test_two_buttons(uint32_t start_us)
+{
+    struct debounce_button buttons[2];
+
+    setup(buttons, start_us);
+    CHECK(debounce_edge(&Db, 1));
+    Now_us += 1000;
+    CHECK(debounce_edge(&Db, 0));
+    CHECK(debounce_poll(&Db, settled, NULL) == WINDOW_US);
+    Now_us += WINDOW_US;
+    CHECK(debounce_poll(&Db, settled, NULL) == WINDOW_US * 2 - WINDOW_US - 1000);
+    CHECK(Settled[0] == 1 && Settled[1] == 0);
+    Now_us += WINDOW_US - 1000;
+    CHECK(debounce_poll(&Db, settled, NULL) == DEBOUNCE_IDLE);
+    CHECK(Settled[1] == 1);
+}
+
+static void
+test_retry(uint32_t start_us)
+{
+    struct debounce_button buttons[2];
+
+    setup(buttons, start_us);
+    CHECK(debounce_edge(&Db, 0));
+    Now_us += WINDOW_US;
+    Accept = false;
+    CHECK(debounce_poll(&Db, settled, NULL) == Db.retry_us);
+    Accept = true;
+    Now_us += Db.retry_us;
+    CHECK(debounce_poll(&Db, settled, NULL) == DEBOUNCE_IDLE);
+    CHECK(Settled[0] == 1);
+}
+
+static void
+test_edge_in_callback(uint32_t start_us)
+{
+    struct debounce_button buttons[2];
+
+    setup(buttons, start_us);
+    CHECK(debounce_edge(&Db, 0));
+    Now_us += WINDOW_US;
+    Edge_in_callback = 0;
+    // the level read is not final, button rattles for one more window
+    CHECK(debounce_poll(&Db, settled, NULL) == WINDOW_US);
+    CHECK(Settled[0] == 1);
+    Now_us += WINDOW_US;
+    CHECK(debounce_poll(&Db, settled, NULL) == DEBOUNCE_IDLE);
+    CHECK(Settled[0] == 2);
+}
+
+/* settle time 0 means stable button, so rattle ending at 0 ends 1 us later */
+static void
+test_settle_at_zero(void)
+{
+    struct debounce_button buttons[2];
+
+    setup(buttons, (uint32_t)-WINDOW_US);
+    CHECK(debounce_edge(&Db, 0));
+    Now_us += WINDOW_US;
+    CHECK(Now_us == 0);
+    CHECK(debounce_poll(&Db, settled, NULL) == 1);
+    CHECK(Settled[0] == 0);
+    Now_us += 1;
+    CHECK(debounce_poll(&Db, settled, NULL) == DEBOUNCE_IDLE);
+    CHECK(Settled[0] == 1);
+}
+
+int
+main(void)
+{
+    // settle time far from the wrap, just before it and across it
+    static const uint32_t starts[] = {
+        1000,
+        UINT32_MAX - WINDOW_US,
+        UINT32_MAX - 2000,
+        UINT32_MAX,
+    };
+    int cases = 0;
+
+    for (size_t i = 0; i < sizeof(starts) / sizeof(starts[0]); ++i) {
+        test_rattle(starts[i]);
+        test_two_buttons(starts[i]);
+        test_retry(starts[i]);
+        test_edge_in_callback(starts[i]);
+        cases += 4;
+    }
+    test_settle_at_zero();
+    cases++;
+
+    printf("{\"test\":\"debounce\",\"cases\":%d}\n", cases);
+    return 0;
+}
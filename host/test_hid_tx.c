@@ -0,0 +1,119 @@
+/*
+TX credit test: the shim fails sends with ENOMEM (retried) and with EINVAL
+(dropped) and raises NOTIFY_TX for them inside the send call like NimBLE does.
+Every failed send must return its credit exactly once: while a report is being
+sent it holds a credit, so the central must see less than CONFIG_HID_TX_CREDITS
+free, and all credits must be back when the pipeline is drained. Runs with
+notifications and with indications. Prints one JSON line.
+
+    test_hid_tx [key changes per delivery]
+*/
+
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "sdkconfig.h"
+
+#include "central.h"
+#include "hid_codes.h"
+#include "hid_func.h"
+#include "hid_tx.h"
+#include "test.h"
+
+/* time without input after which the pipeline must be idle, covers the TX task wakeup */
+#define TEST_QUIET_US 5000
+
+static atomic_int Credits_max;
+
+static void
+credits_sample(void)
+{
+    int credits = hid_tx_credits();
+    int max = atomic_load(&Credits_max);
+
+    while (credits > max && !atomic_compare_exchange_weak(&Credits_max, &max, credits)) {
+    }
+}
+
+static void
+rx_hook(uint16_t conn_handle, uint16_t attr_handle, bool indication)
+{
+    (void)conn_handle;
+    (void)attr_handle;
+    (void)indication;
+    // called inside the send, the report being sent holds one credit
+    CHECK(hid_tx_credits() < CONFIG_HID_TX_CREDITS);
+    credits_sample();
+}
+
+/* waits for the pipeline and checks the credits meanwhile */
+static void
+drain(void)
+{
+    for (int ms = 0; ms < 2000 && hid_input_busy(TEST_QUIET_US); ++ms) {
+        credits_sample();
+        sched_yield();
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    central_drain();
+    credits_sample();
+    CHECK(hid_tx_credits() == CONFIG_HID_TX_CREDITS);
+}
+
+/* key change must reach the central */
+static void
+change_key(uint8_t key, bool pressed)
+{
+    unsigned received = central_received();
+
+    CHECK(hid_keyboard_change_key(key, pressed) == 0);
+    drain();
+    CHECK(central_received() > received);
+}
+
+/* returns reports received */
+static unsigned
+run(uint16_t conn_handle, bool indicate, uint32_t changes)
+{
+    unsigned received = central_received();
+
+    central_connect(conn_handle, indicate);
+    for (uint32_t i = 0; i < changes; ++i) {
+        // some sends fail for lack of mbufs, then are retried and delivered
+        shim_ble_fail_tx(i % 4, BLE_HS_ENOMEM);
+        change_key(HID_KEY_A + (i / 2) % 26, !(i & 1));
+    }
+
+    // failed send which is not retried, the next report is delivered
+    shim_ble_fail_tx(1, BLE_HS_EINVAL);
+    CHECK(hid_keyboard_change_key(HID_KEY_Z, true) == 0);
+    drain();
+    change_key(HID_KEY_Z, false);
+
+    central_disconnect(conn_handle);
+    return central_received() - received;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t changes = argc > 1 ? strtoul(argv[1], NULL, 0) : 200;
+    unsigned notified, indicated;
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    central_init();
+    central_set_rx_hook(rx_hook);
+
+    notified = run(1, false, changes);
+    indicated = run(2, true, changes);
+
+    CHECK(atomic_load(&Credits_max) <= CONFIG_HID_TX_CREDITS);
+    printf("{\"test\":\"hid_tx\",\"changes\":%u,\"notified\":%u,\"indicated\":%u,"
+        "\"credits\":%d,\"credits_max\":%d}\n",
+        changes, notified, indicated, hid_tx_credits(), atomic_load(&Credits_max));
+    return 0;
+}
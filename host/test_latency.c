@@ -0,0 +1,86 @@
+/*
+Latency trace test: every key change is traced like a button event of app_main
+and must reach the NOTIFY_TX stage, which the shim raises inside the send call
+like NimBLE does. Some sends fail with ENOMEM, their traces complete on retry.
+The central reads the histograms from the latency characteristic, the total
+histogram must count every change. Runs with notifications and with
+indications. Prints one JSON line.
+
+    test_latency [key changes per delivery]
+*/
+
+#include "esp_log.h"
+#include "host/ble_hs.h"
+
+#include "central.h"
+#include "gatt_svr.h"
+#include "hid_codes.h"
+#include "hid_func.h"
+#include "hid_latency.h"
+#include "test.h"
+
+/* header of the latency characteristic value */
+#define TEST_LAT_HEADER 4
+
+/* traces in histogram, hist is HID_LAT_HIST_TOTAL or a stage */
+static uint32_t
+traces(uint16_t conn_handle, int hist)
+{
+    uint8_t data[TEST_LAT_HEADER + HID_LAT_STAGE_COUNT * HID_LAT_BUCKETS * 4];
+    uint16_t len = sizeof(data);
+    uint32_t count = 0;
+
+    CHECK(shim_gatt_read(conn_handle, Svc_char_handles[HANDLE_DIAG_LATENCY], data, &len) == 0);
+    CHECK(len == sizeof(data));
+    CHECK(data[1] == HID_LAT_STAGE_COUNT && data[2] == HID_LAT_BUCKETS);
+    for (int i = 0; i < HID_LAT_BUCKETS; ++i) {
+        const uint8_t *bucket = &data[TEST_LAT_HEADER + (hist * HID_LAT_BUCKETS + i) * 4];
+
+        count += bucket[0] | bucket[1] << 8 | bucket[2] << 16 | (uint32_t)bucket[3] << 24;
+    }
+    return count;
+}
+
+/* returns traces completed */
+static uint32_t
+run(uint16_t conn_handle, bool indicate, uint32_t changes)
+{
+    const uint8_t reset = HID_LAT_CMD_RESET;
+    uint32_t total;
+
+    central_connect(conn_handle, indicate);
+    CHECK(shim_gatt_write(conn_handle, Svc_char_handles[HANDLE_DIAG_LATENCY], &reset, 1) == 0);
+    for (uint32_t i = 0; i < changes; ++i) {
+        unsigned received = central_received();
+
+        shim_ble_fail_tx(i % 3, BLE_HS_ENOMEM);
+        // button event without edge time, like a matrix key
+        hid_latency_begin(0, HID_LAT_NOW());
+        CHECK(hid_keyboard_change_key(HID_KEY_A + (i / 2) % 26, !(i & 1)) == 0);
+        central_drain();
+        CHECK(central_received() > received);
+    }
+
+    total = traces(conn_handle, HID_LAT_HIST_TOTAL);
+    CHECK(total == changes);
+    CHECK(traces(conn_handle, HID_LAT_NOTIFY_TX) == changes);
+    central_disconnect(conn_handle);
+    return total;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t changes = argc > 1 ? strtoul(argv[1], NULL, 0) : 200;
+    uint32_t notified, indicated;
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    central_init();
+
+    notified = run(1, false, changes);
+    indicated = run(2, true, changes);
+
+    printf("{\"test\":\"latency\",\"changes\":%u,\"notify_traces\":%u,\"indicate_traces\":%u}\n",
+        changes, notified, indicated);
+    return 0;
+}
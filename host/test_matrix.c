@@ -0,0 +1,257 @@
+/*
+Keyboard matrix test on a simulated 10x10 matrix without diodes: selected row
+reads every column connected to it through pressed keys, so three keys in the
+corners of a rectangle show the fourth one. Every key is pressed alone, then
+the 3-corner pattern, then random chords. No event may report a key which is
+not pressed, unambiguous chords must be reported completely. Prints one JSON
+line with scan-to-event latency in scans, time per scan includes the simulation.
+
+    test_matrix [random changes]
+*/
+
+#include <string.h>
+
+#include "matrix.h"
+#include "test.h"
+
+#define ROWS            10
+#define COLS            10
+#define DEBOUNCE_SCANS  2
+/* scans after a change until everything is reported */
+#define SETTLE_SCANS    (DEBOUNCE_SCANS + 2)
+/* most keys held at once in random test */
+#define CHORD_MAX       4
+
+static bool Keys[ROWS][COLS];
+static int Selected = -1;
+
+static struct {
+    uint32_t events;
+    uint32_t latencies;
+    uint32_t latency_total;
+    uint32_t latency_max;
+    int changed_row, changed_col;
+    uint32_t changed_scan;
+} Stats;
+
+static struct matrix Matrix;
+
+static void
+select_row(int row, void *arg)
+{
+    (void)arg;
+    Selected = row;
+}
+
+static void
+unselect_row(int row, void *arg)
+{
+    (void)arg;
+    (void)row;
+    Selected = -1;
+}
+
+/* columns connected to the selected row through pressed keys */
+static uint32_t
+read_cols(void *arg)
+{
+    uint32_t rows = 1UL << Selected, cols = 0, old_rows;
+
+    (void)arg;
+    do {
+        old_rows = rows;
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                if (Keys[row][col] && ((rows >> row) & 1)) {
+                    cols |= 1UL << col;
+                }
+                if (Keys[row][col] && ((cols >> col) & 1)) {
+                    rows |= 1UL << row;
+                }
+            }
+        }
+    } while (rows != old_rows);
+    return cols;
+}
+
+static bool
+matrix_event(int row, int col, bool pressed, void *arg)
+{
+    (void)arg;
+    CHECK(row >= 0 && row < ROWS && col >= 0 && col < COLS);
+    // phantom key of a rectangle must never be reported
+    CHECK(Keys[row][col] == pressed);
+    if (row == Stats.changed_row && col == Stats.changed_col) {
+        uint32_t latency = Matrix.scans - Stats.changed_scan;
+
+        Stats.latencies++;
+        Stats.latency_total += latency;
+        if (latency > Stats.latency_max) {
+            Stats.latency_max = latency;
+        }
+        Stats.changed_row = -1;
+    }
+    Stats.events++;
+    return true;
+}
+
+static void
+key_set(int row, int col, bool pressed)
+{
+    Keys[row][col] = pressed;
+    Stats.changed_row = row;
+    Stats.changed_col = col;
+    Stats.changed_scan = Matrix.scans;
+}
+
+static void
+settle(void)
+{
+    for (int i = 0; i < SETTLE_SCANS; ++i) {
+        matrix_scan(&Matrix, matrix_event, NULL);
+    }
+}
+
+static uint32_t
+row_keys(int row)
+{
+    uint32_t keys = 0;
+
+    for (int col = 0; col < COLS; ++col) {
+        keys |= (uint32_t)Keys[row][col] << col;
+    }
+    return keys;
+}
+
+/* chord can be read without phantom keys: no two rows share a column when one of them has many keys */
+static bool
+chord_unambiguous(void)
+{
+    for (int a = 0; a < ROWS; ++a) {
+        for (int b = 0; b < ROWS; ++b) {
+            uint32_t ka = row_keys(a), kb = row_keys(b);
+
+            if (a != b && (ka & kb) && ((ka & (ka - 1)) || (kb & (kb - 1)))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void
+check_state(void)
+{
+    for (int row = 0; row < ROWS; ++row) {
+        CHECK(Matrix.state[row] == row_keys(row));
+    }
+}
+
+static void
+test_single_keys(void)
+{
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            uint32_t events = Stats.events;
+
+            key_set(row, col, true);
+            settle();
+            CHECK(Stats.events == events + 1);
+            key_set(row, col, false);
+            settle();
+            CHECK(Stats.events == events + 2);
+            check_state();
+        }
+    }
+    CHECK(!matrix_scan(&Matrix, matrix_event, NULL));
+}
+
+/* keys (2,3), (2,7) and (6,3) make phantom (6,7) */
+static void
+test_ghost(void)
+{
+    uint32_t blocks = Matrix.ghost_blocks;
+    uint32_t events = Stats.events;
+
+    key_set(2, 3, true);
+    settle();
+    key_set(2, 7, true);
+    settle();
+    CHECK(Stats.events == events + 2);
+
+    key_set(6, 3, true);
+    settle();
+    // third key is held back with the phantom until the rectangle is broken
+    CHECK(Stats.events == events + 2);
+    CHECK(Matrix.ghost_blocks > blocks);
+    CHECK(!(Matrix.state[6] & (1UL << 7)));
+
+    key_set(2, 7, false);
+    settle();
+    // release of (2,7) and the held back press of (6,3)
+    CHECK(Stats.events == events + 4);
+    check_state();
+
+    key_set(2, 3, false);
+    key_set(6, 3, false);
+    settle();
+    check_state();
+}
+
+static void
+test_random(uint32_t changes)
+{
+    uint32_t seed = 12345;
+    int held = 0;
+
+    for (uint32_t done = 0; done < changes;) {
+        seed = seed * 1103515245 + 12345;
+        int key = (seed >> 16) % (ROWS * COLS);
+        int row = key / COLS, col = key % COLS;
+
+        if (Keys[row][col]) {
+            key_set(row, col, false);
+            held--;
+        } else if (held < CHORD_MAX) {
+            key_set(row, col, true);
+            held++;
+        } else {
+            // chord is full, pick another key
+            continue;
+        }
+        done++;
+        settle();
+        if (chord_unambiguous()) {
+            check_state();
+        }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const struct matrix_hw hw = {
+        .select_row = select_row,
+        .unselect_row = unselect_row,
+        .read_cols = read_cols,
+    };
+    uint32_t changes = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+
+    matrix_init(&Matrix, ROWS, COLS, &hw, DEBOUNCE_SCANS);
+    Stats.changed_row = -1;
+
+    int64_t start_ns = test_now_ns();
+
+    test_single_keys();
+    test_ghost();
+    test_random(changes);
+
+    int64_t elapsed_ns = test_now_ns() - start_ns;
+
+    printf("{\"test\":\"matrix_ghosting\",\"keys\":%d,\"scans\":%u,\"events\":%u,\"ghost_blocks\":%u,"
+        "\"scan_to_event_avg\":%.2f,\"scan_to_event_max\":%u,\"ns_per_scan\":%.1f}\n",
+        ROWS * COLS, Matrix.scans, Matrix.events, Matrix.ghost_blocks,
+        Stats.latencies ? (double)Stats.latency_total / Stats.latencies : 0.0, Stats.latency_max,
+        (double)elapsed_ns / Matrix.scans);
+    return 0;
+}
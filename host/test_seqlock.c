@@ -0,0 +1,99 @@
+/*
+Report buffer seqlock test: writer thread fills the feature report with one
+byte value again and again through hid_write_buffer, the central reads it by
+ATT at the same time. Every snapshot must have all bytes equal, a torn copy
+means writer and reader were not synchronized. Prints one JSON line.
+
+    test_seqlock [writes]
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "host/ble_hs.h"
+
+#include "dlog.h"
+#include "flight_rec.h"
+#include "gatt_svr.h"
+#include "hid_func.h"
+#include "test.h"
+
+#define TEST_CONN_HANDLE 1
+
+static uint32_t Writes;
+static atomic_bool Writer_done;
+
+static void
+feature_write(uint8_t value)
+{
+    uint8_t data[HIDD_LE_REPORT_FEATURE_SIZE];
+    struct os_mbuf *om;
+
+    memset(data, value, sizeof(data));
+    om = ble_hs_mbuf_from_flat(data, sizeof(data));
+    CHECK(om);
+    CHECK(hid_write_buffer(TEST_CONN_HANDLE, om, HANDLE_HID_FEATURE_REPORT) == 0);
+    os_mbuf_free_chain(om);
+}
+
+static void *
+writer(void *arg)
+{
+    (void)arg;
+    for (uint32_t i = 0; i < Writes; ++i) {
+        feature_write(i);
+        if (!(i & 63)) {
+            // let reader in on a single CPU too
+            sched_yield();
+        }
+    }
+    atomic_store(&Writer_done, true);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint16_t feature_handle;
+    pthread_t thread;
+    uint32_t reads = 0;
+
+    Writes = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+
+    // every ATT access is logged by DLOG, its ring overflows here
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    dlog_init();
+    flight_rec_init();
+    ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
+    CHECK(gatt_svr_init() == 0);
+    shim_ble_connect(TEST_CONN_HANDLE, 0);
+    feature_handle = Svc_char_handles[HANDLE_HID_FEATURE_REPORT];
+    // initial report value is not uniform
+    feature_write(0);
+
+    int64_t start_ns = test_now_ns();
+
+    CHECK(pthread_create(&thread, NULL, writer, NULL) == 0);
+    while (!atomic_load(&Writer_done)) {
+        uint8_t data[HIDD_LE_REPORT_FEATURE_SIZE + 1];
+        uint16_t len = sizeof(data);
+
+        CHECK(shim_gatt_read(TEST_CONN_HANDLE, feature_handle, data, &len) == 0);
+        CHECK(len == HIDD_LE_REPORT_FEATURE_SIZE);
+        for (int i = 1; i < len; ++i) {
+            CHECK(data[i] == data[0]);
+        }
+        reads++;
+    }
+    pthread_join(thread, NULL);
+
+    int64_t elapsed_ns = test_now_ns() - start_ns;
+
+    CHECK(reads > 0);
+    printf("{\"test\":\"report_seqlock\",\"writes\":%u,\"reads\":%u,\"report_size\":%d,"
+        "\"reads_per_sec\":%.0f}\n",
+        Writes, reads, HIDD_LE_REPORT_FEATURE_SIZE, elapsed_ns ? reads * 1e9 / elapsed_ns : 0.0);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_BATTERY_ADC
+#include "driver/adc.h"
+#include "esp_adc_cal.h"
+#endif
+
+#include "battery.h"
+#include "hid_func.h"
+
+static const char *tag = "NimBLEKBD_BATTERY";
+
+/* input must be quiet this long before level is notified */
+#define BATTERY_QUIET_US 500000
+/* poll period while waiting for quiet input */
+#define BATTERY_QUIET_POLL_MS 100
+
+static struct battery {
+    battery_source_t source;
+    void *ctx;
+    struct battery_filter filter;
+    // statistics
+    uint32_t samples;
+    uint32_t notifications;
+    uint32_t deferred;          // notifications which waited for input burst end
+} Battery;
+
+#ifdef CONFIG_BATTERY_ADC
+
+/* ADC reference voltage when eFuse has no calibration */
+#define BATTERY_ADC_VREF_MV 1100
+
+static esp_adc_cal_characteristics_t Adc_chars;
+
+static int
+battery_adc_read(void *ctx)
+{
+    int raw = adc1_get_raw(CONFIG_BATTERY_ADC_CHANNEL);
+
+    if (raw < 0) {
+        return -1;
+    }
+    return esp_adc_cal_raw_to_voltage(raw, &Adc_chars) * CONFIG_BATTERY_DIVIDER_PERCENT / 100;
+}
+
+static void
+battery_adc_init(void)
+{
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten(CONFIG_BATTERY_ADC_CHANNEL, ADC_ATTEN_DB_11);
+    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, BATTERY_ADC_VREF_MV, &Adc_chars);
+}
+
+#endif
+
+static void
+battery_task(void *param)
+{
+    int mv[BATTERY_OVERSAMPLE];
+
+    (void)param;
+    for (;;) {
+        for (int i = 0; i < BATTERY_OVERSAMPLE; ++i) {
+            mv[i] = Battery.source(Battery.ctx);
+        }
+        Battery.samples++;
+
+        int level = battery_filter_step(&Battery.filter, mv, BATTERY_OVERSAMPLE, CONFIG_BATTERY_HYSTERESIS);
+
+        if (level >= 0 && level != hid_battery_level_get()) {
+            // battery notification must not take airtime of key reports
+            if (hid_input_busy(BATTERY_QUIET_US)) {
+                Battery.deferred++;
+                do {
+                    vTaskDelay(pdMS_TO_TICKS(BATTERY_QUIET_POLL_MS));
+                } while (hid_input_busy(BATTERY_QUIET_US));
+            }
+            hid_battery_level_set(level);
+            Battery.notifications++;
+            ESP_LOGI(tag, "level %d%%, %d mV, samples %u, notifications %u (deferred %u)",
+                level, Battery.filter.avg_mv, Battery.samples, Battery.notifications, Battery.deferred);
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_BATTERY_SAMPLE_MS));
+    }
+}
+
+void
+battery_init(battery_source_t source, void *ctx)
+{
+#ifdef CONFIG_BATTERY_ADC
+    if (!source) {
+        battery_adc_init();
+        source = battery_adc_read;
+    }
+#endif
+    if (!source) {
+        ESP_LOGI(tag, "no battery voltage source, level stays %d%%", hid_battery_level_get());
+        return;
+    }
+
+    Battery.source = source;
+    Battery.ctx = ctx;
+    battery_filter_init(&Battery.filter);
+
+    if (xTaskCreate(battery_task, "battery_task", 2048, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(tag, "Can not create battery_task!");
+        vTaskDelay(pdMS_TO_TICKS(30000));
+        esp_restart();
+    }
+}
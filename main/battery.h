@@ -0,0 +1,42 @@
+#ifndef H_BATTERY_
+#define H_BATTERY_
+
+#include <stdint.h>
+
+/*
+Battery level pipeline. Low priority task takes BATTERY_OVERSAMPLE voltage
+readings every CONFIG_BATTERY_SAMPLE_MS, their median drops spikes of radio TX
+load, moving average smooths the rest. Voltage goes to percent by the discharge
+curve of a Li-ion cell, the reported level moves only when it differs by
+CONFIG_BATTERY_HYSTERESIS percent or more, so it does not flip between two
+values. Changed level is notified when no input burst is being sent.
+
+Voltage source is a callback: ADC1 with a divider on the device
+(CONFIG_BATTERY_ADC), anything else for tests. Filter functions below do not
+depend on ESP-IDF, battery_filter.c builds on Linux, so a recorded discharge
+trace can be run through the same code.
+*/
+
+/* readings taken for one sample */
+#define BATTERY_OVERSAMPLE 9
+
+/* battery voltage in mV, negative if it can not be read */
+typedef int (*battery_source_t)(void *ctx);
+
+struct battery_filter {
+    int32_t avg_mv;             // moving average, 0 before the first sample
+    int level;                  // reported level, -1 before the first sample
+};
+
+extern void battery_filter_init(struct battery_filter *filter);
+/* median of readings, readings are reordered */
+extern int battery_median(int *mv, int count);
+/* percent of Li-ion discharge curve for voltage */
+extern int battery_mv_to_percent(int mv);
+/* feeds readings of one sample, returns level to report */
+extern int battery_filter_step(struct battery_filter *filter, int *mv, int count, int hysteresis);
+
+/* starts the task, source NULL is the ADC when CONFIG_BATTERY_ADC is set, otherwise level stays as it is */
+extern void battery_init(battery_source_t source, void *ctx);
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+
+#include "battery.h"
+
+/* moving average takes 1/BATTERY_AVG_WEIGHT of each new sample */
+#define BATTERY_AVG_WEIGHT 4
+
+/* Li-ion cell under light load, voltage falls with level */
+static const struct battery_curve_point {
+    int mv;
+    int percent;
+} Battery_curve[] = {
+    { 4200, 100 },
+    { 4100,  90 },
+    { 4000,  79 },
+    { 3900,  62 },
+    { 3800,  42 },
+    { 3750,  30 },
+    { 3700,  18 },
+    { 3650,  10 },
+    { 3550,   4 },
+    { 3300,   0 },
+};
+
+#define BATTERY_CURVE_POINTS (sizeof(Battery_curve) / sizeof(Battery_curve[0]))
+
+void
+battery_filter_init(struct battery_filter *filter)
+{
+    filter->avg_mv = 0;
+    filter->level = -1;
+}
+
+int
+battery_median(int *mv, int count)
+{
+    // insertion sort, there are only BATTERY_OVERSAMPLE readings
+    for (int i = 1; i < count; ++i) {
+        int value = mv[i];
+        int j = i;
+
+        for (; j > 0 && mv[j - 1] > value; --j) {
+            mv[j] = mv[j - 1];
+        }
+        mv[j] = value;
+    }
+    return mv[count / 2];
+}
+
+int
+battery_mv_to_percent(int mv)
+{
+    if (mv >= Battery_curve[0].mv) {
+        return Battery_curve[0].percent;
+    }
+    for (unsigned i = 1; i < BATTERY_CURVE_POINTS; ++i) {
+        const struct battery_curve_point *hi = &Battery_curve[i - 1], *lo = &Battery_curve[i];
+
+        if (mv >= lo->mv) {
+            // linear between points
+            return lo->percent + (mv - lo->mv) * (hi->percent - lo->percent) / (hi->mv - lo->mv);
+        }
+    }
+    return Battery_curve[BATTERY_CURVE_POINTS - 1].percent;
+}
+
+int
+battery_filter_step(struct battery_filter *filter, int *mv, int count, int hysteresis)
+{
+    int valid = 0, percent;
+
+    // failed readings are dropped
+    for (int i = 0; i < count; ++i) {
+        if (mv[i] >= 0) {
+            mv[valid++] = mv[i];
+        }
+    }
+    if (!valid) {
+        return filter->level;
+    }
+
+    int median = battery_median(mv, valid);
+
+    if (filter->avg_mv == 0) {
+        filter->avg_mv = median;
+    } else {
+        filter->avg_mv += (median - filter->avg_mv) / BATTERY_AVG_WEIGHT;
+    }
+
+    percent = battery_mv_to_percent(filter->avg_mv);
+    if (filter->level < 0 || abs(percent - filter->level) >= hysteresis ||
+        // empty and full are reported as soon as they are reached
+        (percent != filter->level && (percent == 0 || percent == 100))) {
+        filter->level = percent;
+    }
+    return filter->level;
+}
@@ -1,5 +1,9 @@
+#include <inttypes.h>
+#include <stdio.h>
+
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 /* BLE */
 #include "console/console.h"
@@ -8,6 +12,10 @@
 
 #include "gatt_svr.h"
 #include "hid_func.h"
+#include "conn_params.h"
+#include "flight_rec.h"
+#include "dlog.h"
+#include "boot_time.h"
 
 #define MAC2STR_REV(a) (a)[5], (a)[4], (a)[3], (a)[2], (a)[1], (a)[0]
 
@@ -16,6 +24,42 @@ static const char *tag = "NimBLEKBD_BLEFUNC";
 static int bleprph_gap_event(struct ble_gap_event *event, void *arg);
 static uint8_t own_addr_type;
 
+#ifdef CONFIG_BT_NIMBLE_MAX_BONDS
+#define ADV_MAX_BONDS CONFIG_BT_NIMBLE_MAX_BONDS
+#else
+#define ADV_MAX_BONDS 3
+#endif
+
+/*
+Reconnection. When the link is lost and bonds exist, the last bonded host is
+called first by high duty directed advertising, the controller stops each
+burst after 1.28 s and bursts are repeated for CONFIG_ADV_DIRECTED_MS. Then
+undirected advertising accepts only bonded hosts for CONFIG_ADV_ACCEPT_LIST_MS,
+after that anyone can connect. Without bonds advertising is open at once.
+*/
+enum adv_phase {
+    ADV_PHASE_DIRECTED,
+    ADV_PHASE_ACCEPT_LIST,
+    ADV_PHASE_OPEN,
+    ADV_PHASE_COUNT
+};
+
+static const char *Adv_phase_names[] = { "directed", "accept list", "open" };
+
+static struct adv_state {
+    enum adv_phase phase;
+    int64_t phase_start_us;
+    int64_t lost_us;            // time of disconnect or boot, 0 when nobody waits for reconnection
+    bool last_peer_valid;
+    ble_addr_t last_peer;       // identity address of the last bonded host
+    uint16_t last_peer_conn;    // its connection, BLE_HS_CONN_HANDLE_NONE if it is not connected
+    // statistics
+    uint32_t reconnects[ADV_PHASE_COUNT];
+    int64_t reconnect_max_us;
+} Adv = {
+    .last_peer_conn = BLE_HS_CONN_HANDLE_NONE,
+};
+
 /**
  * Logs information about a connection to the console.
  */
@@ -44,33 +88,63 @@ bleprph_print_conn_desc(struct ble_gap_conn_desc *desc)
                 desc->sec_state.bonded);
 }
 
-int
-user_parse(const struct ble_hs_adv_field *data, void *arg)
-{
-    ESP_LOGI(tag, "Parse data: field len %d, type %x, total %d bytes",
-        data->length, data->type, data->length + 2); /* first byte type and second byte length */
-    return 1;
-}
+/*
+Advertising payloads are encoded once and loaded to controller as raw data,
+restarts of advertising reuse them. They are encoded again when device name
+or appearance differ from the encoded ones, and loaded again after host reset.
+Device name is in scan response, so primary payload has room for more fields.
+*/
 
-/**
- * Enables advertising with the following parameters:
- *     o General discoverable mode.
- *     o Undirected connectable mode.
- */
-static void
-bleprph_advertise(void)
+/* encoded primary payload: flags, TX power, advertising interval, appearance, HID service uuid16 */
+#define ADV_DATA_LEN (3 + 3 + 4 + 4 + 4)
+/* scan response is the name only, longer one is shortened */
+#define ADV_NAME_MAX_LEN (BLE_HS_ADV_MAX_SZ - 2)
+
+#ifdef CONFIG_BT_NIMBLE_GAP_DEVICE_NAME_MAX_LEN
+#define ADV_GAP_NAME_MAX_LEN CONFIG_BT_NIMBLE_GAP_DEVICE_NAME_MAX_LEN
+#else
+#define ADV_GAP_NAME_MAX_LEN 31
+#endif
+
+_Static_assert(ADV_DATA_LEN <= BLE_HS_ADV_MAX_SZ, "advertising data does not fit 31 bytes");
+_Static_assert(sizeof(CONFIG_BT_NIMBLE_SVC_GAP_DEVICE_NAME) - 1 <= ADV_NAME_MAX_LEN,
+    "device name is shortened in scan response, make it shorter");
+
+static struct adv_payload {
+    bool encoded;
+    bool loaded;                // payloads are set in controller
+    char name[ADV_GAP_NAME_MAX_LEN + 1];     // full name, to see when it changes
+    uint16_t appearance;
+    uint8_t data[BLE_HS_ADV_MAX_SZ];
+    uint8_t data_len;
+    uint8_t rsp[BLE_HS_ADV_MAX_SZ];
+    uint8_t rsp_len;
+    // statistics
+    uint32_t restarts;
+    int64_t restart_max_us;     // from bleprph_advertise call to advertising start
+} Adv_payload;
+
+/* encodes payloads if name or appearance has changed, returns 0 or BLE_HS_E* */
+static int
+adv_payload_encode(void)
 {
-    struct ble_gap_adv_params adv_params;
     struct ble_hs_adv_fields fields;
-    const char *name;
+    const char *name = ble_svc_gap_device_name();
+    uint16_t appearance = ble_svc_gap_device_appearance();
+    size_t name_len = strlen(name);
     int rc;
 
+    if (Adv_payload.encoded && Adv_payload.appearance == appearance &&
+        !strncmp(Adv_payload.name, name, sizeof(Adv_payload.name))) {
+        return 0;
+    }
+
     /**
      *  Set the advertisement data included in our advertisements:
      *     o Flags (indicates advertisement type and other general info).
      *     o Advertising tx power.
-     *     o Device name.
-     *     o 16-bit service UUIDs (alert notifications).
+     *     o Appearance.
+     *     o 16-bit service UUIDs (HID service).
      */
 
     memset(&fields, 0, sizeof fields);
@@ -92,12 +166,7 @@ bleprph_advertise(void)
     fields.adv_itvl_is_present = 1;
     fields.adv_itvl = 40;
 
-    name = ble_svc_gap_device_name();
-    fields.name = (uint8_t *)name;
-    fields.name_len = strlen(name);
-    fields.name_is_complete = 1;
-
-    fields.appearance = HID_KEYBOARD_APPEARENCE;
+    fields.appearance = appearance;
     fields.appearance_is_present = 1;
 
     fields.uuids16 = (ble_uuid16_t[]) {
@@ -106,40 +175,218 @@ bleprph_advertise(void)
     fields.num_uuids16 = 1;
     fields.uuids16_is_complete = 1;
 
-    uint8_t buf[50], buf_sz;
-    rc = ble_hs_adv_set_fields(&fields, buf, &buf_sz, 50);
+    rc = ble_hs_adv_set_fields(&fields, Adv_payload.data, &Adv_payload.data_len, sizeof(Adv_payload.data));
     if (rc != 0) {
-        ESP_LOGE(tag, "error setting advertisement data to buf; rc=%d", rc);
-        return;
+        ESP_LOGE(tag, "error encoding advertisement data; rc=%d", rc);
+        return rc;
+    }
+
+    /* Scan response has the device name. */
+    memset(&fields, 0, sizeof fields);
+    fields.name = (uint8_t *)name;
+    fields.name_len = name_len < ADV_NAME_MAX_LEN ? name_len : ADV_NAME_MAX_LEN;
+    fields.name_is_complete = name_len <= ADV_NAME_MAX_LEN;
+
+    rc = ble_hs_adv_set_fields(&fields, Adv_payload.rsp, &Adv_payload.rsp_len, sizeof(Adv_payload.rsp));
+    if (rc != 0) {
+        ESP_LOGE(tag, "error encoding scan response; rc=%d", rc);
+        return rc;
     }
-    if (buf_sz > BLE_HS_ADV_MAX_SZ) {
-        ESP_LOGE(tag, "Too long advertising data: name %s, appearance %x, uuid16 %x, advsize = %d",
-            name, fields.appearance, GATT_UUID_HID_SERVICE, buf_sz);
-        ble_hs_adv_parse(buf, buf_sz, user_parse, NULL);
+
+    snprintf(Adv_payload.name, sizeof(Adv_payload.name), "%s", name);
+    Adv_payload.appearance = appearance;
+    Adv_payload.encoded = true;
+    Adv_payload.loaded = false;
+    ESP_LOGI(tag, "advertising payloads: name %s%s, appearance %x, data %d bytes, scan response %d bytes",
+        Adv_payload.name, fields.name_is_complete ? "" : " (shortened)", appearance,
+        Adv_payload.data_len, Adv_payload.rsp_len);
+    return 0;
+}
+
+/**
+ * Enables advertising of the current phase with cached payloads.
+ */
+static void
+bleprph_advertise(void)
+{
+    struct ble_gap_adv_params adv_params;
+    int64_t start_us = esp_timer_get_time();
+    int rc;
+
+    if (ble_gap_adv_active()) {
+        // still advertising for the other centrals
         return;
     }
 
-    rc = ble_gap_adv_set_fields(&fields);
-    if (rc != 0) {
-        ESP_LOGE(tag, "error setting advertisement data; rc=%d", rc);
+    if (adv_payload_encode() != 0) {
         return;
     }
+    if (!Adv_payload.loaded) {
+        rc = ble_gap_adv_set_data(Adv_payload.data, Adv_payload.data_len);
+        if (rc != 0) {
+            ESP_LOGE(tag, "error setting advertisement data; rc=%d", rc);
+            return;
+        }
+        rc = ble_gap_adv_rsp_set_data(Adv_payload.rsp, Adv_payload.rsp_len);
+        if (rc != 0) {
+            ESP_LOGE(tag, "error setting scan response data; rc=%d", rc);
+            return;
+        }
+        Adv_payload.loaded = true;
+    }
 
     /* Begin advertising. */
     memset(&adv_params, 0, sizeof adv_params);
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
     adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-    rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER,
-                           &adv_params, bleprph_gap_event, NULL);
+    switch (Adv.phase) {
+    case ADV_PHASE_DIRECTED:
+        adv_params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+        adv_params.high_duty_cycle = 1;
+        rc = ble_gap_adv_start(own_addr_type, &Adv.last_peer, BLE_HS_FOREVER,
+                               &adv_params, bleprph_gap_event, NULL);
+        break;
+    case ADV_PHASE_ACCEPT_LIST:
+        adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+        adv_params.filter_policy = BLE_HCI_ADV_FILT_BOTH;
+        rc = ble_gap_adv_start(own_addr_type, NULL, CONFIG_ADV_ACCEPT_LIST_MS,
+                               &adv_params, bleprph_gap_event, NULL);
+        break;
+    default:
+        adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+        rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER,
+                               &adv_params, bleprph_gap_event, NULL);
+        break;
+    }
     if (rc != 0) {
-        ESP_LOGE(tag, "error enabling advertisement; rc=%d", rc);
+        ESP_LOGE(tag, "error enabling %s advertisement; rc=%d", Adv_phase_names[Adv.phase], rc);
+        return;
+    }
+    boot_stamp(BOOT_ADV_START);
+
+    int64_t restart_us = esp_timer_get_time() - start_us;
+
+    Adv_payload.restarts++;
+    if (restart_us > Adv_payload.restart_max_us) {
+        Adv_payload.restart_max_us = restart_us;
+    }
+    ESP_LOGD(tag, "advertising restarted in %" PRId64 " us, max %" PRId64 " us of %" PRIu32 " restarts",
+        restart_us, Adv_payload.restart_max_us, Adv_payload.restarts);
+}
+
+/* enters phase and restarts advertising */
+static void
+adv_phase_start(enum adv_phase phase)
+{
+    ble_addr_t peers[ADV_MAX_BONDS];
+    int count = 0;
+
+    // accept list can not be changed while it is used by advertising
+    if (ble_gap_adv_active()) {
+        ble_gap_adv_stop();
+    }
+    if (phase == ADV_PHASE_ACCEPT_LIST) {
+        if (CONFIG_ADV_ACCEPT_LIST_MS == 0 ||
+            ble_store_util_bonded_peers(peers, &count, ADV_MAX_BONDS) != 0 || count == 0 ||
+            ble_gap_wl_set(peers, count) != 0) {
+            phase = ADV_PHASE_OPEN;
+        }
+    }
+
+    Adv.phase = phase;
+    Adv.phase_start_us = esp_timer_get_time();
+    flight_rec(FLIGHT_EV_ADV_PHASE, phase, count);
+    ESP_LOGI(tag, "%s advertising", Adv_phase_names[phase]);
+    bleprph_advertise();
+}
+
+/* starts advertising from the first phase which fits: the last host first if it is not connected */
+static void
+adv_reconnect(void)
+{
+    ble_addr_t peers[ADV_MAX_BONDS];
+    int count = 0;
+
+    if (!Adv.last_peer_valid &&
+        ble_store_util_bonded_peers(peers, &count, ADV_MAX_BONDS) == 0 && count > 0) {
+        // after boot: NimBLE store keeps bonds in the order they were made
+        Adv.last_peer = peers[count - 1];
+        Adv.last_peer_valid = true;
+    }
+
+    if (Adv.last_peer_valid && Adv.last_peer_conn == BLE_HS_CONN_HANDLE_NONE && CONFIG_ADV_DIRECTED_MS > 0) {
+        adv_phase_start(ADV_PHASE_DIRECTED);
+    } else {
+        adv_phase_start(ADV_PHASE_ACCEPT_LIST);
+    }
+}
+
+/* advertising has timed out or a directed burst has ended, bursts are repeated until the phase ends */
+static void
+adv_timeout(void)
+{
+    switch (Adv.phase) {
+    case ADV_PHASE_DIRECTED:
+        if (esp_timer_get_time() - Adv.phase_start_us < CONFIG_ADV_DIRECTED_MS * 1000LL) {
+            bleprph_advertise();
+        } else {
+            adv_phase_start(ADV_PHASE_ACCEPT_LIST);
+        }
+        break;
+    case ADV_PHASE_ACCEPT_LIST:
+        adv_phase_start(ADV_PHASE_OPEN);
+        break;
+    default:
+        bleprph_advertise();
+        break;
+    }
+}
+
+/* time from link loss to the first connection */
+static void
+adv_connected(void)
+{
+    if (!Adv.lost_us) {
         return;
     }
+
+    int64_t reconnect_us = esp_timer_get_time() - Adv.lost_us;
+
+    Adv.lost_us = 0;
+    Adv.reconnects[Adv.phase]++;
+    if (reconnect_us > Adv.reconnect_max_us) {
+        Adv.reconnect_max_us = reconnect_us;
+    }
+    ESP_LOGI(tag, "connected in %" PRId64 " ms by %s advertising; directed %" PRIu32 ", accept list %" PRIu32 ", "
+        "open %" PRIu32 ", max %" PRId64 " ms",
+        reconnect_us / 1000, Adv_phase_names[Adv.phase], Adv.reconnects[ADV_PHASE_DIRECTED],
+        Adv.reconnects[ADV_PHASE_ACCEPT_LIST], Adv.reconnects[ADV_PHASE_OPEN], Adv.reconnect_max_us / 1000);
 }
 
 // default password for bonding, can be changed from sdkconfig var CONFIG_EXAMPLE_DISP_PASSWD
 int Disp_password = 123456;
 
+/* payload of GAP event in flight recorder: what tells the most about the event */
+static uint16_t
+gap_event_flight_payload(const struct ble_gap_event *event)
+{
+    switch (event->type) {
+    case BLE_GAP_EVENT_CONNECT:
+        return event->connect.status == 0 ? event->connect.conn_handle : event->connect.status;
+    case BLE_GAP_EVENT_DISCONNECT:
+        return event->disconnect.reason;
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        return event->conn_update.status;
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+        return event->adv_complete.reason;
+    case BLE_GAP_EVENT_ENC_CHANGE:
+        return event->enc_change.status;
+    case BLE_GAP_EVENT_MTU:
+        return event->mtu.value;
+    default:
+        return 0;
+    }
+}
+
 /**
  * The nimble host executes this callback when a GAP event occurs.  The
  * application associates a GAP event callback with each connection that forms.
@@ -160,6 +407,13 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
     struct ble_gap_conn_desc desc;
     int rc;
 
+    (void)arg;
+    if (event->type == BLE_GAP_EVENT_NOTIFY_TX) {
+        flight_rec(FLIGHT_EV_NOTIFY_TX, event->notify_tx.status, event->notify_tx.conn_handle);
+    } else {
+        flight_rec(FLIGHT_EV_GAP, event->type, gap_event_flight_payload(event));
+    }
+
     switch (event->type) {
     case BLE_GAP_EVENT_CONNECT:
         /* A new connection was established or a connection attempt failed. */
@@ -172,6 +426,17 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
             bleprph_print_conn_desc(&desc);
 
             hid_clean_vars(&desc);
+            conn_params_connected(desc.conn_handle);
+            adv_connected();
+
+            if (Adv.last_peer_valid && !memcmp(&desc.peer_id_addr, &Adv.last_peer, sizeof(Adv.last_peer))) {
+                Adv.last_peer_conn = desc.conn_handle;
+            }
+
+            /* More centrals can connect; keep advertising for bonded ones first. */
+            if (hid_conn_count() < CONFIG_BT_NIMBLE_MAX_CONNECTIONS) {
+                adv_phase_start(ADV_PHASE_ACCEPT_LIST);
+            }
         } else {
             /* Connection failed; resume advertising. */
             bleprph_advertise();
@@ -180,10 +445,19 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
 
     case BLE_GAP_EVENT_DISCONNECT:
         ESP_LOGI(tag, "disconnect; reason=%d ", event->disconnect.reason);
-        hid_set_disconnected();
+        hid_set_disconnected(event->disconnect.conn.conn_handle);
+        conn_params_disconnected(event->disconnect.conn.conn_handle);
+        flight_rec_disconnected(event->disconnect.conn.conn_handle);
 
-        /* Connection terminated; resume advertising. */
-        bleprph_advertise();
+        if (event->disconnect.conn.conn_handle == Adv.last_peer_conn) {
+            Adv.last_peer_conn = BLE_HS_CONN_HANDLE_NONE;
+        }
+        if (!Adv.lost_us) {
+            Adv.lost_us = esp_timer_get_time();
+        }
+
+        /* Connection terminated; call the host back. */
+        adv_reconnect();
         return 0;
 
     case BLE_GAP_EVENT_CONN_UPDATE_REQ:
@@ -195,18 +469,36 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
         /* The central has updated the connection parameters. */
         ESP_LOGI(tag, "connection updated; status=%d ",
                     event->conn_update.status);
+        if (event->conn_update.status == 0 &&
+            ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0) {
+            // reports are coalesced per connection interval
+            hid_set_conn_interval(desc.conn_handle, desc.conn_itvl);
+        }
+        conn_params_updated(event->conn_update.conn_handle, event->conn_update.status);
         return 0;
 
     case BLE_GAP_EVENT_ADV_COMPLETE:
         ESP_LOGI(tag, "advertise complete; reason=%d",
                     event->adv_complete.reason);
-        bleprph_advertise();
+        // controller ends directed bursts itself, NimBLE reports them with reason 0
+        if (Adv.phase == ADV_PHASE_DIRECTED || event->adv_complete.reason == BLE_HS_ETIMEOUT) {
+            adv_timeout();
+        } else {
+            bleprph_advertise();
+        }
         return 0;
 
     case BLE_GAP_EVENT_ENC_CHANGE:
         /* Encryption has been enabled or disabled for this connection. */
         ESP_LOGI(tag, "encryption change event; status=%d ",
                     event->enc_change.status);
+        if (event->enc_change.status == 0 &&
+            ble_gap_conn_find(event->enc_change.conn_handle, &desc) == 0 && desc.sec_state.bonded) {
+            // identity address is known after encryption, this host is called first next time
+            Adv.last_peer = desc.peer_id_addr;
+            Adv.last_peer_valid = true;
+            Adv.last_peer_conn = desc.conn_handle;
+        }
         return 0;
 
     case BLE_GAP_EVENT_SUBSCRIBE:
@@ -220,17 +512,17 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
                     event->subscribe.prev_indicate,
                     event->subscribe.cur_indicate);
 
-        hid_set_notify(event->subscribe.attr_handle,
+        hid_set_notify(event->subscribe.conn_handle,
+            event->subscribe.attr_handle,
             event->subscribe.cur_notify,
             event->subscribe.cur_indicate);
         return 0;
 
     case BLE_GAP_EVENT_NOTIFY_TX:
-        ESP_LOGI(tag, "notify event; status=%d conn_handle=%d attr_handle=%04X type=%s",
-                    event->notify_tx.status,
-                    event->notify_tx.conn_handle,
-                    event->notify_tx.attr_handle,
-                    event->notify_tx.indication?"indicate":"notify");
+        DLOG(DLOG_NOTIFY_TX, event->notify_tx.status, event->notify_tx.conn_handle,
+            event->notify_tx.attr_handle, event->notify_tx.indication);
+        hid_notify_tx(event->notify_tx.conn_handle, event->notify_tx.attr_handle,
+            event->notify_tx.indication, event->notify_tx.status);
         return 0;
 
     case BLE_GAP_EVENT_MTU:
@@ -288,6 +580,8 @@ static void
 bleprph_on_reset(int reason)
 {
     ESP_LOGE(tag, "Resetting state; reason=%d", reason);
+    // controller has lost advertising payloads
+    Adv_payload.loaded = false;
 }
 
 static void
@@ -295,6 +589,8 @@ bleprph_on_sync(void)
 {
     int rc;
 
+    boot_stamp(BOOT_SYNC);
+
     rc = ble_hs_util_ensure_addr(0);
     assert(rc == 0);
 
@@ -311,13 +607,15 @@ bleprph_on_sync(void)
 
     ESP_LOGI(tag, "Device Address: "MACSTR, MAC2STR_REV(addr_val));
 
-    /* Begin advertising. */
-    bleprph_advertise();
+    /* Begin advertising, bonded host is called back after reset too. */
+    Adv.lost_us = esp_timer_get_time();
+    adv_reconnect();
 }
 
 void
 bleprph_host_task(void *param)
 {
+    (void)param;
     ESP_LOGI(tag, "BLE Host Task Started");
     /* This function will return only when nimble_port_stop() is executed */
     nimble_port_run();
@@ -332,6 +630,7 @@ void
 ble_init()
 {
     ESP_ERROR_CHECK(esp_nimble_hci_and_controller_init());
+    boot_stamp(BOOT_CONTROLLER);
 
     nimble_port_init();
     /* Initialize the NimBLE host configuration. */
@@ -379,6 +678,7 @@ ble_init()
     assert(rc == 0);
 
     ble_store_config_init();
+    boot_stamp(BOOT_HOST);
 
     nimble_port_freertos_init(bleprph_host_task);
 }
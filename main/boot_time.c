@@ -0,0 +1,87 @@
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "boot_time.h"
+
+static const char *tag = "NimBLEKBD_BOOT";
+
+static const char *Stage_names[] = {
+    [BOOT_APP_MAIN] = "app_main",
+    [BOOT_NVS_INIT] = "nvs init",
+    [BOOT_INPUT_TASK] = "input task",
+    [BOOT_GPIO] = "gpio",
+    [BOOT_CONTROLLER] = "controller",
+    [BOOT_HOST] = "host",
+    [BOOT_APP_INIT] = "app init",
+    [BOOT_SYNC] = "sync",
+    [BOOT_ADV_START] = "advertising",
+};
+
+_Static_assert(sizeof(Stage_names) / sizeof(Stage_names[0]) == BOOT_STAGE_COUNT, "every boot stage needs a name");
+
+static struct boot_time {
+    int64_t stamp_us[BOOT_STAGE_COUNT];     // 0 if stage is not reached yet
+    int stamped;
+    bool reported;
+} Boot;
+
+/* stages are stamped from several tasks */
+static portMUX_TYPE Boot_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* part of stage interval from..to which is done before limit stage */
+static int64_t
+boot_overlap(enum boot_stage from, enum boot_stage to, enum boot_stage limit)
+{
+    int64_t end_us = Boot.stamp_us[to] < Boot.stamp_us[limit] ? Boot.stamp_us[to] : Boot.stamp_us[limit];
+
+    return end_us > Boot.stamp_us[from] ? end_us - Boot.stamp_us[from] : 0;
+}
+
+static void
+boot_report(void)
+{
+    int64_t prev_us = 0;
+    // gpio_setup runs on the other core during controller init,
+    // NVS namespace open and battery init run in app_main during host sync
+    int64_t overlap_us = boot_overlap(BOOT_INPUT_TASK, BOOT_GPIO, BOOT_ADV_START) +
+        boot_overlap(BOOT_HOST, BOOT_APP_INIT, BOOT_SYNC);
+
+    ESP_LOGI(tag, "startup timeline, us from app start:");
+    for (int i = 0; i < BOOT_STAGE_COUNT; ++i) {
+        // stages of other tasks are not in order, the step is from the previous stage in the list
+        ESP_LOGI(tag, "  %-12s %8" PRId64 " %+8" PRId64, Stage_names[i], Boot.stamp_us[i], Boot.stamp_us[i] - prev_us);
+        prev_us = Boot.stamp_us[i];
+    }
+    ESP_LOGI(tag, "first advertisement at %" PRId64 " us, %" PRId64 " us of init ran beside BLE bring-up",
+        Boot.stamp_us[BOOT_ADV_START], overlap_us);
+}
+
+void
+boot_stamp(enum boot_stage stage)
+{
+    bool complete = false;
+
+    if (Boot.stamp_us[stage]) {
+        return;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&Boot_mux);
+    if (!Boot.stamp_us[stage]) {
+        Boot.stamp_us[stage] = now_us;
+        if (++Boot.stamped == BOOT_STAGE_COUNT && !Boot.reported) {
+            complete = Boot.reported = true;
+        }
+    }
+    portEXIT_CRITICAL(&Boot_mux);
+
+    if (complete) {
+        boot_report();
+    }
+}
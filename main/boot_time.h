@@ -0,0 +1,29 @@
+#ifndef H_BOOT_TIME_
+#define H_BOOT_TIME_
+
+/*
+Boot timeline. Every stage of startup is stamped once with esp_timer time,
+which counts from early app startup, the second stage bootloader is not
+included. Stages run in app_main, gpio_btn_task and the NimBLE host task,
+the timeline is printed once when all of them have been stamped, with the
+time of init work which ran beside controller bring-up and host sync: the
+sequential order adds it to the time of the first advertisement.
+*/
+
+enum boot_stage {
+    BOOT_APP_MAIN,              // app_main entered
+    BOOT_NVS_INIT,              // nvs_flash_init done, controller needs it for PHY calibration
+    BOOT_INPUT_TASK,            // gpio_btn_task started
+    BOOT_GPIO,                  // gpio_setup done in gpio_btn_task
+    BOOT_CONTROLLER,            // controller and HCI are up
+    BOOT_HOST,                  // NimBLE host, GATT services and bond store are configured
+    BOOT_APP_INIT,              // app_main has done the rest of init
+    BOOT_SYNC,                  // host is synced with controller, bleprph_on_sync
+    BOOT_ADV_START,             // first ble_gap_adv_start succeeded
+    BOOT_STAGE_COUNT
+};
+
+/* repeated stamps are ignored, cheap after the first one */
+extern void boot_stamp(enum boot_stage stage);
+
+#endif
@@ -0,0 +1,65 @@
+#include <string.h>
+
+#include "btn_ring.h"
+
+#define BTN_RING_MASK (BTN_RING_SIZE - 1)
+
+_Static_assert((BTN_RING_SIZE & BTN_RING_MASK) == 0, "BTN_RING_SIZE must be a power of 2");
+
+void
+btn_ring_init(struct btn_ring *ring, void *consumer)
+{
+    memset(ring->events, 0, sizeof(ring->events));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->overflows, 0);
+    ring->consumer = consumer;
+}
+
+bool
+btn_ring_push(struct btn_ring *ring, const struct btn_event *event)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    // acquire: slot must be completely read by consumer before we overwrite it
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail >= BTN_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+        return false;
+    }
+
+    ring->events[head & BTN_RING_MASK] = *event;
+
+    // release: publish event data before the new head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+int
+btn_ring_drain(struct btn_ring *ring, struct btn_event *out, int max_events)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned count = head - tail;
+
+    if (max_events <= 0) {
+        return 0;
+    }
+    if (count > (unsigned) max_events) {
+        count = max_events;
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        out[i] = ring->events[(tail + i) & BTN_RING_MASK];
+    }
+
+    // release: slots are free for producer only after we copied them
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return (int) count;
+}
+
+uint32_t
+btn_ring_overflows(struct btn_ring *ring)
+{
+    return atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+}
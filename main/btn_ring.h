@@ -0,0 +1,47 @@
+#ifndef H_BTN_RING_
+#define H_BTN_RING_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+Lock-free single producer / single consumer ring of button events.
+Producer is gpio_btn_task, consumer is app_main dispatch loop.
+This file does not depend on FreeRTOS, so it can be built on host.
+*/
+
+/* number of event slots, must be a power of 2 */
+#define BTN_RING_SIZE 32
+
+struct btn_event {
+    // button code, the same format as hid_button in gpio_func.c
+    uint32_t button;
+    // microsecond timestamps for latency tracing: first edge (0 - unknown) and debounce end
+    uint32_t edge_us;
+    uint32_t debounced_us;
+};
+
+struct btn_ring {
+    // index of the next slot to write, changed by producer only
+    atomic_uint head;
+    // index of the next slot to read, changed by consumer only
+    atomic_uint tail;
+    // number of events not pushed because ring was full
+    atomic_uint overflows;
+    // opaque handle of the consumer to wake up (TaskHandle_t on target)
+    void *consumer;
+    struct btn_event events[BTN_RING_SIZE];
+};
+
+extern void btn_ring_init(struct btn_ring *ring, void *consumer);
+
+/* returns false and counts overflow if there is no room for event */
+extern bool btn_ring_push(struct btn_ring *ring, const struct btn_event *event);
+
+/* moves up to max_events pending events to out, returns number of events moved */
+extern int btn_ring_drain(struct btn_ring *ring, struct btn_event *out, int max_events);
+
+extern uint32_t btn_ring_overflows(struct btn_ring *ring);
+
+#endif
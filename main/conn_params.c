@@ -0,0 +1,301 @@
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "host/ble_gap.h"
+
+#include "conn_params.h"
+
+static const char *tag = "NimBLEKBD_CONNPARAMS";
+
+enum conn_mode {
+    CONN_MODE_NONE,         // parameters chosen by central
+    CONN_MODE_FAST,
+    CONN_MODE_SLOW,
+};
+
+static const char *Mode_names[] = { "central", "fast", "slow" };
+
+/* intervals in 1.25 ms units, supervision timeout in 10 ms units */
+static const struct ble_gap_upd_params Mode_params[] = {
+    [CONN_MODE_FAST] = {
+        .itvl_min = CONFIG_CONN_FAST_ITVL_MIN,
+        .itvl_max = CONFIG_CONN_FAST_ITVL_MAX,
+        .latency = 0,
+        .supervision_timeout = CONFIG_CONN_SUPERVISION_TIMEOUT,
+    },
+    [CONN_MODE_SLOW] = {
+        .itvl_min = CONFIG_CONN_SLOW_ITVL_MIN,
+        .itvl_max = CONFIG_CONN_SLOW_ITVL_MAX,
+        .latency = CONFIG_CONN_SLOW_LATENCY,
+        .supervision_timeout = CONFIG_CONN_SUPERVISION_TIMEOUT,
+    },
+};
+
+#ifdef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONN_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#else
+#define CONN_MAX_CONNECTIONS 1
+#endif
+
+static struct conn_params {
+    bool connected;
+    uint16_t conn_handle;
+    enum conn_mode requested;   // mode of update in progress, CONN_MODE_NONE if there is none
+    enum conn_mode current;     // mode of connection now
+    // statistics
+    uint32_t accepted;
+    uint32_t rejected;
+} Conns[CONN_MAX_CONNECTIONS];
+
+/* input is the same for all centrals, so they share target mode and idle timer */
+static struct conn_activity {
+    enum conn_mode target;      // mode wanted now
+    int64_t last_input_us;
+    bool timer_armed;
+    esp_timer_handle_t idle_timer;
+} Activity;
+
+/* state is changed from app_main, BLE host and esp_timer tasks */
+static portMUX_TYPE Conn_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static struct conn_params *
+conn_find(uint16_t conn_handle)
+{
+    for (int i = 0; i < CONN_MAX_CONNECTIONS; ++i) {
+        if (Conns[i].connected && Conns[i].conn_handle == conn_handle) {
+            return &Conns[i];
+        }
+    }
+    return NULL;
+}
+
+/* start update if target mode differs from current one and no update is in progress */
+static void
+conn_params_apply(struct conn_params *conn)
+{
+    enum conn_mode mode = CONN_MODE_NONE;
+    uint16_t conn_handle;
+
+    portENTER_CRITICAL(&Conn_mux);
+    if (conn->connected && conn->requested == CONN_MODE_NONE && Activity.target != conn->current) {
+        mode = conn->requested = Activity.target;
+    }
+    conn_handle = conn->conn_handle;
+    portEXIT_CRITICAL(&Conn_mux);
+
+    if (mode == CONN_MODE_NONE) {
+        return;
+    }
+
+    int rc = ble_gap_update_params(conn_handle, &Mode_params[mode]);
+
+    if (rc != 0) {
+        ESP_LOGW(tag, "can not request %s parameters for conn_handle %d; rc=%d",
+            Mode_names[mode], conn_handle, rc);
+        portENTER_CRITICAL(&Conn_mux);
+        // do not retry until mode changes again
+        conn->requested = CONN_MODE_NONE;
+        conn->current = mode;
+        conn->rejected++;
+        portEXIT_CRITICAL(&Conn_mux);
+    }
+}
+
+static void
+conn_params_apply_all(void)
+{
+    for (int i = 0; i < CONN_MAX_CONNECTIONS; ++i) {
+        conn_params_apply(&Conns[i]);
+    }
+}
+
+static bool
+conn_any_connected(void)
+{
+    for (int i = 0; i < CONN_MAX_CONNECTIONS; ++i) {
+        if (Conns[i].connected) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+idle_timer_cb(void *arg)
+{
+    (void)arg;
+    int64_t wait = 0;
+
+    portENTER_CRITICAL(&Conn_mux);
+    if (conn_any_connected()) {
+        // input does not restart the timer, so check the time of the last one
+        wait = Activity.last_input_us + CONFIG_CONN_IDLE_MS * 1000LL - esp_timer_get_time();
+    }
+    if (wait > 0) {
+        Activity.timer_armed = true;
+    } else {
+        Activity.timer_armed = false;
+        Activity.target = CONN_MODE_SLOW;
+    }
+    portEXIT_CRITICAL(&Conn_mux);
+
+    if (wait > 0) {
+        esp_timer_start_once(Activity.idle_timer, wait);
+    } else {
+        conn_params_apply_all();
+    }
+}
+
+void
+conn_params_input(void)
+{
+    int64_t now = esp_timer_get_time();
+    bool wake = false, arm = false;
+
+    portENTER_CRITICAL(&Conn_mux);
+    Activity.last_input_us = now;
+    if (conn_any_connected()) {
+        if (Activity.target != CONN_MODE_FAST) {
+            Activity.target = CONN_MODE_FAST;
+            wake = true;
+        }
+        if (!Activity.timer_armed) {
+            Activity.timer_armed = arm = true;
+        }
+    }
+    portEXIT_CRITICAL(&Conn_mux);
+
+    if (arm) {
+        esp_timer_start_once(Activity.idle_timer, CONFIG_CONN_IDLE_MS * 1000ULL);
+    }
+    if (wake) {
+        conn_params_apply_all();
+    }
+}
+
+/* mode which parameters the connection has now */
+static enum conn_mode
+conn_mode_of(const struct ble_gap_conn_desc *desc)
+{
+    for (enum conn_mode mode = CONN_MODE_FAST; mode <= CONN_MODE_SLOW; ++mode) {
+        if (desc->conn_itvl >= Mode_params[mode].itvl_min &&
+            desc->conn_itvl <= Mode_params[mode].itvl_max) {
+            return mode;
+        }
+    }
+    return CONN_MODE_NONE;
+}
+
+void
+conn_params_updated(uint16_t conn_handle, int status)
+{
+    struct ble_gap_conn_desc desc = { 0 };
+    enum conn_mode requested, mode = CONN_MODE_NONE;
+    struct conn_params *conn;
+
+    if (ble_gap_conn_find(conn_handle, &desc) == 0) {
+        mode = conn_mode_of(&desc);
+    }
+
+    portENTER_CRITICAL(&Conn_mux);
+    conn = conn_find(conn_handle);
+    if (!conn) {
+        portEXIT_CRITICAL(&Conn_mux);
+        return;
+    }
+    requested = conn->requested;
+    conn->requested = CONN_MODE_NONE;
+    if (requested == CONN_MODE_NONE) {
+        // central has changed parameters by itself
+        conn->current = mode;
+    } else if (status == 0 && mode == requested) {
+        conn->current = mode;
+        conn->accepted++;
+    } else {
+        // do not retry until mode changes again
+        conn->current = requested;
+        conn->rejected++;
+    }
+    portEXIT_CRITICAL(&Conn_mux);
+
+    if (requested != CONN_MODE_NONE) {
+        ESP_LOGI(tag, "%s parameters %s; conn_handle=%d status=%d conn_itvl=%d conn_latency=%d",
+            Mode_names[requested], mode == requested && status == 0 ? "accepted" : "rejected",
+            conn_handle, status, desc.conn_itvl, desc.conn_latency);
+    }
+
+    // target could change while update was in progress
+    conn_params_apply(conn);
+}
+
+void
+conn_params_connected(uint16_t conn_handle)
+{
+    struct conn_params *conn = NULL;
+
+    if (!Activity.idle_timer) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = idle_timer_cb,
+            .name = "conn_idle"
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &Activity.idle_timer));
+    }
+
+    portENTER_CRITICAL(&Conn_mux);
+    for (int i = 0; i < CONN_MAX_CONNECTIONS; ++i) {
+        if (!Conns[i].connected) {
+            conn = &Conns[i];
+            conn->conn_handle = conn_handle;
+            conn->connected = true;
+            conn->requested = CONN_MODE_NONE;
+            conn->current = CONN_MODE_NONE;
+            conn->accepted = 0;
+            conn->rejected = 0;
+            break;
+        }
+    }
+    // service discovery and pairing go faster too
+    Activity.target = CONN_MODE_FAST;
+    portEXIT_CRITICAL(&Conn_mux);
+
+    if (!conn) {
+        ESP_LOGE(tag, "no room for conn_handle %d", conn_handle);
+        return;
+    }
+
+    conn_params_input();
+    conn_params_apply(conn);
+}
+
+void
+conn_params_disconnected(uint16_t conn_handle)
+{
+    struct conn_params *conn;
+    bool last;
+
+    portENTER_CRITICAL(&Conn_mux);
+    conn = conn_find(conn_handle);
+    if (conn) {
+        conn->connected = false;
+    }
+    last = !conn_any_connected();
+    portEXIT_CRITICAL(&Conn_mux);
+
+    if (!conn) {
+        return;
+    }
+    if (last) {
+        // timer callback does nothing after disconnect, if it has already been started
+        esp_timer_stop(Activity.idle_timer);
+        portENTER_CRITICAL(&Conn_mux);
+        Activity.timer_armed = false;
+        portEXIT_CRITICAL(&Conn_mux);
+    }
+
+    ESP_LOGI(tag, "conn_handle %d parameter updates: %u accepted, %u rejected",
+        conn_handle, conn->accepted, conn->rejected);
+}
@@ -0,0 +1,23 @@
+#ifndef H_CONN_PARAMS_
+#define H_CONN_PARAMS_
+
+#include <stdint.h>
+
+/*
+Connection parameters manager. While keys or mouse are active the shortest
+connection interval with zero slave latency is requested. After
+CONFIG_CONN_IDLE_MS without input it relaxes to a long interval with high slave
+latency to save power, the first new input requests fast parameters again.
+All connected centrals follow the same input activity.
+*/
+
+extern void conn_params_connected(uint16_t conn_handle);
+extern void conn_params_disconnected(uint16_t conn_handle);
+
+/* called on every input report change, cheap when parameters are already fast */
+extern void conn_params_input(void);
+
+/* called for BLE_GAP_EVENT_CONN_UPDATE */
+extern void conn_params_updated(uint16_t conn_handle, int status);
+
+#endif
@@ -0,0 +1,85 @@
+#include "debounce.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+/* default retry delay for events not accepted by settled callback */
+#define DEBOUNCE_RETRY_US 1000
+
+void
+debounce_init(struct debounce *db, struct debounce_button *buttons,
+              int buttons_count, debounce_clock_t clock)
+{
+    db->now_us = clock;
+    db->buttons = buttons;
+    db->buttons_count = buttons_count;
+    db->retry_us = DEBOUNCE_RETRY_US;
+
+    for (int i = 0; i < buttons_count; ++i) {
+        atomic_init(&buttons[i].settle_at_us, 0);
+    }
+}
+
+/* zero is reserved for stable buttons */
+static inline uint32_t
+settle_time(uint32_t time_us)
+{
+    return time_us ? time_us : 1;
+}
+
+bool IRAM_ATTR
+debounce_edge(struct debounce *db, int button_idx)
+{
+    struct debounce_button *button = &db->buttons[button_idx];
+    uint32_t settle_at = settle_time(db->now_us() + button->window_us);
+
+    // every edge moves the end of rattling
+    return atomic_exchange_explicit(&button->settle_at_us, settle_at, memory_order_acq_rel) == 0;
+}
+
+uint32_t
+debounce_poll(struct debounce *db, debounce_settled_t settled, void *arg)
+{
+    uint32_t now = db->now_us();
+    uint32_t next_poll = DEBOUNCE_IDLE;
+
+    for (int i = 0; i < db->buttons_count; ++i) {
+        struct debounce_button *button = &db->buttons[i];
+        uint32_t settle_at = atomic_load_explicit(&button->settle_at_us, memory_order_acquire);
+
+        if (!settle_at) {
+            continue;
+        }
+
+        // wrap-safe time comparison
+        int32_t time_left = (int32_t)(settle_at - now);
+
+        if (time_left <= 0) {
+            if (settled(i, arg)) {
+                // button is stable, unless new edge has come while we were reading it
+                if (atomic_compare_exchange_strong(&button->settle_at_us, &settle_at, 0)) {
+                    continue;
+                }
+            } else {
+                uint32_t retry_at = settle_time(now + db->retry_us);
+                atomic_compare_exchange_strong(&button->settle_at_us, &settle_at, retry_at);
+            }
+            settle_at = atomic_load_explicit(&button->settle_at_us, memory_order_acquire);
+            time_left = (int32_t)(settle_at - now);
+            if (!settle_at) {
+                continue;
+            }
+        }
+
+        // find shortest time among the rattling buttons
+        uint32_t wait = time_left > 0 ? (uint32_t) time_left : 0;
+        if (wait < next_poll) {
+            next_poll = wait;
+        }
+    }
+
+    return next_poll;
+}
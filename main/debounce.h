@@ -0,0 +1,51 @@
+#ifndef H_DEBOUNCE_
+#define H_DEBOUNCE_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+Button debounce engine with microsecond resolution.
+It does not touch hardware: edges are timestamped by debounce_edge() (called
+from ISR), settled buttons are reported by debounce_poll() and the caller
+schedules next poll with any one-shot timer. Clock is injected, so engine can
+be driven by a simulated clock.
+*/
+
+/* poll result when no button is rattling */
+#define DEBOUNCE_IDLE UINT32_MAX
+
+/* microsecond clock, it may wrap around */
+typedef uint32_t (*debounce_clock_t)(void);
+
+/* called for each button that has stopped rattling,
+   returns false if event can not be handled now and must be retried */
+typedef bool (*debounce_settled_t)(int button_idx, void *arg);
+
+struct debounce_button {
+    // time when rattling will be over, 0 if button is stable
+    atomic_uint settle_at_us;
+    // debounce window for this button
+    uint32_t window_us;
+};
+
+struct debounce {
+    debounce_clock_t now_us;
+    struct debounce_button *buttons;
+    int buttons_count;
+    // retry delay for events that were not handled by settled callback
+    uint32_t retry_us;
+};
+
+extern void debounce_init(struct debounce *db, struct debounce_button *buttons,
+                          int buttons_count, debounce_clock_t clock);
+
+/* edge on button, safe to call from ISR,
+   returns true if button was stable before, so poller must be woken up */
+extern bool debounce_edge(struct debounce *db, int button_idx);
+
+/* handles settled buttons, returns microseconds to next poll or DEBOUNCE_IDLE */
+extern uint32_t debounce_poll(struct debounce *db, debounce_settled_t settled, void *arg);
+
+#endif
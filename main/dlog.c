@@ -0,0 +1,155 @@
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "dlog.h"
+
+static const char *tag = "NimBLEKBD_DLOG";
+
+#define DLOG_RING_MASK (CONFIG_DLOG_RING_SIZE - 1)
+
+_Static_assert((CONFIG_DLOG_RING_SIZE & DLOG_RING_MASK) == 0, "DLOG_RING_SIZE must be a power of 2");
+
+/* dlog task looks for new records with this period */
+#define DLOG_POLL_MS 20
+/* the longest formatted message */
+#define DLOG_LINE_MAX 160
+
+static const struct dlog_format {
+    const char *tag;
+    const char *format;
+} Formats[DLOG_FORMAT_COUNT] = {
+#define DLOG_FORMAT(id, tag, format) [id] = { tag, format },
+#include "dlog_formats.h"
+#undef DLOG_FORMAT
+};
+
+/*
+Bounded MPSC ring, the same algorithm as TX queue in hid_tx.c: producers claim
+cell with CAS on enqueue position and publish it by cell sequence.
+*/
+static struct dlog_cell {
+    atomic_uint seq;
+    struct dlog_record record;
+} Cells[CONFIG_DLOG_RING_SIZE];
+
+static struct dlog {
+    atomic_uint enqueue_pos;
+    unsigned dequeue_pos;       // dlog task only
+    atomic_uint dropped;
+    uint32_t dropped_reported;
+} Dlog;
+
+void
+dlog_write(enum dlog_format_id format, const uint32_t *args, int nargs)
+{
+    unsigned pos = atomic_load_explicit(&Dlog.enqueue_pos, memory_order_relaxed);
+    struct dlog_cell *cell;
+
+    for (;;) {
+        cell = &Cells[pos & DLOG_RING_MASK];
+        unsigned seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&Dlog.enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&Dlog.dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&Dlog.enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->record.time_us = (uint32_t)esp_timer_get_time();
+    cell->record.format = format;
+    cell->record.nargs = nargs;
+    cell->record.reserved = 0;
+    for (int i = 0; i < DLOG_MAX_ARGS; ++i) {
+        cell->record.args[i] = i < nargs ? args[i] : 0;
+    }
+    // release: publish record before the cell sequence
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+}
+
+static void
+dlog_print(const struct dlog_record *record)
+{
+#ifdef CONFIG_DLOG_BINARY
+    const uint8_t *bytes = (const uint8_t *)record;
+    char line[sizeof(*record) * 2 + 1];
+
+    for (int i = 0; i < sizeof(*record); ++i) {
+        sprintf(line + i * 2, "%02x", bytes[i]);
+    }
+    printf("DLOG:%s\n", line);
+#else
+    char line[DLOG_LINE_MAX];
+
+    if (record->format >= DLOG_FORMAT_COUNT) {
+        return;
+    }
+    const struct dlog_format *format = &Formats[record->format];
+
+    snprintf(line, sizeof(line), format->format, record->args[0], record->args[1],
+        record->args[2], record->args[3], record->args[4]);
+    // time of the event, not of printing
+    esp_log_write(ESP_LOG_INFO, format->tag, "I (%u) %s: %s\n",
+        record->time_us / 1000, format->tag, line);
+#endif
+}
+
+static void
+dlog_task(void *param)
+{
+    (void)param;
+    for (;;) {
+        for (;;) {
+            struct dlog_cell *cell = &Cells[Dlog.dequeue_pos & DLOG_RING_MASK];
+
+            if (atomic_load_explicit(&cell->seq, memory_order_acquire) != Dlog.dequeue_pos + 1) {
+                break;
+            }
+            dlog_print(&cell->record);
+            // release: record is read, cell can be reused by producers
+            atomic_store_explicit(&cell->seq, Dlog.dequeue_pos + CONFIG_DLOG_RING_SIZE,
+                memory_order_release);
+            Dlog.dequeue_pos++;
+        }
+
+        uint32_t dropped = atomic_load_explicit(&Dlog.dropped, memory_order_relaxed);
+        if (dropped != Dlog.dropped_reported) {
+            ESP_LOGW(tag, "%u records dropped, ring is full", dropped - Dlog.dropped_reported);
+            Dlog.dropped_reported = dropped;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(DLOG_POLL_MS));
+    }
+}
+
+void
+dlog_init(void)
+{
+    for (unsigned i = 0; i < CONFIG_DLOG_RING_SIZE; ++i) {
+        atomic_init(&Cells[i].seq, i);
+    }
+    atomic_init(&Dlog.enqueue_pos, 0);
+    atomic_init(&Dlog.dropped, 0);
+    Dlog.dequeue_pos = 0;
+
+    // the lowest priority above idle, printing must not delay BLE or input
+    if (xTaskCreate(dlog_task, "dlog_task", 3072, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(tag, "Can not create dlog_task!");
+        vTaskDelay(pdMS_TO_TICKS(30000));
+        esp_restart();
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef H_DLOG_
+#define H_DLOG_
+
+#include <stdint.h>
+
+/*
+Deferred binary log for hot paths. Call site puts format ID and up to
+DLOG_MAX_ARGS integer arguments to a lock-free ring, it takes no lock and
+formats nothing. Low priority dlog task formats records and prints them with
+esp_log_write() later, or prints them as hex for tools/dlog_decode.py when
+CONFIG_DLOG_BINARY is set. When ring is full new records are dropped and
+counted.
+*/
+
+#define DLOG_MAX_ARGS 5
+
+enum dlog_format_id {
+#define DLOG_FORMAT(id, tag, format) id,
+#include "dlog_formats.h"
+#undef DLOG_FORMAT
+    DLOG_FORMAT_COUNT
+};
+
+/* record as it is stored in ring and printed in binary mode, little endian */
+struct dlog_record {
+    uint32_t time_us;           // esp_timer time, wraps after 71 minutes
+    uint16_t format;
+    uint8_t nargs;
+    uint8_t reserved;
+    uint32_t args[DLOG_MAX_ARGS];
+};
+
+_Static_assert(sizeof(struct dlog_record) == 8 + 4 * DLOG_MAX_ARGS, "dlog record must have no padding");
+
+extern void dlog_init(void);
+
+/* safe from any task, never blocks */
+extern void dlog_write(enum dlog_format_id format, const uint32_t *args, int nargs);
+
+#define DLOG(format, ...) do { \
+        const uint32_t dlog_args_[] = { __VA_ARGS__ }; \
+        _Static_assert(sizeof(dlog_args_) <= sizeof(uint32_t) * DLOG_MAX_ARGS, "too many dlog arguments"); \
+        dlog_write((format), dlog_args_, sizeof(dlog_args_)/sizeof(dlog_args_[0])); \
+    } while (0)
+
+#endif
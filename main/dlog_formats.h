@@ -0,0 +1,13 @@
+/*
+Formats of deferred log records, see dlog.h. Every argument is a 32-bit
+integer, so only %d, %u, %x, %X (with flags and width) can be used. Host
+decoder tools/dlog_decode.py parses this file: one entry per line, IDs are
+given in order from 0, new entries go to the end.
+*/
+DLOG_FORMAT(DLOG_HID_ACCESS,      "NimBLEKBD_GATT_SVR", "hid_svr_chr_access: UUID %04X attr %04X arg %d op %d")
+DLOG_FORMAT(DLOG_REPORT_ACCESS,   "NimBLEKBD_GATT_SVR", "ble_svc_report_access: UUID %04X attr %04X arg %d op %d")
+DLOG_FORMAT(DLOG_BATTERY_ACCESS,  "NimBLEKBD_GATT_SVR", "ble_svc_battery_access: UUID %04X attr %04X arg %d op %d")
+DLOG_FORMAT(DLOG_DIS_ACCESS,      "NimBLEKBD_GATT_SVR", "ble_svc_dis_access: UUID %04X attr %04X arg %d op %d")
+DLOG_FORMAT(DLOG_SET_NOTIFY,      "NimBLEKBD_HIDFUNC",  "hid_set_notify: conn_handle %d, report %d, attr_handle %d, notify %d, indicate %d")
+DLOG_FORMAT(DLOG_BUTTON,          "NimBLEKBD_main",     "button %d type %08X (src %08X) pressed %d")
+DLOG_FORMAT(DLOG_NOTIFY_TX,       "NimBLEKBD_BLEFUNC",  "notify event; status=%d conn_handle=%d attr_handle=%04X indication=%d")
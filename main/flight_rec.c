@@ -0,0 +1,286 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "host/ble_hs.h"
+
+#include "flight_rec.h"
+
+static const char *tag = "NimBLEKBD_FLIGHT";
+
+#define FLIGHT_RECORDS CONFIG_FLIGHT_REC_RECORDS
+
+/* bytes in one FLIGHT: console line */
+#define FLIGHT_PRINT_BYTES 32
+
+/* recording resumes by itself when GATT dump is not read this long */
+#define FLIGHT_FREEZE_TIMEOUT_US 10000000
+
+struct flight_record {
+    uint16_t delta_us;
+    uint8_t type;
+    uint8_t arg;
+    uint16_t payload;
+};
+
+_Static_assert(sizeof(struct flight_record) == 6, "flight record must match dump format");
+_Static_assert(FLIGHT_RECORDS <= UINT16_MAX, "record count must fit dump header");
+
+static struct flight_record Records[FLIGHT_RECORDS];
+
+static struct flight_rec {
+    uint16_t head;              // next record to write
+    uint16_t count;
+    bool wrapped;
+    bool frozen;                // dump is being read, ring is not changed
+    uint16_t frozen_conn;       // central reading GATT dump, BLE_HS_CONN_HANDLE_NONE if there is none
+    int64_t frozen_us;          // time of its last page select or read
+    uint16_t page;              // selected GATT page
+    int64_t last_us;            // time of the last record
+    uint32_t base_us;           // time before the oldest record
+    uint32_t lost;
+} Flight;
+
+/* records come from ISR and tasks on both cores */
+static portMUX_TYPE Flight_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint32_t
+flight_delta(const struct flight_record *rec)
+{
+    return rec->delta_us + (rec->type == FLIGHT_EV_TIME ? (uint32_t)rec->payload << 16 : 0);
+}
+
+/* called with Flight_mux held */
+static void IRAM_ATTR
+flight_put(uint16_t delta_us, uint8_t type, uint8_t arg, uint16_t payload)
+{
+    struct flight_record *rec = &Records[Flight.head];
+
+    if (Flight.count == FLIGHT_RECORDS) {
+        // oldest record is overwritten, its time goes to the base
+        Flight.base_us += flight_delta(rec);
+        Flight.wrapped = true;
+        Flight.lost++;
+    } else {
+        Flight.count++;
+    }
+    rec->delta_us = delta_us;
+    rec->type = type;
+    rec->arg = arg;
+    rec->payload = payload;
+    Flight.head = Flight.head + 1 < FLIGHT_RECORDS ? Flight.head + 1 : 0;
+}
+
+void IRAM_ATTR
+flight_rec(enum flight_event type, uint8_t arg, uint16_t payload)
+{
+    portENTER_CRITICAL_SAFE(&Flight_mux);
+    // time is taken under the lock, so records are in time order
+    int64_t now = esp_timer_get_time();
+
+    if (Flight.frozen && Flight.frozen_conn != BLE_HS_CONN_HANDLE_NONE &&
+        now - Flight.frozen_us > FLIGHT_FREEZE_TIMEOUT_US) {
+        // reader has gone without resume command
+        Flight.frozen = false;
+        Flight.frozen_conn = BLE_HS_CONN_HANDLE_NONE;
+    }
+    if (Flight.frozen) {
+        Flight.lost++;
+    } else {
+        uint64_t delta = now - Flight.last_us;
+
+        Flight.last_us = now;
+        if (delta > UINT16_MAX) {
+            uint64_t high = delta >> 16;
+
+            // gaps longer than 71 minutes are shortened
+            flight_put(delta & UINT16_MAX, FLIGHT_EV_TIME, 0, high > UINT16_MAX ? UINT16_MAX : high);
+            delta = 0;
+        }
+        flight_put(delta, type, arg, payload);
+    }
+    portEXIT_CRITICAL_SAFE(&Flight_mux);
+}
+
+void
+flight_rec_init(void)
+{
+    portENTER_CRITICAL(&Flight_mux);
+    Flight.head = Flight.count = 0;
+    Flight.lost = 0;
+    Flight.wrapped = Flight.frozen = false;
+    Flight.frozen_conn = BLE_HS_CONN_HANDLE_NONE;
+    Flight.last_us = esp_timer_get_time();
+    Flight.base_us = Flight.last_us;
+    portEXIT_CRITICAL(&Flight_mux);
+
+    flight_rec(FLIGHT_EV_BOOT, esp_reset_reason(), 0);
+    ESP_LOGI(tag, "recording %d events", FLIGHT_RECORDS);
+}
+
+static inline void
+put_le16(uint8_t *dst, uint16_t value)
+{
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
+
+static inline void
+put_le32(uint8_t *dst, uint32_t value)
+{
+    put_le16(dst, value);
+    put_le16(dst + 2, value >> 16);
+}
+
+static size_t
+flight_dump_size(void)
+{
+    return FLIGHT_REC_HEADER_SIZE + Flight.count * sizeof(struct flight_record);
+}
+
+/* copies part of the dump starting at offset, returns bytes copied */
+static size_t
+flight_dump_copy(size_t offset, uint8_t *dst, size_t len)
+{
+    uint8_t header[FLIGHT_REC_HEADER_SIZE];
+    size_t copied = 0, total;
+    int oldest;
+
+    portENTER_CRITICAL(&Flight_mux);
+    put_le16(header, FLIGHT_REC_MAGIC);
+    header[2] = FLIGHT_REC_VERSION;
+    header[3] = sizeof(struct flight_record);
+    put_le16(header + 4, Flight.count);
+    put_le16(header + 6, Flight.wrapped ? 1 : 0);
+    put_le32(header + 8, Flight.base_us);
+    put_le32(header + 12, Flight.lost);
+
+    total = flight_dump_size();
+    oldest = (Flight.head + FLIGHT_RECORDS - Flight.count) % FLIGHT_RECORDS;
+    // ESP32 is little endian, records are copied as they are
+    while (copied < len && offset < total) {
+        if (offset < FLIGHT_REC_HEADER_SIZE) {
+            dst[copied++] = header[offset++];
+        } else {
+            size_t pos = offset++ - FLIGHT_REC_HEADER_SIZE;
+            const uint8_t *rec = (const uint8_t *)
+                &Records[(oldest + pos / sizeof(struct flight_record)) % FLIGHT_RECORDS];
+
+            dst[copied++] = rec[pos % sizeof(struct flight_record)];
+        }
+    }
+    portEXIT_CRITICAL(&Flight_mux);
+
+    return copied;
+}
+
+int
+flight_rec_read(struct os_mbuf *om)
+{
+    // called from BLE host task only, page does not go to its stack
+    static uint8_t page[4 + FLIGHT_REC_PAGE_BYTES];
+    uint16_t pages;
+    size_t len;
+
+    portENTER_CRITICAL(&Flight_mux);
+    pages = (flight_dump_size() + FLIGHT_REC_PAGE_BYTES - 1) / FLIGHT_REC_PAGE_BYTES;
+    // reader is still there, freeze timeout starts again
+    Flight.frozen_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&Flight_mux);
+
+    put_le16(page, Flight.page);
+    put_le16(page + 2, pages);
+    len = flight_dump_copy((size_t)Flight.page * FLIGHT_REC_PAGE_BYTES, page + 4, FLIGHT_REC_PAGE_BYTES);
+
+    return os_mbuf_append(om, page, 4 + len);
+}
+
+/* conn_handle is the GATT reader, BLE_HS_CONN_HANDLE_NONE for console */
+static void
+flight_freeze(bool frozen, uint16_t conn_handle)
+{
+    portENTER_CRITICAL(&Flight_mux);
+    Flight.frozen = frozen;
+    Flight.frozen_conn = frozen ? conn_handle : BLE_HS_CONN_HANDLE_NONE;
+    Flight.frozen_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&Flight_mux);
+}
+
+int
+flight_rec_command(uint16_t conn_handle, const uint8_t *cmd, uint16_t len)
+{
+    if (len == 3 && cmd[0] == FLIGHT_REC_CMD_PAGE) {
+        Flight.page = cmd[1] | cmd[2] << 8;
+        flight_freeze(true, conn_handle);
+        return 0;
+    }
+    if (len != 1) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    switch (cmd[0]) {
+        case FLIGHT_REC_CMD_RESUME:
+            flight_freeze(false, BLE_HS_CONN_HANDLE_NONE);
+            return 0;
+
+        case FLIGHT_REC_CMD_PRINT:
+            flight_rec_print();
+            return 0;
+
+        case FLIGHT_REC_CMD_CLEAR:
+            flight_rec_init();
+            return 0;
+
+        default:
+            ESP_LOGW(tag, "unknown command %d", cmd[0]);
+            return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+}
+
+void
+flight_rec_print(void)
+{
+    uint8_t chunk[FLIGHT_PRINT_BYTES];
+    char line[FLIGHT_PRINT_BYTES * 2 + 1];
+    size_t offset = 0, len;
+    bool frozen;
+    uint16_t frozen_conn;
+
+    portENTER_CRITICAL(&Flight_mux);
+    frozen = Flight.frozen;
+    frozen_conn = Flight.frozen_conn;
+    Flight.frozen = true;
+    // GATT freeze timeout does not end printing
+    Flight.frozen_conn = BLE_HS_CONN_HANDLE_NONE;
+    portEXIT_CRITICAL(&Flight_mux);
+
+    // plain lines without log prefix, tools/flight_rec.py picks them from console output
+    printf("FLIGHT:BEGIN\n");
+    while ((len = flight_dump_copy(offset, chunk, sizeof(chunk))) > 0) {
+        for (size_t i = 0; i < len; ++i) {
+            sprintf(line + i * 2, "%02x", chunk[i]);
+        }
+        printf("FLIGHT:%s\n", line);
+        offset += len;
+    }
+    printf("FLIGHT:END\n");
+
+    flight_freeze(frozen, frozen_conn);
+}
+
+void
+flight_rec_disconnected(uint16_t conn_handle)
+{
+    portENTER_CRITICAL(&Flight_mux);
+    if (Flight.frozen && Flight.frozen_conn == conn_handle) {
+        Flight.frozen = false;
+        Flight.frozen_conn = BLE_HS_CONN_HANDLE_NONE;
+    }
+    portEXIT_CRITICAL(&Flight_mux);
+}
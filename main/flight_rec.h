@@ -0,0 +1,89 @@
+#ifndef H_FLIGHT_REC_
+#define H_FLIGHT_REC_
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/*
+Flight recorder: always-on ring of the last CONFIG_FLIGHT_REC_RECORDS events
+in RAM, the oldest records are overwritten. Recording is a few dozen cycles
+under a spinlock and is safe in ISR. The ring is dumped over the flight
+recorder GATT characteristic or printed to console, tools/flight_rec.py turns
+the dump into a timeline and latency statistics.
+
+Dump format, all fields little endian:
+
+  header, 16 bytes
+    uint16  magic           0x5246 ("FR")
+    uint8   version         1
+    uint8   record_size     6
+    uint16  count           records after header, the oldest first
+    uint16  flags           bit 0: ring has wrapped, older records are lost
+    uint32  base_us         time before the first record, us from boot (wraps)
+    uint32  lost            records overwritten or not recorded while frozen
+
+  record, 6 bytes
+    uint16  delta_us        time from the previous record
+    uint8   type            enum flight_event
+    uint8   arg             meaning depends on type
+    uint16  payload         meaning depends on type
+
+Time of record is the time of the previous one plus delta_us, a
+FLIGHT_EV_TIME record also adds payload * 65536 us. It is written before
+records which come later than 65535 us after the previous one.
+
+GATT dump is read in pages: write FLIGHT_REC_CMD_PAGE and a uint16 page
+number, then read uint16 page, uint16 page count and up to
+FLIGHT_REC_PAGE_BYTES of the dump. Selecting a page freezes the recorder, so
+pages belong to the same dump, FLIGHT_REC_CMD_RESUME continues recording.
+Recording also continues when the reader disconnects or reads no page for 10 s.
+*/
+
+enum flight_event {
+    FLIGHT_EV_TIME,             // payload: delta_us extension in 65536 us units
+    FLIGHT_EV_BOOT,             // arg: esp_reset_reason()
+    FLIGHT_EV_GPIO_EDGE,        // arg: button index, payload: 1 if edge has started debounce, 0 rattle
+    FLIGHT_EV_BUTTON,           // arg: FLIGHT_BUTTON_ARG(), payload: low 16 bits of button code
+    FLIGHT_EV_REPORT_QUEUED,    // arg: report index, payload: conn_handle
+    FLIGHT_EV_QUEUE_FULL,       // arg: report index, payload: conn_handle
+    FLIGHT_EV_REPORT_SENT,      // arg: report index, bit 7 indication, payload: conn_handle
+    FLIGHT_EV_TX_RETRY,         // arg: report index, payload: conn_handle
+    FLIGHT_EV_NOTIFY_TX,        // arg: status (low byte), payload: conn_handle
+    FLIGHT_EV_GAP,              // arg: BLE_GAP_EVENT_*, payload: conn_handle, reason or status
+    FLIGHT_EV_SUBSCRIBE,        // arg: report index, bit 6 notify, bit 7 indicate, payload: conn_handle
+    FLIGHT_EV_SNAPSHOT_RETRY,   // arg: report index, payload: retries of seqlock read
+    FLIGHT_EV_ADV_PHASE,        // arg: advertising phase (directed, accept list, open), payload: bonds in accept list
+    FLIGHT_EV_COUNT
+};
+
+/* debounced button: bits 0-1 button type, bits 2-6 gpio button index + 1 (0 is matrix), bit 7 released */
+#define FLIGHT_BUTTON_ARG(button, button_idx) \
+    (uint8_t)((((button) >> 24) & 3) | ((((button_idx) + 1) & 0x1f) << 2) | ((button) >> 31 << 7))
+
+#define FLIGHT_REC_MAGIC        0x5246
+#define FLIGHT_REC_VERSION      1
+#define FLIGHT_REC_HEADER_SIZE  16
+#define FLIGHT_REC_PAGE_BYTES   480
+
+/* GATT commands written to flight recorder characteristic */
+#define FLIGHT_REC_CMD_RESUME   0x01
+#define FLIGHT_REC_CMD_PRINT    0x02
+#define FLIGHT_REC_CMD_CLEAR    0x03
+#define FLIGHT_REC_CMD_PAGE     0x10
+
+struct os_mbuf;
+
+extern void flight_rec_init(void);
+extern void flight_rec(enum flight_event type, uint8_t arg, uint16_t payload);
+
+/* appends selected page of the dump */
+extern int flight_rec_read(struct os_mbuf *om);
+/* returns 0 or BLE_ATT_ERR_* */
+extern int flight_rec_command(uint16_t conn_handle, const uint8_t *cmd, uint16_t len);
+/* resumes recording frozen by this central */
+extern void flight_rec_disconnected(uint16_t conn_handle);
+/* prints dump to console as FLIGHT: hex lines */
+extern void flight_rec_print(void);
+
+#endif
@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -25,6 +26,11 @@
 
 #include "gatt_svr.h"
 #include "hid_func.h"
+#include "hid_typing.h"
+#include "hid_perf.h"
+#include "hid_latency.h"
+#include "flight_rec.h"
+#include "dlog.h"
 
 static const char *tag = "NimBLEKBD_GATT_SVR";
 
@@ -53,11 +59,11 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt,
                              void *arg)
 {
+    HID_PERF_SCOPE(HID_PERF_HID_ACCESS);
     uint16_t uuid16 = ble_uuid_u16(ctxt->chr->uuid);
     int rc;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d", __FUNCTION__,
-        uuid16, attr_handle, (int)arg, ctxt->op);
+    DLOG(DLOG_HID_ACCESS, uuid16, attr_handle, (int)(uintptr_t)arg, ctxt->op);
 
     switch (uuid16) {
 
@@ -80,7 +86,7 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
         rc = gatt_svr_chr_write(ctxt->om, 1, 1, &new_suspend_state, NULL);
         if (!rc) {
-            bool old_state = hid_set_suspend((bool) new_suspend_state);
+            bool old_state = hid_set_suspend(conn_handle, (bool) new_suspend_state);
 
             ESP_LOGI(tag, "HID_CONTROL_POINT received new suspend state: %d, old state is: %d",
                 (int)new_suspend_state, (int)old_state);
@@ -113,8 +119,11 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
         if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
 
-            rc = os_mbuf_append(ctxt->om, &HidProtocolMode,
-                                sizeof(HidProtocolMode));
+            // every central has its own protocol mode
+            uint8_t protocol_mode = hid_get_report_mode(conn_handle) ?
+                HID_PROTOCOL_MODE_BOOT : HID_PROTOCOL_MODE_REPORT;
+
+            rc = os_mbuf_append(ctxt->om, &protocol_mode, sizeof(protocol_mode));
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
         } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
@@ -124,9 +133,8 @@ hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
             rc = gatt_svr_chr_write(ctxt->om, 1, sizeof(new_protocol_mode),
                 &new_protocol_mode, NULL);
             if (!rc) {
-                HidProtocolMode = new_protocol_mode;
                 // send true if new mode is boot mode, else guess
-                hid_set_report_mode(HidProtocolMode == HID_PROTOCOL_MODE_BOOT);
+                hid_set_report_mode(conn_handle, new_protocol_mode == HID_PROTOCOL_MODE_BOOT);
 
                 ESP_LOGI(tag, "Received new protocol mode: %d",
                     (int)new_protocol_mode);
@@ -153,13 +161,12 @@ ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt,
                              void *arg)
 {
+    HID_PERF_SCOPE(HID_PERF_REPORT_ACCESS);
     uint16_t uuid16 = ble_uuid_u16(ctxt->chr->uuid);
-    int handle_num = (int) arg;
+    int handle_num = (int)(uintptr_t)arg;
     int rc = BLE_ATT_ERR_UNLIKELY;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d",
-         __FUNCTION__, uuid16, attr_handle, (int)arg, ctxt->op);
-
+    DLOG(DLOG_REPORT_ACCESS, uuid16, attr_handle, (int)(uintptr_t)arg, ctxt->op);
 
     do {
         // Report reference descriptors
@@ -168,18 +175,8 @@ ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
                 ESP_LOGI(tag, "invalid op %d", ctxt->op);
                 break;
             }
-            int rpt_ind = -1;
-
-            for (int i = 0; i < Hid_report_ref_data_count; ++i) {
-                if ((int)Hid_report_ref_data[i].id == handle_num) {
-                    rpt_ind = i;
-                    break;
-                }
-            }
-            if (rpt_ind != -1) {
-                rc = os_mbuf_append(ctxt->om,
-                    (uint8_t *)Hid_report_ref_data[rpt_ind].hidReportRef,
-                    HID_REPORT_REF_LEN);
+            if (handle_num >= 0 && handle_num < HANDLE_HID_COUNT && Hid_report_refs[handle_num][1]) {
+                rc = os_mbuf_append(ctxt->om, Hid_report_refs[handle_num], HID_REPORT_REF_LEN);
                 if (rc) {
                     rc = BLE_ATT_ERR_INSUFFICIENT_RES;
                 }
@@ -196,7 +193,7 @@ ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
                 (uuid16 == GATT_UUID_HID_BT_MOUSE_INPUT)    ||
                 (uuid16 == GATT_UUID_HID_BT_KB_INPUT)       ||
                 (uuid16 == GATT_UUID_HID_BT_KB_OUTPUT)      )) {
-            rc = hid_read_buffer(ctxt->om, handle_num);
+            rc = hid_read_buffer(conn_handle, ctxt->om, handle_num);
             if (rc) {
                 rc = BLE_ATT_ERR_INSUFFICIENT_RES;
             }
@@ -208,7 +205,8 @@ ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
             switch (handle_num) {
                 case HANDLE_HID_KB_OUT_REPORT:
                 case HANDLE_HID_FEATURE_REPORT:
-                    rc = hid_write_buffer(ctxt->om, handle_num);
+                case HANDLE_HID_MOUSE_FEATURE_REPORT:
+                    rc = hid_write_buffer(conn_handle, ctxt->om, handle_num);
                     if (rc) {
                         rc = BLE_ATT_ERR_INSUFFICIENT_RES;
                     }
@@ -235,13 +233,12 @@ ble_svc_battery_access(uint16_t conn_handle, uint16_t attr_handle,
     uint16_t uuid16 = ble_uuid_u16(ctxt->chr->uuid);
     int rc = 0;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d",
-         __FUNCTION__, uuid16, attr_handle, (int) arg, ctxt->op);
+    DLOG(DLOG_BATTERY_ACCESS, uuid16, attr_handle, (int)(uintptr_t)arg, ctxt->op);
 
     switch (uuid16) {
         case BLE_SVC_BAS_CHR_UUID16_BATTERY_LEVEL:
             if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-                rc = hid_read_buffer(ctxt->om, (int) arg);
+                rc = hid_read_buffer(conn_handle, ctxt->om, (int)(uintptr_t)arg);
                 // rc = hid_battery_level_get(ctxt->om);
                 if (rc) {
                     ESP_LOGW(tag, "Error reading battery buffer, rc = %d", rc);
@@ -271,6 +268,103 @@ ble_svc_battery_access(uint16_t conn_handle, uint16_t attr_handle,
     return rc;
 }
 
+/**
+ * Typing service access function
+ */
+int
+ble_svc_typing_access(uint16_t conn_handle, uint16_t attr_handle,
+                      struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    int rc;
+
+    (void)conn_handle;
+    (void)attr_handle;
+    (void)arg;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR: {
+            // writer sends the next text when there is room for it
+            size_t free_space = hid_typing_space();
+            uint16_t space = free_space > UINT16_MAX ? UINT16_MAX : free_space;
+
+            rc = os_mbuf_append(ctxt->om, &space, sizeof(space));
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+            char text[TYPING_TEXT_MAX_LEN];
+            uint16_t len;
+
+            rc = gatt_svr_chr_write(ctxt->om, 1, sizeof(text), text, &len);
+            if (rc) {
+                return rc;
+            }
+            if (hid_typing_write(text, len) != len) {
+                ESP_LOGW(tag, "typing buffer is full, %d bytes rejected", len);
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            return 0;
+        }
+
+        default:
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+/**
+ * Diagnostics service access function
+ */
+int
+ble_svc_diag_access(uint16_t conn_handle, uint16_t attr_handle,
+                    struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    int rc;
+
+    (void)attr_handle;
+
+    if ((int)(uintptr_t)arg == HANDLE_DIAG_FLIGHT_REC) {
+        switch (ctxt->op) {
+            case BLE_GATT_ACCESS_OP_READ_CHR:
+                rc = flight_rec_read(ctxt->om);
+                return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+            case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+                uint8_t cmd[3];
+                uint16_t len;
+
+                rc = gatt_svr_chr_write(ctxt->om, 1, sizeof(cmd), cmd, &len);
+                return rc == 0 ? flight_rec_command(conn_handle, cmd, len) : rc;
+            }
+
+            default:
+                return BLE_ATT_ERR_UNLIKELY;
+        }
+    }
+
+#ifdef CONFIG_HID_LATENCY
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            rc = hid_latency_read(ctxt->om);
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+            uint8_t cmd;
+
+            rc = gatt_svr_chr_write(ctxt->om, 1, sizeof(cmd), &cmd, NULL);
+            if (rc == 0) {
+                hid_latency_command(cmd);
+            }
+            return rc;
+        }
+
+        default:
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+#else
+    return BLE_ATT_ERR_UNLIKELY;
+#endif
+}
+
 /**
  * Simple read access callback for the device information service
  * characteristic.
@@ -284,8 +378,8 @@ ble_svc_dis_access(uint16_t conn_handle, uint16_t attr_handle,
     int rc = 0;
     int data_len = 0;
 
-    ESP_LOGI("", "%s: UUID %04X attr %04X arg %d op %d",
-         __FUNCTION__, uuid, attr_handle, (int)arg, ctxt->op);
+    (void)conn_handle;
+    DLOG(DLOG_DIS_ACCESS, uuid, attr_handle, (int)(uintptr_t)arg, ctxt->op);
 
     switch(uuid) {
     case BLE_SVC_DIS_CHR_UUID16_MODEL_NUMBER:
@@ -360,26 +454,35 @@ gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
 {
     char buf[BLE_UUID_STR_LEN];
 
+    (void)arg;
+
+    // debug level: dozens of lines on console delay the first advertisement
     switch (ctxt->op) {
         case BLE_GATT_REGISTER_OP_SVC:
-            ESP_LOGI("service","uuid16 %s handle=%d (%04X)",
+            ESP_LOGD("service","uuid16 %s handle=%d (%04X)",
                 ble_uuid_to_str(ctxt->svc.svc_def->uuid, buf),
                 ctxt->svc.handle, ctxt->svc.handle);
             break;
 
         case BLE_GATT_REGISTER_OP_CHR:
-            ESP_LOGI("charact",
+            ESP_LOGD("charact",
                 "uuid16 %s arg %d def_handle=%d (%04X) val_handle=%d (%04X)",
                 ble_uuid_to_str(ctxt->chr.chr_def->uuid, buf),
-                (int)ctxt->chr.chr_def->arg,
+                (int)(uintptr_t)ctxt->chr.chr_def->arg,
                 ctxt->chr.def_handle, ctxt->chr.def_handle,
                 ctxt->chr.val_handle, ctxt->chr.val_handle);
+
+            // fill ATT handle to report dispatch table
+            if (ctxt->chr.chr_def->access_cb == ble_svc_report_access ||
+                ctxt->chr.chr_def->access_cb == ble_svc_battery_access) {
+                hid_register_report_attr(ctxt->chr.val_handle, (int)(uintptr_t)ctxt->chr.chr_def->arg);
+            }
             break;
 
         case BLE_GATT_REGISTER_OP_DSC:
-            ESP_LOGI("descrip", "uuid16 %s arg %d handle=%d (%04X)",
+            ESP_LOGD("descrip", "uuid16 %s arg %d handle=%d (%04X)",
                 ble_uuid_to_str(ctxt->dsc.dsc_def->uuid, buf),
-                (int)ctxt->dsc.dsc_def->arg,
+                (int)(uintptr_t)ctxt->dsc.dsc_def->arg,
                 ctxt->dsc.handle, ctxt->dsc.handle);
             break;
     }
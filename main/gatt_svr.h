@@ -36,6 +36,7 @@
 
 #include "modlog/modlog.h"
 #include "hid_codes.h"
+#include "hid_reports.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -60,6 +61,20 @@ extern "C" {
 #define GATT_UUID_HID_BT_KB_OUTPUT              0x2A32
 #define GATT_UUID_HID_BT_MOUSE_INPUT            0x2A33
 
+/* vendor typing service, 128-bit UUIDs in little endian byte order */
+#define GATT_UUID_TYPING_SERVICE    0x6b, 0x1d, 0x2c, 0x93, 0x5e, 0x0a, 0x4f, 0x8e, \
+                                    0x9a, 0x41, 0x7c, 0x3b, 0x01, 0x00, 0x5d, 0xe3
+#define GATT_UUID_TYPING_TEXT       0x6b, 0x1d, 0x2c, 0x93, 0x5e, 0x0a, 0x4f, 0x8e, \
+                                    0x9a, 0x41, 0x7c, 0x3b, 0x02, 0x00, 0x5d, 0xe3
+
+/* vendor diagnostics service */
+#define GATT_UUID_DIAG_SERVICE      0x6b, 0x1d, 0x2c, 0x93, 0x5e, 0x0a, 0x4f, 0x8e, \
+                                    0x9a, 0x41, 0x7c, 0x3b, 0x03, 0x00, 0x5d, 0xe3
+#define GATT_UUID_DIAG_LATENCY      0x6b, 0x1d, 0x2c, 0x93, 0x5e, 0x0a, 0x4f, 0x8e, \
+                                    0x9a, 0x41, 0x7c, 0x3b, 0x04, 0x00, 0x5d, 0xe3
+#define GATT_UUID_DIAG_FLIGHT_REC   0x6b, 0x1d, 0x2c, 0x93, 0x5e, 0x0a, 0x4f, 0x8e, \
+                                    0x9a, 0x41, 0x7c, 0x3b, 0x05, 0x00, 0x5d, 0xe3
+
 #define GATT_UUID_BAT_PRESENT_DESCR             0x2904
 #define GATT_UUID_EXT_RPT_REF_DESCR             0x2907
 #define GATT_UUID_RPT_REF_DESCR                 0x2908
@@ -94,80 +109,14 @@ extern "C" {
 #define HID_INFORMATION_LEN             4         // HID Information
 #define HID_REPORT_REF_LEN              2         // HID Report Reference Descriptor
 #define HID_EXT_REPORT_REF_LEN          2         // External Report Reference Descriptor
+#define TYPING_TEXT_MAX_LEN             256       // UTF-8 text in one write to typing characteristic
 
-// HID Report IDs for the service
-#define HID_RPT_ID_KB_OUT               0   // LED output report ID from report map
-#define HID_RPT_ID_MOUSE_IN             1   // Mouse input report ID from report map
-#define HID_RPT_ID_KB_IN                2   // Keyboard input report ID from report map
-#define HID_RPT_ID_CC_IN                3   // Consumer Control input report ID from report map
-#define HID_RPT_ID_FEATURE              4   // Feature report ID from report map
-
-// boot report cb_access args
-#define HID_BOOT_KB_IN                  6   // Keyboard input report ID
-#define HID_BOOT_KB_OUT                 7   // LED output report ID
-#define HID_BOOT_MOUSE_IN               8   // Mouse input report ID
-
-// HID Report types
-#define HID_REPORT_TYPE_INPUT           1
-#define HID_REPORT_TYPE_OUTPUT          2
-#define HID_REPORT_TYPE_FEATURE         3
-
-#define HID_CC_RPT_MUTE                 1
-#define HID_CC_RPT_POWER                2
-#define HID_CC_RPT_LAST                 3
-#define HID_CC_RPT_ASSIGN_SEL           4
-#define HID_CC_RPT_PLAY                 5
-#define HID_CC_RPT_PAUSE                6
-#define HID_CC_RPT_RECORD               7
-#define HID_CC_RPT_FAST_FWD             8
-#define HID_CC_RPT_REWIND               9
-#define HID_CC_RPT_SCAN_NEXT_TRK        10
-#define HID_CC_RPT_SCAN_PREV_TRK        11
-#define HID_CC_RPT_STOP                 12
-
-#define HID_CC_RPT_CHANNEL_UP           0x01
-#define HID_CC_RPT_CHANNEL_DOWN         0x03
-#define HID_CC_RPT_VOLUME_UP            0x40
-#define HID_CC_RPT_VOLUME_DOWN          0x80
-
-// HID Consumer Control report bitmasks
-#define HID_CC_RPT_NUMERIC_BITS         0xF0
-#define HID_CC_RPT_CHANNEL_BITS         0xCF
-#define HID_CC_RPT_VOLUME_BITS          0x3F
-#define HID_CC_RPT_BUTTON_BITS          0xF0
-#define HID_CC_RPT_SELECTION_BITS       0xCF
-
-
-// Macros for the HID Consumer Control 2-byte report
-#define HID_CC_RPT_SET_NUMERIC(s, x)    (s)[0] &= HID_CC_RPT_NUMERIC_BITS;   \
-                                        (s)[0] |= (x)
-#define HID_CC_RPT_SET_CHANNEL(s, x)    (s)[0] &= HID_CC_RPT_CHANNEL_BITS;   \
-                                        (s)[0] |= ((x) & 0x03) << 4
-#define HID_CC_RPT_SET_VOLUME(s, x)     (s)[0] &= HID_CC_RPT_VOLUME_BITS;    \
-                                        (s)[0] |= (x)
-#define HID_CC_RPT_SET_BUTTON(s, x)     (s)[1] &= HID_CC_RPT_BUTTON_BITS;    \
-                                        (s)[1] |= (x)
-#define HID_CC_RPT_SET_SELECTION(s, x)  (s)[1] &= HID_CC_RPT_SELECTION_BITS; \
-                                        (s)[1] |= ((x) & 0x03) << 4
-
-// Keyboard report size
-#define HIDD_LE_REPORT_KB_IN_SIZE       (8)
-
-// Mouse report size
-#define HIDD_LE_REPORT_MOUSE_SIZE       (4)
-
-// LEDS report size
-#define HIDD_LE_REPORT_KB_OUT_SIZE      (1)
-
-// Consumer control report size
-#define HIDD_LE_REPORT_CC_SIZE          (2)
+// Boot protocol mouse report size: buttons, 8-bit X and Y
+#define HIDD_LE_REPORT_BOOT_MOUSE_SIZE  (3)
 
 // battery level data size
 #define HIDD_LE_BATTERY_LEVEL_SIZE      (1)
 
-// feature data size
-#define HIDD_LE_REPORT_FEATURE          (6)
-
 /* HID information flags */
 #define HID_FLAGS_REMOTE_WAKE           0x01      // RemoteWake
 #define HID_FLAGS_NORMALLY_CONNECTABLE  0x02      // NormallyConnectable
@@ -229,22 +178,22 @@ enum attr_handles {
     HANDLE_HID_CONTROL_POINT,           // 10
     HANDLE_HID_REPORT_MAP,              // 11
     HANDLE_HID_PROTO_MODE,              // 12
-    HANDLE_HID_MOUSE_REPORT,            // 13
-    HANDLE_HID_KB_IN_REPORT,            // 14
-    HANDLE_HID_KB_OUT_REPORT,           // 15
-    HANDLE_HID_CC_REPORT,               // 16
-    HANDLE_HID_BOOT_KB_IN_REPORT,       // 17
-    HANDLE_HID_BOOT_KB_OUT_REPORT,      // 18
-    HANDLE_HID_BOOT_MOUSE_REPORT,       // 19
-    HANDLE_HID_FEATURE_REPORT,          // 20
-    HANDLE_HID_COUNT                    // 21
+    HID_REPORT_HANDLES                  // report characteristics from hid_reports.h
+    HANDLE_HID_BOOT_KB_IN_REPORT,
+    HANDLE_HID_BOOT_KB_OUT_REPORT,
+    HANDLE_HID_BOOT_MOUSE_REPORT,
+
+    // TYPING SERVICE
+    HANDLE_TYPING_TEXT,
+
+    // DIAGNOSTICS SERVICE
+    HANDLE_DIAG_FLIGHT_REC,
+    HANDLE_DIAG_LATENCY,
+    HANDLE_HID_COUNT
 };
 
-struct report_reference_table {
-    int id;
-    uint8_t hidReportRef[HID_REPORT_REF_LEN];
-} __attribute__((packed));
-
+/* size of ATT handle to report dispatch table, must be bigger than any ATT handle */
+#define GATT_SVR_MAX_ATT_HANDLES        128
 
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
 int gatt_svr_init(void);
@@ -262,6 +211,14 @@ int ble_svc_report_access(uint16_t conn_handle, uint16_t attr_handle,
 int ble_svc_battery_access(uint16_t conn_handle, uint16_t attr_handle,
                    struct ble_gatt_access_ctxt *ctxt, void *arg);
 
+/* Access function for typing service */
+int ble_svc_typing_access(uint16_t conn_handle, uint16_t attr_handle,
+                   struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+/* Access function for diagnostics service */
+int ble_svc_diag_access(uint16_t conn_handle, uint16_t attr_handle,
+                   struct ble_gatt_access_ctxt *ctxt, void *arg);
+
 /* Access function for device information service */
 int ble_svc_dis_access(uint16_t conn_handle, uint16_t attr_handle,
                    struct ble_gatt_access_ctxt *ctxt, void *arg);
@@ -282,10 +239,9 @@ extern const uint8_t HidInfo[];
 
 // HID External Report Reference Descriptor
 extern uint16_t HidExtReportRefDesc;
-extern uint8_t HidProtocolMode;
 
-extern struct report_reference_table Hid_report_ref_data[];
-extern size_t Hid_report_ref_data_count;
+/* report reference descriptor values indexed by enum attr_handles, type is 0 if handle is not a report */
+extern const uint8_t Hid_report_refs[HANDLE_HID_COUNT][HID_REPORT_REF_LEN];
 
 extern struct prf_char_pres_fmt Battery_level_units;
 
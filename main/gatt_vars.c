@@ -4,144 +4,9 @@
 
 #define SUPPORT_REPORT_VENDOR false
 
-// HID Report Map characteristic value
-// Keyboard report descriptor (using format for Boot interface descriptor)
+// HID Report Map characteristic value, collections and their reports are declared in hid_reports.h
 const uint8_t Hid_report_map[] = {
-    /*** MOUSE REPORT ***/
-    0x05, 0x01,  // Usage Page (Generic Desktop)
-    0x09, 0x02,  // Usage (Mouse)
-    0xA1, 0x01,  // Collection (Application)
-    0x85, 0x01,  // Report Id (1)
-    0x09, 0x01,  //   Usage (Pointer)
-    0xA1, 0x00,  //   Collection (Physical)
-    0x05, 0x09,  //     Usage Page (Buttons)
-    0x19, 0x01,  //     Usage Minimum (01) - Button 1
-    0x29, 0x03,  //     Usage Maximum (03) - Button 3
-    0x15, 0x00,  //     Logical Minimum (0)
-    0x25, 0x01,  //     Logical Maximum (1)
-    0x75, 0x01,  //     Report Size (1)
-    0x95, 0x03,  //     Report Count (3)
-    0x81, 0x02,  //     Input (Data, Variable, Absolute) - Button states
-    0x75, 0x05,  //     Report Size (5)
-    0x95, 0x01,  //     Report Count (1)
-    0x81, 0x01,  //     Input (Constant) - Padding or Reserved bits
-    0x05, 0x01,  //     Usage Page (Generic Desktop)
-    0x09, 0x30,  //     Usage (X)
-    0x09, 0x31,  //     Usage (Y)
-    0x09, 0x38,  //     Usage (Wheel)
-    0x15, 0x81,  //     Logical Minimum (-127)
-    0x25, 0x7F,  //     Logical Maximum (127)
-    0x75, 0x08,  //     Report Size (8)
-    0x95, 0x03,  //     Report Count (3)
-    0x81, 0x06,  //     Input (Data, Variable, Relative) - X coordinate, Y coordinate, wheel
-    0xC0,        //   End Collection
-    0xC0,        // End Collection
-
-    /*** KEYBOARD REPORT ***/
-    0x05, 0x01,  // Usage Pg (Generic Desktop)
-    0x09, 0x06,  // Usage (Keyboard)
-    0xA1, 0x01,  // Collection: (Application)
-    0x85, 0x02,  // Report Id (2)
-    //
-    0x05, 0x07,  //   Usage Pg (Key Codes)
-    0x19, 0xE0,  //   Usage Min (224)
-    0x29, 0xE7,  //   Usage Max (231)
-    0x15, 0x00,  //   Log Min (0)
-    0x25, 0x01,  //   Log Max (1)
-    //
-    //   Modifier byte
-    0x75, 0x01,  //   Report Size (1)
-    0x95, 0x08,  //   Report Count (8)
-    0x81, 0x02,  //   Input: (Data, Variable, Absolute)
-    //
-    //   Reserved byte
-    0x95, 0x01,  //   Report Count (1)
-    0x75, 0x08,  //   Report Size (8)
-    0x81, 0x01,  //   Input: (Constant)
-    //
-    //   LED report
-    0x95, 0x05,  //   Report Count (5)
-    0x75, 0x01,  //   Report Size (1)
-    0x05, 0x08,  //   Usage Pg (LEDs)
-    0x19, 0x01,  //   Usage Min (1)
-    0x29, 0x05,  //   Usage Max (5)
-    0x91, 0x02,  //   Output: (Data, Variable, Absolute)
-    //
-    //   LED report padding
-    0x95, 0x01,  //   Report Count (1)
-    0x75, 0x03,  //   Report Size (3)
-    0x91, 0x01,  //   Output: (Constant)
-    //
-    //   Key arrays (6 bytes)
-    0x95, 0x06,  //   Report Count (6)
-    0x75, 0x08,  //   Report Size (8)
-    0x15, 0x00,  //   Log Min (0)
-    0x25, 0x65,  //   Log Max (101)
-    0x05, 0x07,  //   Usage Pg (Key Codes)
-    0x19, 0x00,  //   Usage Min (0)
-    0x29, 0x65,  //   Usage Max (101)
-    0x81, 0x00,  //   Input: (Data, Array)
-    //
-    0xC0,        // End Collection
-    //
-    /*** CONSUMER DEVICE REPORT ***/
-    0x05, 0x0C,   // Usage Pg (Consumer Devices)
-    0x09, 0x01,   // Usage (Consumer Control)
-    0xA1, 0x01,   // Collection (Application)
-    0x85, 0x03,   // Report Id (3)
-    0x09, 0x02,   //   Usage (Numeric Key Pad)
-    0xA1, 0x02,   //   Collection (Logical)
-    0x05, 0x09,   //     Usage Pg (Button)
-    0x19, 0x01,   //     Usage Min (Button 1)
-    0x29, 0x0A,   //     Usage Max (Button 10)
-    0x15, 0x01,   //     Logical Min (1)
-    0x25, 0x0A,   //     Logical Max (10)
-    0x75, 0x04,   //     Report Size (4)
-    0x95, 0x01,   //     Report Count (1)
-    0x81, 0x00,   //     Input (Data, Ary, Abs)
-    0xC0,         //   End Collection
-    0x05, 0x0C,   //   Usage Pg (Consumer Devices)
-    0x09, 0x86,   //   Usage (Channel)
-    0x15, 0xFF,   //   Logical Min (-1)
-    0x25, 0x01,   //   Logical Max (1)
-    0x75, 0x02,   //   Report Size (2)
-    0x95, 0x01,   //   Report Count (1)
-    0x81, 0x46,   //   Input (Data, Var, Rel, Null)
-    0x09, 0xE9,   //   Usage (Volume Up)
-    0x09, 0xEA,   //   Usage (Volume Down)
-    0x15, 0x00,   //   Logical Min (0)
-    0x75, 0x01,   //   Report Size (1)
-    0x95, 0x02,   //   Report Count (2)
-    0x81, 0x02,   //   Input (Data, Var, Abs)
-    0x09, 0xE2,   //   Usage (Mute)
-    0x09, 0x30,   //   Usage (Power)
-    0x09, 0x83,   //   Usage (Recall Last)
-    0x09, 0x81,   //   Usage (Assign Selection)
-    0x09, 0xB0,   //   Usage (Play)
-    0x09, 0xB1,   //   Usage (Pause)
-    0x09, 0xB2,   //   Usage (Record)
-    0x09, 0xB3,   //   Usage (Fast Forward)
-    0x09, 0xB4,   //   Usage (Rewind)
-    0x09, 0xB5,   //   Usage (Scan Next)
-    0x09, 0xB6,   //   Usage (Scan Prev)
-    0x09, 0xB7,   //   Usage (Stop)
-    0x15, 0x01,   //   Logical Min (1)
-    0x25, 0x0C,   //   Logical Max (12)
-    0x75, 0x04,   //   Report Size (4)
-    0x95, 0x01,   //   Report Count (1)
-    0x81, 0x00,   //   Input (Data, Ary, Abs)
-    0x09, 0x80,   //   Usage (Selection)
-    0xA1, 0x02,   //   Collection (Logical)
-    0x05, 0x09,   //     Usage Pg (Button)
-    0x19, 0x01,   //     Usage Min (Button 1)
-    0x29, 0x03,   //     Usage Max (Button 3)
-    0x15, 0x01,   //     Logical Min (1)
-    0x25, 0x03,   //     Logical Max (3)
-    0x75, 0x02,   //     Report Size (2)
-    0x81, 0x00,   //     Input (Data, Ary, Abs)
-    0xC0,         //   End Collection
-    0x81, 0x03,   //   Input (Const, Var, Abs)
-    0xC0,         // End Collection
+    HID_REPORT_MAP_BYTES
 };
 
 size_t Hid_report_map_size = sizeof(Hid_report_map);
@@ -153,6 +18,30 @@ size_t Hid_report_map_size = sizeof(Hid_report_map);
 
 #define MY_NOTIFY_FLAGS (BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE)
 
+/* report characteristic flags by report type */
+#define REPORT_FLAGS_INPUT   MY_NOTIFY_FLAGS
+#define REPORT_FLAGS_OUTPUT  (BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP)
+#define REPORT_FLAGS_FEATURE (BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE)
+
+/* report characteristic with its Report Reference Descriptor, one for each report of hid_reports.h */
+#define REPORT_CHR(report, coll, type) {                                    \
+        .uuid = BLE_UUID16_DECLARE(GATT_UUID_HID_REPORT),                   \
+        .access_cb = ble_svc_report_access,                                 \
+        .arg = (void *)HANDLE_HID_##report##_REPORT,                        \
+        .val_handle = &Svc_char_handles[HANDLE_HID_##report##_REPORT],      \
+        .flags = REPORT_FLAGS_##type,                                       \
+        .min_key_size = DEFAULT_MIN_KEY_SIZE,                               \
+        .descriptors = (struct ble_gatt_dsc_def[]) { {                      \
+            .uuid = BLE_UUID16_DECLARE(GATT_UUID_RPT_REF_DESCR),            \
+            .att_flags = BLE_ATT_F_READ,                                    \
+            .access_cb = ble_svc_report_access,                             \
+            .arg = (void *)HANDLE_HID_##report##_REPORT,                    \
+            .min_key_size = DEFAULT_MIN_KEY_SIZE,                           \
+        }, {                                                                \
+            0, /* No more descriptors in this characteristic. */            \
+        } },                                                                \
+    },
+
 const struct ble_gatt_svc_def Gatt_svr_included_services[] = {
     {
         /*** Battery Service. */
@@ -300,79 +189,10 @@ const struct ble_gatt_svc_def Gatt_svr_svcs[] = {
                 .val_handle = &Svc_char_handles[HANDLE_HID_PROTO_MODE],
                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
                 NO_ARG_DESCR_MKS,
-            }, {
-            /*** Mouse hid report */
-                .uuid = BLE_UUID16_DECLARE(GATT_UUID_HID_REPORT),
-                .access_cb = ble_svc_report_access,
-                .arg = (void *)HANDLE_HID_MOUSE_REPORT,
-                .val_handle = &Svc_char_handles[HANDLE_HID_MOUSE_REPORT],
-                .flags = MY_NOTIFY_FLAGS,
-                .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                .descriptors = (struct ble_gatt_dsc_def[]) { {
-                    /* Report Reference Descriptor */
-                    .uuid = BLE_UUID16_DECLARE(GATT_UUID_RPT_REF_DESCR),
-                    .att_flags = BLE_ATT_F_READ,
-                    .access_cb = ble_svc_report_access,
-                    .arg = (void *)HANDLE_HID_MOUSE_REPORT,
-                    .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                }, {
-                    0, /* No more descriptors in this characteristic. */
-                } },
-            }, {
-            /*** Keyboard hid report */
-                .uuid = BLE_UUID16_DECLARE(GATT_UUID_HID_REPORT),
-                .access_cb = ble_svc_report_access,
-                .arg = (void *)HANDLE_HID_KB_IN_REPORT,
-                .val_handle = &Svc_char_handles[HANDLE_HID_KB_IN_REPORT],
-                .flags = MY_NOTIFY_FLAGS,
-                .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                .descriptors = (struct ble_gatt_dsc_def[]) { {
-                    /* Report Reference Descriptor */
-                    .uuid = BLE_UUID16_DECLARE(GATT_UUID_RPT_REF_DESCR),
-                    .att_flags = BLE_ATT_F_READ,
-                    .access_cb = ble_svc_report_access,
-                    .arg = (void *)HANDLE_HID_KB_IN_REPORT,
-                    .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                }, {
-                    0, /* No more descriptors in this characteristic. */
-                } },
-            }, {
-            /*** Keyboard hid out (LED IN/OUT) report */
-                .uuid = BLE_UUID16_DECLARE(GATT_UUID_HID_REPORT),
-                .access_cb = ble_svc_report_access,
-                .arg = (void *)HANDLE_HID_KB_OUT_REPORT,
-                .val_handle = &Svc_char_handles[HANDLE_HID_KB_OUT_REPORT],
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
-                .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                .descriptors = (struct ble_gatt_dsc_def[]) { {
-                    /* Report Reference Descriptor */
-                    .uuid = BLE_UUID16_DECLARE(GATT_UUID_RPT_REF_DESCR),
-                    .att_flags = BLE_ATT_F_READ,
-                    .access_cb = ble_svc_report_access,
-                    .arg = (void *)HANDLE_HID_KB_OUT_REPORT,
-                    .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                }, {
-                    0, /* No more descriptors in this characteristic. */
-                } },
-            }, {
-            /*** Consumer control hid report */
-                .uuid = BLE_UUID16_DECLARE(GATT_UUID_HID_REPORT),
-                .access_cb = ble_svc_report_access,
-                .arg = (void *)HANDLE_HID_CC_REPORT,
-                .val_handle = &Svc_char_handles[HANDLE_HID_CC_REPORT],
-                .flags = MY_NOTIFY_FLAGS,
-                .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                .descriptors = (struct ble_gatt_dsc_def[]) { {
-                    /* Report Reference Descriptor */
-                    .uuid = BLE_UUID16_DECLARE(GATT_UUID_RPT_REF_DESCR),
-                    .att_flags = BLE_ATT_F_READ,
-                    .access_cb = ble_svc_report_access,
-                    .arg = (void *)HANDLE_HID_CC_REPORT,
-                    .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                }, {
-                    0, /* No more descriptors in this characteristic. */
-                } },
-            }, {
+            },
+            /*** Report characteristics of hid_reports.h, the ones which were before boot reports */
+            HID_REPORTS_BEFORE_BOOT(REPORT_CHR)
+            {
             /*** Keyboard input boot hid report */
                 .uuid = BLE_UUID16_DECLARE(GATT_UUID_HID_BT_KB_INPUT),
                 .access_cb = ble_svc_report_access,
@@ -396,30 +216,67 @@ const struct ble_gatt_svc_def Gatt_svr_svcs[] = {
                 .val_handle = &Svc_char_handles[HANDLE_HID_BOOT_MOUSE_REPORT],
                 .flags = MY_NOTIFY_FLAGS,
                 NO_DESCR_MKS,
-            }, {
-            /*** Feature hid report */
-                .uuid = BLE_UUID16_DECLARE(GATT_UUID_HID_REPORT),
-                .access_cb = ble_svc_report_access,
-                .arg = (void *)HANDLE_HID_FEATURE_REPORT,
-                .val_handle = &Svc_char_handles[HANDLE_HID_FEATURE_REPORT],
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                .descriptors = (struct ble_gatt_dsc_def[]) { {
-                    /* Report Reference Descriptor */
-                    .uuid = BLE_UUID16_DECLARE(GATT_UUID_RPT_REF_DESCR),
-                    .att_flags = BLE_ATT_F_READ,
-                    .access_cb = ble_svc_report_access,
-                    .arg = (void *)HANDLE_HID_FEATURE_REPORT,
-                    .min_key_size = DEFAULT_MIN_KEY_SIZE,
-                }, {
-                    0, /* No more descriptors in this characteristic. */
-                } },
-            }, {
+            },
+            /*** The rest of report characteristics */
+            HID_REPORTS_AFTER_BOOT(REPORT_CHR)
+            {
                 0, /* No more characteristics in this service. */
             }
         },
     },
 
+    {
+        /*** Typing Service */
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID128_DECLARE(GATT_UUID_TYPING_SERVICE),
+        .includes = NULL,
+        .characteristics = (struct ble_gatt_chr_def[]) { {
+        /*** Text characteristic: write UTF-8 text to type it, read free buffer space */
+            .uuid = BLE_UUID128_DECLARE(GATT_UUID_TYPING_TEXT),
+            .access_cb = ble_svc_typing_access,
+            .arg = (void *)HANDLE_TYPING_TEXT,
+            .val_handle = &Svc_char_handles[HANDLE_TYPING_TEXT],
+            // text becomes keystrokes on the host, so link must be encrypted
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |
+                     BLE_GATT_CHR_F_WRITE_ENC,
+            NO_DESCR_MKS,
+        }, {
+            0, /* No more characteristics in this service. */
+        } },
+    },
+
+    {
+        /*** Diagnostics Service */
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID128_DECLARE(GATT_UUID_DIAG_SERVICE),
+        .includes = NULL,
+        .characteristics = (struct ble_gatt_chr_def[]) { {
+        /*** Flight recorder: write 0x10 and page number, then read the page (format in flight_rec.h) */
+            .uuid = BLE_UUID128_DECLARE(GATT_UUID_DIAG_FLIGHT_REC),
+            .access_cb = ble_svc_diag_access,
+            .arg = (void *)HANDLE_DIAG_FLIGHT_REC,
+            .val_handle = &Svc_char_handles[HANDLE_DIAG_FLIGHT_REC],
+            // event timeline tells about user input, page select needs the bond too
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC |
+                     BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+            NO_DESCR_MKS,
+        }, {
+#ifdef CONFIG_HID_LATENCY
+        /*** Latency histograms: read them, write 1 to reset, 2 to print them to log */
+            .uuid = BLE_UUID128_DECLARE(GATT_UUID_DIAG_LATENCY),
+            .access_cb = ble_svc_diag_access,
+            .arg = (void *)HANDLE_DIAG_LATENCY,
+            .val_handle = &Svc_char_handles[HANDLE_DIAG_LATENCY],
+            // histograms tell about typing rhythm, reset and print need the bond too
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC |
+                     BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+            NO_DESCR_MKS,
+        }, {
+#endif
+            0, /* No more characteristics in this service. */
+        } },
+    },
+
     {
         0, /* No more services. */
     },
@@ -438,17 +295,11 @@ const uint8_t HidInfo[HID_INFORMATION_LEN] = {
 
 // HID External Report Reference Descriptor
 uint16_t HidExtReportRefDesc = BLE_SVC_BAS_CHR_UUID16_BATTERY_LEVEL;
-uint8_t  HidProtocolMode = HID_PROTOCOL_MODE_REPORT;
 
 /* Report reference table, byte 0 - report id from report map, byte 1 - report type (in,out,feature)*/
-struct report_reference_table Hid_report_ref_data[] = {
-    { .id = HANDLE_HID_MOUSE_REPORT,    .hidReportRef = { HID_RPT_ID_MOUSE_IN,  HID_REPORT_TYPE_INPUT   }},
-    { .id = HANDLE_HID_KB_IN_REPORT,    .hidReportRef = { HID_RPT_ID_KB_IN,     HID_REPORT_TYPE_INPUT   }},
-    { .id = HANDLE_HID_KB_OUT_REPORT,   .hidReportRef = { HID_RPT_ID_KB_IN,     HID_REPORT_TYPE_OUTPUT  }},
-    { .id = HANDLE_HID_CC_REPORT,       .hidReportRef = { HID_RPT_ID_CC_IN,     HID_REPORT_TYPE_INPUT   }},
-    { .id = HANDLE_HID_FEATURE_REPORT,  .hidReportRef = { HID_RPT_ID_FEATURE,   HID_REPORT_TYPE_FEATURE }},
+const uint8_t Hid_report_refs[HANDLE_HID_COUNT][HID_REPORT_REF_LEN] = {
+    HID_REPORT_REFS
 };
-size_t Hid_report_ref_data_count = sizeof(Hid_report_ref_data)/sizeof(Hid_report_ref_data[0]);
 
 // battery level unit - percents
 struct prf_char_pres_fmt Battery_level_units = {
@@ -1,18 +1,34 @@
+#include <stdint.h>
 #include <string.h>
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "driver/gpio.h"
+#include "esp_timer.h"
+#ifdef CONFIG_GPIO_ISR_PROFILE
+#include "xtensa/hal.h"
+#endif
 
 #include "gpio_func.h"
 #include "hid_codes.h"
+#include "btn_ring.h"
+#include "debounce.h"
+#include "hid_latency.h"
+#include "flight_rec.h"
+#include "boot_time.h"
+#ifdef CONFIG_KBD_MATRIX
+#include "matrix.h"
+#endif
 
 #define task_delay_ms(PAR_MS) vTaskDelay(pdMS_TO_TICKS(PAR_MS))
 
-// time to wait for rattle to end in milliseconds
-#define ANTI_RATTLE_TIME 5
+// default time to wait for rattle to end in microseconds
+#ifdef CONFIG_BUTTON_DEBOUNCE_US
+#define ANTI_RATTLE_TIME_US CONFIG_BUTTON_DEBOUNCE_US
+#else
+#define ANTI_RATTLE_TIME_US 5000
+#endif
 
 #define ESP_INTR_FLAG_DEFAULT 0
 
@@ -25,22 +41,13 @@
 
 static const char *tag = "NimBLEKBD_gpio";
 
-// #define WAIT_TICKS pdMS_TO_TICKS(ANTI_RATTLE_TIME)
-// #if WAIT_TICKS == (0)
-// #define WAIT_TICKS  (1)
-// #endif
-
-// ticks in antirattling time
-int Ticks_to_wait = 1;
-
 // buttons array
 static struct kbd_button {
     // button's GPIO
     uint32_t gpio;
 
-    // ticks from program start when rattling will over
-    // if this not 0, then it is rattling right now
-    TickType_t max_ticks;
+    // time to wait for rattle to end in microseconds, 0 - ANTI_RATTLE_TIME_US
+    uint32_t debounce_us;
 
     // button to emulate, 32 bit
     // bits 0-7: button keycode (from hid_codes.h)
@@ -59,34 +66,209 @@ static struct kbd_button {
 };
 static int Hid_buttons_count = sizeof(Hid_buttons)/sizeof(Hid_buttons[0]);
 
+// rattling state of the buttons, index is the same as in Hid_buttons
+static struct debounce_button Debounce_buttons[sizeof(Hid_buttons)/sizeof(Hid_buttons[0])];
+static struct debounce Debounce;
+
+// one-shot timer to check buttons when rattling is over
+static esp_timer_handle_t Debounce_timer = NULL;
+
 static SemaphoreHandle_t ISR_semaphore = NULL;
 
+#ifdef CONFIG_HID_LATENCY
+// time of the first edge of rattling, index is the same as in Hid_buttons
+static volatile uint32_t Edge_us[sizeof(Hid_buttons)/sizeof(Hid_buttons[0])];
+#endif
+
+/* debounce clock, microseconds from boot */
+static uint32_t IRAM_ATTR
+debounce_clock_us(void)
+{
+    return (uint32_t) esp_timer_get_time();
+}
+
+/* wake up gpio_btn_task when the earliest rattle is over */
+static void
+debounce_timer_cb(void *arg)
+{
+    (void)arg;
+    xSemaphoreGive(ISR_semaphore);
+}
+
+#ifdef CONFIG_GPIO_ISR_PROFILE
+// CPU cycles spent in gpio_isr_handler1, written by ISR only
+static volatile struct {
+    uint32_t edges;
+    uint32_t cycles_total;
+    uint32_t cycles_max;
+} Isr_profile;
+#endif
+
 static void IRAM_ATTR
 gpio_isr_handler1(void* arg)  // gpio isr
 {
-    uint32_t gpio_num = (uint32_t)arg;
-    int cur_button = -1;
+#ifdef CONFIG_GPIO_ISR_PROFILE
+    uint32_t start_cycles = xthal_get_ccount();
+#endif
 
-    // find the index of button in Hid_buttons array
-    for (int i = 0; i < Hid_buttons_count; ++i) {
-        if (Hid_buttons[i].gpio == gpio_num) {
-            cur_button = i;
-            break;
+    // ISR argument is the index of button in Hid_buttons array
+    uint32_t cur_button = (uint32_t)(uintptr_t)arg;
+
+    // "give" semaphore to start gpio_btn_task watching at this gpio pin
+    // ISR will not give seamphore on rattle interrupts
+    bool started = debounce_edge(&Debounce, cur_button);
+
+    flight_rec(FLIGHT_EV_GPIO_EDGE, cur_button, started);
+    if (started) {
+#ifdef CONFIG_HID_LATENCY
+        Edge_us[cur_button] = HID_LAT_NOW();
+#endif
+        xSemaphoreGiveFromISR(ISR_semaphore, NULL);
+    }
+
+#ifdef CONFIG_GPIO_ISR_PROFILE
+    uint32_t cycles = xthal_get_ccount() - start_cycles;
+    Isr_profile.edges++;
+    Isr_profile.cycles_total += cycles;
+    if (cycles > Isr_profile.cycles_max) {
+        Isr_profile.cycles_max = cycles;
+    }
+#endif
+}
+
+#ifdef CONFIG_KBD_MATRIX
+/*
+Keyboard matrix: rows are open drain outputs, active row is driven low,
+columns are inputs with pull-ups, pressed key pulls its column low.
+*/
+static const uint8_t Matrix_row_gpios[] = { 25, 26 };
+static const uint8_t Matrix_col_gpios[] = { 27, 32, 33 };
+
+#define MATRIX_ROWS ((int)(sizeof(Matrix_row_gpios)/sizeof(Matrix_row_gpios[0])))
+#define MATRIX_COLS ((int)(sizeof(Matrix_col_gpios)/sizeof(Matrix_col_gpios[0])))
+
+// button to emulate for each key, the same format as hid_button in Hid_buttons
+static const uint32_t Matrix_keymap[MATRIX_ROWS][MATRIX_COLS] = {
+    { HID_KEY_A | BUTTON_TYPE_KEYBOARD, HID_KEY_B | BUTTON_TYPE_KEYBOARD, HID_KEY_C | BUTTON_TYPE_KEYBOARD },
+    { HID_KEY_LEFT_SHIFT | BUTTON_TYPE_KEYBOARD, HID_KEY_SPACEBAR | BUTTON_TYPE_KEYBOARD, HID_KEY_RETURN | BUTTON_TYPE_KEYBOARD },
+};
+
+_Static_assert(MATRIX_ROWS <= MATRIX_MAX_ROWS && MATRIX_COLS <= MATRIX_MAX_COLS, "matrix is too big");
+
+static struct matrix Matrix;
+
+// periodic timer for fast polling while keys are active
+static esp_timer_handle_t Matrix_timer = NULL;
+
+// set by column ISR when matrix is sleeping, set by Matrix_timer when polling
+static volatile bool Matrix_wakeup = false, Matrix_tick = false;
+static bool Matrix_scanning = false;
+static int Matrix_idle_scans = 0;
+
+static void
+matrix_select_row(int row, void *arg)
+{
+    (void)arg;
+    gpio_set_level(Matrix_row_gpios[row], 0);
+}
+
+static void
+matrix_unselect_row(int row, void *arg)
+{
+    (void)arg;
+    gpio_set_level(Matrix_row_gpios[row], 1);
+}
+
+static uint32_t
+matrix_read_cols(void *arg)
+{
+    uint32_t cols = 0;
+
+    (void)arg;
+    for (int i = 0; i < MATRIX_COLS; ++i) {
+        if (gpio_get_level(Matrix_col_gpios[i]) == 0) {
+            cols |= 1UL << i;
         }
     }
-    if (cur_button == -1) return;
+    return cols;
+}
 
-    uint32_t cur_ticks = xTaskGetTickCountFromISR(),
-             old_ticks = Hid_buttons[cur_button].max_ticks;
+/* any key pressed while matrix is sleeping */
+static void IRAM_ATTR
+matrix_col_isr(void *arg)
+{
+    (void)arg;
+    Matrix_wakeup = true;
+    xSemaphoreGiveFromISR(ISR_semaphore, NULL);
+}
 
-    Hid_buttons[cur_button].max_ticks = cur_ticks + Ticks_to_wait;
+static void
+matrix_timer_cb(void *arg)
+{
+    (void)arg;
+    Matrix_tick = true;
+    xSemaphoreGive(ISR_semaphore);
+}
 
-    // "give" semaphore to start gpio_btn_task watching at this gpio pin
-    // ISR will not give seamphore on rattle interrupts
-    if (old_ticks == 0) {
-        xSemaphoreGiveFromISR(ISR_semaphore, NULL);
+/* all rows active, any key press gives column interrupt */
+static void
+matrix_sleep()
+{
+    for (int i = 0; i < MATRIX_ROWS; ++i) {
+        gpio_set_level(Matrix_row_gpios[i], 0);
+    }
+    for (int i = 0; i < MATRIX_COLS; ++i) {
+        gpio_intr_enable(Matrix_col_gpios[i]);
+    }
+}
+
+static void
+matrix_setup()
+{
+    const struct matrix_hw hw = {
+        .select_row = matrix_select_row,
+        .unselect_row = matrix_unselect_row,
+        .read_cols = matrix_read_cols,
+    };
+    const esp_timer_create_args_t timer_args = {
+        .callback = matrix_timer_cb,
+        .name = "matrix",
+    };
+    uint64_t row_pins = 0, col_pins = 0;
+    gpio_config_t io_conf;
+
+    for (int i = 0; i < MATRIX_ROWS; ++i) {
+        row_pins |= (1ULL << Matrix_row_gpios[i]);
     }
+    for (int i = 0; i < MATRIX_COLS; ++i) {
+        col_pins |= (1ULL << Matrix_col_gpios[i]);
+    }
+
+    memset(&io_conf, 0, sizeof(io_conf));
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.pin_bit_mask = row_pins;
+    io_conf.mode = GPIO_MODE_OUTPUT_OD;
+    gpio_config(&io_conf);
+
+    io_conf.intr_type = GPIO_INTR_NEGEDGE;
+    io_conf.pin_bit_mask = col_pins;
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pull_up_en = 1;
+    gpio_config(&io_conf);
+
+    matrix_init(&Matrix, MATRIX_ROWS, MATRIX_COLS, &hw, CONFIG_KBD_MATRIX_DEBOUNCE_SCANS);
+
+    if (esp_timer_create(&timer_args, &Matrix_timer) != ESP_OK) {
+        ESP_LOGE(tag, "Can not create matrix timer!");
+        return;
+    }
+
+    for (int i = 0; i < MATRIX_COLS; ++i) {
+        gpio_isr_handler_add(Matrix_col_gpios[i], matrix_col_isr, NULL);
+    }
+    matrix_sleep();
 }
+#endif
 
 void
 gpio_reset()
@@ -123,14 +305,21 @@ gpio_setup()
     io_conf.pull_up_en = 1;
     gpio_config(&io_conf);
 
+    debounce_init(&Debounce, Debounce_buttons, Hid_buttons_count, debounce_clock_us);
+
     // GPIO ISR binding
     gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-    for (uint32_t i = 0; i < Hid_buttons_count; ++i) {
+    for (int i = 0; i < Hid_buttons_count; ++i) {
         // zero button state values
-        Hid_buttons[i].max_ticks = 0;
+        Debounce_buttons[i].window_us = Hid_buttons[i].debounce_us ?
+            Hid_buttons[i].debounce_us : ANTI_RATTLE_TIME_US;
         Hid_buttons[i].last_state = Hid_buttons[i].hid_button | BUTTON_RELEASED_BIT;
-        gpio_isr_handler_add(Hid_buttons[i].gpio, gpio_isr_handler1, (void *) Hid_buttons[i].gpio);
+        gpio_isr_handler_add(Hid_buttons[i].gpio, gpio_isr_handler1, (void *)(uintptr_t)i);
     }
+
+#ifdef CONFIG_KBD_MATRIX
+    matrix_setup();
+#endif
 }
 
 int
@@ -141,67 +330,162 @@ set_leds(uint8_t hid_leds)
     return 0;
 }
 
+/* context of debounce_settled() calls */
+struct btn_poll_ctx {
+    struct btn_ring *ring;
+    // wake up consumer only once for all events of this pass
+    bool pushed;
+};
+
+/* button has stopped rattling, send its state to consumer if it has changed */
+static bool
+debounce_settled(int button_idx, void *arg)
+{
+    struct btn_poll_ctx *ctx = arg;
+    struct kbd_button *button = &Hid_buttons[button_idx];
+    struct btn_event event;
+
+    event.button = button->hid_button;
+#ifdef CONFIG_HID_LATENCY
+    event.edge_us = Edge_us[button_idx];
+#else
+    event.edge_us = 0;
+#endif
+    event.debounced_us = HID_LAT_NOW();
+    // gpio level 0 is pressed, 1 is released
+    if (gpio_get_level(button->gpio) > 0) {
+        event.button |= BUTTON_RELEASED_BIT; // it is released
+    }
+
+    if (button->last_state == event.button) {
+        // false state change
+        return true;
+    }
+
+    if (!btn_ring_push(ctx->ring, &event)) {
+        // no room in ring (overflow is counted by the ring), debounce will retry it
+        return false;
+    }
+    flight_rec(FLIGHT_EV_BUTTON, FLIGHT_BUTTON_ARG(event.button, button_idx), event.button);
+
+    button->last_state = event.button;
+    ctx->pushed = true;
+    return true;
+}
+
+#ifdef CONFIG_KBD_MATRIX
+/* debounced key change in matrix, send it to consumer */
+static bool
+matrix_event(int row, int col, bool pressed, void *arg)
+{
+    struct btn_poll_ctx *ctx = arg;
+    struct btn_event event;
+
+    event.button = Matrix_keymap[row][col];
+    // scan finds the key, time of its edge is not known
+    event.edge_us = 0;
+    event.debounced_us = HID_LAT_NOW();
+    if (!pressed) {
+        event.button |= BUTTON_RELEASED_BIT;
+    }
+
+    if (!btn_ring_push(ctx->ring, &event)) {
+        // no room in ring (overflow is counted by the ring), matrix will retry it
+        return false;
+    }
+    flight_rec(FLIGHT_EV_BUTTON, FLIGHT_BUTTON_ARG(event.button, -1), event.button);
+
+    ctx->pushed = true;
+    return true;
+}
+
+/* sleep until column interrupt, then poll matrix until all keys are released */
+static void
+matrix_poll(struct btn_poll_ctx *ctx)
+{
+    if (Matrix_wakeup && !Matrix_scanning) {
+        for (int i = 0; i < MATRIX_COLS; ++i) {
+            gpio_intr_disable(Matrix_col_gpios[i]);
+        }
+        for (int i = 0; i < MATRIX_ROWS; ++i) {
+            gpio_set_level(Matrix_row_gpios[i], 1);
+        }
+        Matrix_scanning = true;
+        Matrix_idle_scans = 0;
+        Matrix_tick = true;
+        esp_timer_start_periodic(Matrix_timer, CONFIG_KBD_MATRIX_SCAN_US);
+    }
+    Matrix_wakeup = false;
+
+    if (!Matrix_scanning || !Matrix_tick) {
+        return;
+    }
+    Matrix_tick = false;
+
+    if (matrix_scan(&Matrix, matrix_event, ctx)) {
+        Matrix_idle_scans = 0;
+    } else if (++Matrix_idle_scans >= CONFIG_KBD_MATRIX_IDLE_SCANS) {
+        esp_timer_stop(Matrix_timer);
+        Matrix_scanning = false;
+        matrix_sleep();
+    }
+}
+#endif
+
 void IRAM_ATTR
 gpio_btn_task(void* arg)
 {
-    QueueHandle_t buttons_queue = arg;
-    TickType_t delay_time = portMAX_DELAY, cur_ticks;
-    uint32_t button;
+    struct btn_poll_ctx ctx = { .ring = arg };
 
+    boot_stamp(BOOT_INPUT_TASK);
     ISR_semaphore = xSemaphoreCreateBinary();
-    if (!ISR_semaphore || !buttons_queue) {
-        ESP_LOGE(tag, "Can not create semaphore! %p %p", buttons_queue, ISR_semaphore);
+    if (!ISR_semaphore || !ctx.ring) {
+        ESP_LOGE(tag, "Can not create semaphore! %p %p", ctx.ring, ISR_semaphore);
         vTaskDelay(pdMS_TO_TICKS(30000));
         esp_restart();
     }
 
-    // when ticks per second is too small, rattle period can be zero, but it is unacceptable
-    Ticks_to_wait = pdMS_TO_TICKS(ANTI_RATTLE_TIME) > 0 ? pdMS_TO_TICKS(ANTI_RATTLE_TIME) : 1;
+    const esp_timer_create_args_t timer_args = {
+        .callback = debounce_timer_cb,
+        .name = "debounce",
+    };
+    if (esp_timer_create(&timer_args, &Debounce_timer) != ESP_OK) {
+        ESP_LOGE(tag, "Can not create debounce timer!");
+        vTaskDelay(pdMS_TO_TICKS(30000));
+        esp_restart();
+    }
 
     gpio_setup();
+    boot_stamp(BOOT_GPIO);
 
     while(1) {
 
-        xSemaphoreTake(ISR_semaphore, delay_time);
-
-        cur_ticks = xTaskGetTickCount();
-
-        delay_time = portMAX_DELAY;
-
-        for (int i = 0; i < Hid_buttons_count; ++i) {
-
-            if (Hid_buttons[i].max_ticks) {
-                if (Hid_buttons[i].max_ticks <= cur_ticks) {
-                    // this button does not rattle any more
-
-                    button = Hid_buttons[i].hid_button;
-                    // gpio level 0 is pressed, 1 is released
-                    if (gpio_get_level(Hid_buttons[i].gpio) > 0) {
-                        button |= BUTTON_RELEASED_BIT; // it is released
-                    }
-
-                    if (Hid_buttons[i].last_state == button) {
-                        // false state change
-                        Hid_buttons[i].max_ticks = 0;
-                    } else {
-                        if (xQueueSend(buttons_queue, (void *) &button, 0) == pdTRUE) {
-                            Hid_buttons[i].max_ticks = 0;
-                            Hid_buttons[i].last_state = button;
-                            continue;
-                        } else {
-                            // no room in queue, trying to send it on next tick
-                            ESP_LOGI(tag, "No room in out queue!");
-                            Hid_buttons[i].max_ticks = cur_ticks + 1;
-                        }
-                    }
-                }
-
-                // find shortest time among the rattling buttons
-                if (Hid_buttons[i].max_ticks > cur_ticks &&
-                    Hid_buttons[i].max_ticks - cur_ticks < delay_time) {
-                    delay_time = Hid_buttons[i].max_ticks - cur_ticks;
-                }
-            }
+        xSemaphoreTake(ISR_semaphore, portMAX_DELAY);
+
+        ctx.pushed = false;
+
+        uint32_t next_poll_us = debounce_poll(&Debounce, debounce_settled, &ctx);
+
+        if (next_poll_us != DEBOUNCE_IDLE) {
+            // timer may be running for a later deadline, restart it
+            esp_timer_stop(Debounce_timer);
+            esp_timer_start_once(Debounce_timer, next_poll_us);
         }
+
+#ifdef CONFIG_KBD_MATRIX
+        matrix_poll(&ctx);
+#endif
+
+        if (ctx.pushed && ctx.ring->consumer) {
+            xTaskNotifyGive((TaskHandle_t) ctx.ring->consumer);
+        }
+
+#ifdef CONFIG_GPIO_ISR_PROFILE
+        if (ctx.pushed && Isr_profile.edges) {
+            ESP_LOGI(tag, "ISR edges %u, cycles per edge: avg %u, max %u",
+                Isr_profile.edges, Isr_profile.cycles_total / Isr_profile.edges,
+                Isr_profile.cycles_max);
+        }
+#endif
     }
 }
@@ -70,6 +70,7 @@
 #define HID_KEY_LEFT_BRKT      47   // Keyboard [ and {
 #define HID_KEY_RIGHT_BRKT     48   // Keyboard ] and }
 #define HID_KEY_BACK_SLASH     49   // Keyboard \ and |
+#define HID_KEY_NON_US_HASH    50   // Keyboard Non-US # and ~
 #define HID_KEY_SEMI_COLON     51   // Keyboard ; and :
 #define HID_KEY_SGL_QUOTE      52   // Keyboard ' and "
 #define HID_KEY_GRV_ACCENT     53   // Keyboard Grave Accent and Tilde
@@ -119,6 +120,7 @@
 #define HID_KEYPAD_9           97   // Keypad 9 and PageUp
 #define HID_KEYPAD_0           98   // Keypad 0 and Insert
 #define HID_KEYPAD_DOT         99   // Keypad . and Delete
+#define HID_KEY_NON_US_BSLASH  100  // Keyboard Non-US \ and |
 #define HID_KEY_MUTE           127  // Keyboard Mute
 #define HID_KEY_VOLUME_UP      128  // Keyboard Volume up
 #define HID_KEY_VOLUME_DOWN    129  // Keyboard Volume down
@@ -177,6 +179,20 @@ typedef uint8_t mouse_cmd_t;
 #define HID_CONSUMER_BASS           227 // Bass
 #define HID_CONSUMER_VOLUME_UP      233 // Volume Increment
 #define HID_CONSUMER_VOLUME_DOWN    234 // Volume Decrement
-typedef uint8_t consumer_cmd_t;
+
+#define HID_CONSUMER_AL_CONFIG      0x183 // AL Consumer Control Configuration (media player)
+#define HID_CONSUMER_AL_EMAIL       0x18A // AL Email Reader
+#define HID_CONSUMER_AL_CALCULATOR  0x192 // AL Calculator
+#define HID_CONSUMER_AL_BROWSER     0x194 // AL Local Machine Browser
+#define HID_CONSUMER_AC_SEARCH      0x221 // AC Search
+#define HID_CONSUMER_AC_HOME        0x223 // AC Home
+#define HID_CONSUMER_AC_BACK        0x224 // AC Back
+#define HID_CONSUMER_AC_FORWARD     0x225 // AC Forward
+#define HID_CONSUMER_AC_STOP        0x226 // AC Stop
+#define HID_CONSUMER_AC_REFRESH     0x227 // AC Refresh
+#define HID_CONSUMER_AC_BOOKMARKS   0x22A // AC Bookmarks
+
+// any defined Consumer page usage can be sent, from 1 to HID_CC_USAGE_MAX of hid_reports.h
+typedef uint16_t consumer_cmd_t;
 
 #endif
@@ -1,34 +1,69 @@
+#include <stdatomic.h>
+
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
 
 #include "gatt_svr.h"
 #include "gpio_func.h"
+#include "hid_func.h"
+#include "hid_tx.h"
+#include "conn_params.h"
+#include "hid_perf.h"
+#include "hid_latency.h"
+#include "flight_rec.h"
+#include "dlog.h"
 
 static const char *tag = "NimBLEKBD_HIDFUNC";
 
-/*
-10 ms is enough time for writing operation, and
-a very large amount of time im terms of ble operations*/
-#define HID_DEV_BUF_MUTEX_WAIT 10
 #define BATTERY_DEFAULT_LEVEL 77
 
+/* the biggest report buffer, used for report snapshots on stack */
+#define HID_REPORT_MAX_SIZE HIDD_LE_REPORT_NKRO_SIZE
+
+/* ATT notification header: opcode and attribute handle */
+#define ATT_NOTIFY_HEADER_LEN 3
+
+/* delivery policy of input reports */
+#if defined(CONFIG_HID_DELIVERY_INDICATE)
+#define HID_INPUT_DELIVERY HID_DELIVERY_INDICATE
+#elif defined(CONFIG_HID_DELIVERY_ADAPTIVE)
+#define HID_INPUT_DELIVERY HID_DELIVERY_ADAPTIVE
+#else
+#define HID_INPUT_DELIVERY HID_DELIVERY_NOTIFY
+#endif
+
+static bool mouse_motion_fill(uint8_t *pending);
+static bool boot_mouse_motion_fill(uint8_t *pending);
+static bool mouse_motion_refund(const uint8_t *pending);
+static bool boot_mouse_motion_refund(const uint8_t *pending);
+
 /* notify data buffers */
 static uint8_t
     /* mouse: byte 0: bit 0 Button 1, bit 1 Button 2, bit 2 Button 3, bits 4 to 7 zero
-    byte 1 : X displacement, byte 2: Y displacement, byte 3: wheel    */
+    bytes 1-2: X displacement, 3-4: Y displacement, 5-6: wheel, 7-8: pan, 16-bit little endian
+    displacements are always zero here, they are taken from Mouse_motion at flush */
     Mouse_buffer[HIDD_LE_REPORT_MOUSE_SIZE],
+    /* boot protocol mouse: byte 0: buttons as in mouse report, byte 1: X displacement,
+    byte 2: Y displacement, taken from Boot_mouse_motion at flush */
+    Boot_mouse_buffer[HIDD_LE_REPORT_BOOT_MOUSE_SIZE],
+    /* mouse feature: bits 0-1 wheel resolution multiplier, bits 2-3 pan resolution multiplier,
+    1 is HID_MOUSE_RES_MULTIPLIER steps per notch, 0 is one step per notch;
+    every central has its own value in struct hid_conn, this one stays zero */
+    Mouse_feature_buffer[HIDD_LE_REPORT_MOUSE_FEATURE_SIZE],
     /* keyboard
     byte 0: modifiers: bit 0 LEFT CTRL, 1 LEFT SHIFT, 2 LEFT ALT, 3 LEFT GUI
                            4 RIGHT CTRL, 5 RIGHT SHIFT, 6 RIGHT ALT, 7 RIGHT GUI
     byte 1: reserved (zeroes),
     bytes 2 to 7: keyboard scan codes from 4 to 221     */
     Keyboard_buffer[HIDD_LE_REPORT_KB_IN_SIZE],
-    /* consumer control buffer
-    byte 0: bits 0-3 num key pad, 4-5 - channel (+1 -1), 6 - volume up, 7 - volume down
-    byte 1: 0-3 - buttons, 4-5 - selection buttons, 6-7 - zero    */
+    /* N-key rollover keyboard: bit N of the bitmap is set while key with usage N is pressed,
+    modifiers are usages 0xE0 to 0xE7 (byte 28)  */
+    Nkro_buffer[HIDD_LE_REPORT_NKRO_SIZE],
+    /* consumer control buffer: HID_CC_USAGES slots of pressed usages, 16-bit little endian,
+    pressed usages are at the start, empty slots are zero */
     CC_buffer[HIDD_LE_REPORT_CC_SIZE],
     /* Keyboard out report keeps data for leds in one byte
     LEDS: bit 0 NUM LOCK, 1 CAPS LOCK, 2 SCROLL LOCK, 3 COMPOSE, 4 KANA, 5 to 7 RESERVED (zeroes) */
@@ -36,7 +71,16 @@ static uint8_t
     /* battery level */
     Battery_level[] = { BATTERY_DEFAULT_LEVEL, },
     /* Feature data - custom data for this device */
-    Feature_buffer[] = "olegos";
+    Feature_buffer[HIDD_LE_REPORT_FEATURE_SIZE] = "olegos";
+
+/* index in Notify_data_reports: reports of hid_reports.h, then the ones outside of report map */
+#define REPORT_IDX_ENTRY(report, coll, type) REPORT_IDX_##report,
+enum hid_report_idx {
+    HID_REPORTS(REPORT_IDX_ENTRY)
+    REPORT_IDX_BATTERY,
+    REPORT_IDX_BOOT_MOUSE,
+    REPORTS_COUNT
+};
 
 static struct hid_notify_data {
     const char *name;
@@ -44,191 +88,582 @@ static struct hid_notify_data {
     int handle_boot_num;   // handle num in boot mode
     uint8_t *buffer;            // data to send
     size_t buffer_size;
-    bool can_indicate;          // preffered method, because central will response to it
-    bool can_notify;
-} Notify_data_reports[] =
+    atomic_uint seq;            // seqlock counter, it is odd while buffer is being changed
+    enum hid_delivery delivery; // used when central has subscribed to both notify and indicate
+    /* coalescer state, protected by Hid_report_mux */
+    bool dirty;                 // changed since last flush
+    bool ordered_pending;       // pending change must reach central before next ordered one
+    uint32_t touched[8];        // bitmap of keys changed since last flush
+    // puts accumulated deltas to data being flushed, returns true if some are left
+    bool (*fill)(uint8_t *pending);
+    // gives deltas of data which could not be queued back, returns true if there were some
+    bool (*refund)(const uint8_t *pending);
+} Notify_data_reports[REPORTS_COUNT] =
 {
-    {   .name = "mouse",
+    // boot protocol mouse has other format, so it is a report of its own
+    [REPORT_IDX_MOUSE] = {
+        .name = "mouse",
         .handle_num = HANDLE_HID_MOUSE_REPORT,
-        .handle_boot_num = HANDLE_HID_BOOT_MOUSE_REPORT,
+        .handle_boot_num = HANDLE_HID_MOUSE_REPORT,
         .buffer = Mouse_buffer,
         .buffer_size = HIDD_LE_REPORT_MOUSE_SIZE,
-        .can_indicate = false, .can_notify= false
+        .delivery = HID_INPUT_DELIVERY,
+        .fill = mouse_motion_fill,
+        .refund = mouse_motion_refund
     },
-    {   .name = "keyboard",
+    [REPORT_IDX_KB_IN] = {
+        .name = "keyboard",
         .handle_num = HANDLE_HID_KB_IN_REPORT,
         .handle_boot_num = HANDLE_HID_BOOT_KB_IN_REPORT,
         .buffer = Keyboard_buffer,
         .buffer_size = HIDD_LE_REPORT_KB_IN_SIZE,
-        .can_indicate = false, .can_notify= false
+        .delivery = HID_INPUT_DELIVERY
     },
-    {   .name = "leds",
+    [REPORT_IDX_KB_OUT] = {
+        .name = "leds",
         .handle_num = HANDLE_HID_KB_OUT_REPORT,
         .handle_boot_num = HANDLE_HID_BOOT_KB_OUT_REPORT,
         .buffer = Leds_buffer,
         .buffer_size = HIDD_LE_REPORT_KB_OUT_SIZE,
-        .can_indicate = false, .can_notify= false
+        .delivery = HID_INPUT_DELIVERY
     },
-    {   .name = "consumer control",
+    [REPORT_IDX_CC] = {
+        .name = "consumer control",
         .handle_num = HANDLE_HID_CC_REPORT,
         .handle_boot_num = HANDLE_HID_CC_REPORT,
         .buffer = CC_buffer,
         .buffer_size = HIDD_LE_REPORT_CC_SIZE,
-        .can_indicate = false, .can_notify= false
+        .delivery = HID_INPUT_DELIVERY
+    },
+    [REPORT_IDX_FEATURE] = {
+        .name = "feature",
+        .handle_num = HANDLE_HID_FEATURE_REPORT,
+        .handle_boot_num = HANDLE_HID_FEATURE_REPORT,
+        .buffer = Feature_buffer,
+        .buffer_size = HIDD_LE_REPORT_FEATURE_SIZE,
+        .delivery = HID_DELIVERY_INDICATE
+    },
+    [REPORT_IDX_NKRO] = {
+        .name = "nkro keyboard",
+        .handle_num = HANDLE_HID_NKRO_REPORT,
+        .handle_boot_num = HANDLE_HID_NKRO_REPORT,
+        .buffer = Nkro_buffer,
+        .buffer_size = HIDD_LE_REPORT_NKRO_SIZE,
+        .delivery = HID_INPUT_DELIVERY
     },
-    {   .name = "battery level",
+    [REPORT_IDX_MOUSE_FEATURE] = {
+        .name = "mouse feature",
+        .handle_num = HANDLE_HID_MOUSE_FEATURE_REPORT,
+        .handle_boot_num = HANDLE_HID_MOUSE_FEATURE_REPORT,
+        .buffer = Mouse_feature_buffer,
+        .buffer_size = HIDD_LE_REPORT_MOUSE_FEATURE_SIZE,
+        .delivery = HID_DELIVERY_INDICATE
+    },
+    [REPORT_IDX_BATTERY] = {
+        .name = "battery level",
         .handle_num = HANDLE_BATTERY_LEVEL,
         .handle_boot_num = HANDLE_BATTERY_LEVEL,
         .buffer = Battery_level,
         .buffer_size = HIDD_LE_BATTERY_LEVEL_SIZE,
-        .can_indicate = false, .can_notify= false
-    },
-    {   .name = "feature",
-        .handle_num = HANDLE_HID_FEATURE_REPORT,
-        .handle_boot_num = HANDLE_HID_FEATURE_REPORT,
-        .buffer = Feature_buffer,
-        .buffer_size = HIDD_LE_REPORT_FEATURE,
-        .can_indicate = false, .can_notify= false
+        .delivery = HID_DELIVERY_INDICATE
     },
+    [REPORT_IDX_BOOT_MOUSE] = {
+        .name = "boot mouse",
+        .handle_num = HANDLE_HID_BOOT_MOUSE_REPORT,
+        .handle_boot_num = HANDLE_HID_BOOT_MOUSE_REPORT,
+        .buffer = Boot_mouse_buffer,
+        .buffer_size = HIDD_LE_REPORT_BOOT_MOUSE_SIZE,
+        .delivery = HID_INPUT_DELIVERY,
+        .fill = boot_mouse_motion_fill,
+        .refund = boot_mouse_motion_refund
+    }
+};
+
+#define REPORT_SIZE_FITS(report, coll, type) \
+    _Static_assert(HIDD_LE_REPORT_##report##_SIZE <= HID_REPORT_MAX_SIZE, "HID_REPORT_MAX_SIZE is too small");
+HID_REPORTS(REPORT_SIZE_FITS)
+_Static_assert(HIDD_LE_REPORT_BOOT_MOUSE_SIZE <= HID_REPORT_MAX_SIZE &&
+               HIDD_LE_BATTERY_LEVEL_SIZE <= HID_REPORT_MAX_SIZE,
+               "HID_REPORT_MAX_SIZE is too small");
+// keyboard and LEDs buffers are shared with boot protocol reports of fixed size
+_Static_assert(HIDD_LE_REPORT_KB_IN_SIZE == 8 && HIDD_LE_REPORT_KB_OUT_SIZE == 1,
+               "keyboard report must have boot protocol layout");
+_Static_assert(HIDD_LE_REPORT_MOUSE_SIZE == 9 && HIDD_LE_REPORT_CC_SIZE % 2 == 0 &&
+               HIDD_LE_REPORT_MOUSE_FEATURE_SIZE == 1 && HIDD_LE_REPORT_NKRO_SIZE * 8 == HIDD_LE_REPORT_NKRO_KEYS,
+               "report layout in hid_reports.h does not match report buffers");
+_Static_assert(HID_REPORT_MAX_SIZE <= HID_TX_DATA_MAX, "HID_TX_DATA_MAX is too small");
+_Static_assert(REPORTS_COUNT <= 32, "TX resync mask has one bit per report");
+
+/*
+Writers of report buffers are serialized with this spinlock. Critical section
+is held only for a few byte changes, readers never take it: they use seqlock
+counter of the report to get consistent copy of the buffer.
+*/
+static portMUX_TYPE Hid_report_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+Dispatch tables, values are report index + 1, zero means that handle is not a
+report. Every hot path lookup is one array index. ATT handles are known only when
+services are registered, so Attr_reports is filled by gatt_svr_register_cb.
+*/
+static struct hid_attr_report {
+    uint8_t report;     // index in Notify_data_reports + 1
+    bool is_boot;       // attribute is boot protocol variant of the report
+} Attr_reports[GATT_SVR_MAX_ATT_HANDLES];       // indexed by ATT handle
+
+#define REPORT_HANDLE_NUM_ENTRY(report, coll, type) [HANDLE_HID_##report##_REPORT] = REPORT_IDX_##report + 1,
+static const uint8_t Handle_num_reports[HANDLE_HID_COUNT] = {     // indexed by enum attr_handles
+    HID_REPORTS(REPORT_HANDLE_NUM_ENTRY)
+    [HANDLE_BATTERY_LEVEL] = REPORT_IDX_BATTERY + 1,
+    [HANDLE_HID_BOOT_KB_IN_REPORT] = REPORT_IDX_KB_IN + 1,
+    [HANDLE_HID_BOOT_KB_OUT_REPORT] = REPORT_IDX_KB_OUT + 1,
+    [HANDLE_HID_BOOT_MOUSE_REPORT] = REPORT_IDX_BOOT_MOUSE + 1,
+};
+
+#ifdef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define HID_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#else
+#define HID_MAX_CONNECTIONS 1
+#endif
+
+/* central subscription to report */
+struct hid_subscription {
+    bool can_indicate;
+    bool can_notify;
 };
 
-static struct hid_device_data {
-    /* Mutex semaphore for access to this struct */
-    SemaphoreHandle_t semaphore;
+/* state of each connected central, report buffers are shared by all of them */
+static struct hid_conn {
+    bool connected;
     bool suspended_state;
     bool report_mode_boot;
-    bool connected;
     uint16_t conn_handle;
-} My_hid_dev = {
-    .semaphore = 0,
-    .connected = false,
-    .suspended_state = false,
-    .report_mode_boot = false,
+    uint16_t conn_itvl;
+    // ATT allows one indication in flight: set by TX task, cleared by BLE host on confirmation
+    volatile bool indication_pending;
+    // resolution multiplier feature report of this central and wheel and pan steps
+    // which do not make a whole notch for it yet, protected by Hid_report_mux
+    uint8_t mouse_feature;
+    int32_t wheel_rest;
+    int32_t pan_rest;
+    struct hid_subscription subs[REPORTS_COUNT];    // indexed as Notify_data_reports
+} Hid_conns[HID_MAX_CONNECTIONS];
+
+/*
+Report coalescer. Changes made inside one connection interval are collected and
+every dirty report is sent once, because the central can not receive more than
+one notification of a report per connection event anyway, extra ones just fill
+controller buffers. First change after quiet interval is sent at once, so single
+keystroke gets no extra latency. Collapsing must not lose a keystroke: second
+change of the same key (release after press) or two ordered changes (presses in
+bitmap report) flush pending state of the report first. Relative mouse motion
+is summed between flushes instead, see Mouse_motion.
+*/
+#define COALESCE_ANY_KEY (-1)
+
+/* flush period when coalescing is off, but motion is left: the shortest BLE connection interval */
+#define COALESCE_CARRY_US 7500
+
+static struct hid_coalesce {
+    esp_timer_handle_t timer;
+    bool timer_armed;           // protected by Hid_report_mux
+    int64_t last_flush_us;
+    uint32_t interval_us;       // minimal time between flushes, 0 - no coalescing
+    hid_flush_cb_t flush_cb;    // called after every flush, paces generated input
+    int64_t last_input_us;      // time of the last input report change
+    // statistics, notifications saved = changes - notifications
+    uint32_t changes;
+    uint32_t notifications;
+} Coalesce;
+
+static void coalesce_timer_cb(void *arg);
+static void coalesce_carry(void);
+static void coalesce_refund(struct hid_notify_data *report, const uint8_t *pending);
+static void mouse_conn_scale(struct hid_conn *conn, uint8_t *dst, const uint8_t *src);
+static void mouse_conn_unscale(struct hid_conn *conn, const uint8_t *dst, const uint8_t *src);
+
+/*
+Mouse motion accumulators, one for each mouse report. Deltas are summed between
+flushes, every flush sends as much as the report can carry and the rest goes with
+the next flush, so a fast source gives one report per connection interval and
+nothing is clipped. Deltas of a flush which finds TX queue full are given back.
+Wheel and pan are kept in 1/HID_MOUSE_RES_MULTIPLIER notch steps, they are
+scaled to the resolution multiplier of every central when its entry is built.
+Protected by Hid_report_mux.
+*/
+#define MOUSE_DELTA_MAX 32767
+#define BOOT_MOUSE_DELTA_MAX 127
+
+static struct mouse_motion {
+    int32_t x;
+    int32_t y;
+    int32_t wheel;
+    int32_t pan;
+} Mouse_motion, Boot_mouse_motion;
+
+/*
+Delivery statistics for each method: reports and time between them while they
+go in bursts, so reports per second show the rate achieved under load.
+*/
+#define DELIVERY_BURST_GAP_US 1000000
+
+static struct hid_delivery_stats {
+    const char *name;
+    uint32_t reports;
+    uint32_t busy_us;
+    int64_t last_us;
+} Delivery_stats[] = {
+    { .name = "notify" },
+    { .name = "indicate" },
 };
 
-/* mark report for indicate/notify when central subscribes to service charachetric with report */
-void
-hid_set_notify(uint16_t attr_handle, uint8_t cur_notify, uint8_t cur_indicate)
+static bool Tx_started = false;
+static int tx_send(const struct hid_tx_entry *entry);
+static void tx_resync(int report_idx);
+
+/* report record for handle index from enum attr_handles, NULL if it is not a report */
+static struct hid_notify_data *
+report_by_num(int handle_num)
 {
-    int report_idx = -1;
+    if (handle_num < 0 || handle_num >= HANDLE_HID_COUNT || !Handle_num_reports[handle_num]) {
+        return NULL;
+    }
+    return &Notify_data_reports[Handle_num_reports[handle_num] - 1];
+}
 
-    /* find hid_notify_data struct index of reports array for given atribute handle */
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        uint16_t current_handle_idx = My_hid_dev.report_mode_boot ?
-            Notify_data_reports[i].handle_boot_num :
-            Notify_data_reports[i].handle_num;
-        if (attr_handle == Svc_char_handles[current_handle_idx]) {
-            report_idx = i;
-            break;
+/* state of connected central, NULL if there is no such connection */
+static struct hid_conn *
+conn_find(uint16_t conn_handle)
+{
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        if (Hid_conns[i].connected && Hid_conns[i].conn_handle == conn_handle) {
+            return &Hid_conns[i];
         }
     }
-    if (report_idx == -1) {
-        ESP_LOGW(tag, "%s: attr_handle %04X not found in reports", __FUNCTION__, attr_handle);
-    } else {
-        Notify_data_reports[report_idx].can_indicate = cur_indicate;
-        Notify_data_reports[report_idx].can_notify = cur_notify;
+    return NULL;
+}
 
-        ESP_LOGI(tag, "%s: service %s, attr_handle %d, notify %d, indicate %d",
-                    __FUNCTION__, Notify_data_reports[report_idx].name, attr_handle, cur_notify, cur_indicate);
+/* central is connected and can get input reports */
+static inline bool
+conn_active(const struct hid_conn *conn)
+{
+    return conn->connected && !conn->suspended_state;
+}
+
+static bool
+hid_any_active(void)
+{
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        if (conn_active(&Hid_conns[i])) {
+            return true;
+        }
     }
+    return false;
 }
 
-/* lock report buffers with mutex semaphore */
-static int
-lock_hid_data()
+/* called from gatt_svr_register_cb for each report characteristic */
+void
+hid_register_report_attr(uint16_t attr_handle, int handle_num)
 {
-    if (!My_hid_dev.semaphore) {
-        ESP_LOGW(tag, "%s semaphore is NULL", __FUNCTION__);
-        return 1;
+    struct hid_notify_data *report = report_by_num(handle_num);
+
+    if (!report) {
+        ESP_LOGW(tag, "%s: handle_num %d is not a report", __FUNCTION__, handle_num);
+        return;
     }
-    if (xSemaphoreTake( My_hid_dev.semaphore, pdMS_TO_TICKS(HID_DEV_BUF_MUTEX_WAIT) ) == pdTRUE) {
-        return 0;
-    } else {
-        ESP_LOGW(tag, "%s: can't lock", __FUNCTION__);
+    if (attr_handle >= GATT_SVR_MAX_ATT_HANDLES) {
+        ESP_LOGE(tag, "%s: attr_handle %d is too big, increase GATT_SVR_MAX_ATT_HANDLES",
+            __FUNCTION__, attr_handle);
+        return;
     }
 
-    return 2;
+    Attr_reports[attr_handle].report = report - Notify_data_reports + 1;
+    Attr_reports[attr_handle].is_boot = report->handle_num != handle_num;
+}
+
+/* change delivery policy of the report at runtime */
+int
+hid_set_delivery(int handle_num, enum hid_delivery delivery)
+{
+    struct hid_notify_data *report = report_by_num(handle_num);
 
+    if (!report) {
+        return 2;
+    }
+    report->delivery = delivery;
+    return 0;
 }
 
-/* unlock report buffers locked with mutex semaphore */
-static int
-unlock_hid_data()
+/* mark report for indicate/notify when central subscribes to service charachetric with report */
+void
+hid_set_notify(uint16_t conn_handle, uint16_t attr_handle, uint8_t cur_notify, uint8_t cur_indicate)
 {
-    if (!My_hid_dev.semaphore) {
-        ESP_LOGW(tag, "%s semaphore is NULL", __FUNCTION__);
-        return 1;
+    struct hid_conn *conn = conn_find(conn_handle);
+    struct hid_notify_data *report = NULL;
+
+    if (conn && attr_handle < GATT_SVR_MAX_ATT_HANDLES && Attr_reports[attr_handle].report) {
+        report = &Notify_data_reports[Attr_reports[attr_handle].report - 1];
+
+        // subscription to the other protocol mode variant of the report is ignored
+        if (report->handle_num != report->handle_boot_num &&
+            Attr_reports[attr_handle].is_boot != conn->report_mode_boot) {
+            report = NULL;
+        }
     }
-    if (xSemaphoreGive( My_hid_dev.semaphore ) == pdTRUE) {
-        return 0;
+
+    if (!report) {
+        ESP_LOGW(tag, "%s: attr_handle %04X not found in reports", __FUNCTION__, attr_handle);
+    } else {
+        struct hid_subscription *sub = &conn->subs[report - Notify_data_reports];
+
+        sub->can_indicate = cur_indicate;
+        sub->can_notify = cur_notify;
+
+        flight_rec(FLIGHT_EV_SUBSCRIBE, (report - Notify_data_reports) |
+            (cur_notify ? 0x40 : 0) | (cur_indicate ? 0x80 : 0), conn_handle);
+
+        DLOG(DLOG_SET_NOTIFY, conn_handle, report->handle_num, attr_handle, cur_notify, cur_indicate);
     }
-    return 2;
+}
+
+/* start changing report buffer, must be short and must not block or log */
+static void
+report_write_begin(struct hid_notify_data *report)
+{
+    portENTER_CRITICAL(&Hid_report_mux);
+    atomic_fetch_add_explicit(&report->seq, 1, memory_order_relaxed);
+    // buffer changes must not become visible before odd counter
+    atomic_thread_fence(memory_order_release);
+}
 
+/* finish changing report buffer */
+static void
+report_write_end(struct hid_notify_data *report)
+{
+    atomic_fetch_add_explicit(&report->seq, 1, memory_order_release);
+    portEXIT_CRITICAL(&Hid_report_mux);
+}
+
+/* copy consistent snapshot of report buffer to dst, never waits for a lock */
+static void
+report_snapshot(struct hid_notify_data *report, uint8_t *dst)
+{
+    unsigned seq_begin, seq_end;
+    int retries = -1;
+
+    do {
+        retries++;
+        seq_begin = atomic_load_explicit(&report->seq, memory_order_acquire);
+        for (size_t i = 0; i < report->buffer_size; ++i) {
+            dst[i] = ((volatile uint8_t *)report->buffer)[i];
+        }
+        atomic_thread_fence(memory_order_acquire);
+        seq_end = atomic_load_explicit(&report->seq, memory_order_relaxed);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+
+    if (retries) {
+        flight_rec(FLIGHT_EV_SNAPSHOT_RETRY, report - Notify_data_reports, retries);
+    }
 }
 
-/* zero all fields on new connection */
+/* conn_itvl in 1.25 ms units, as in ble_gap_conn_desc */
 void
-hid_clean_vars(struct ble_gap_conn_desc *desc)
+hid_set_conn_interval(uint16_t conn_handle, uint16_t conn_itvl)
 {
-    // save semaphore for new connection use
-    SemaphoreHandle_t semaphore_saved = My_hid_dev.semaphore;
-    int rc = -1;
+    struct hid_conn *conn = conn_find(conn_handle);
+    uint32_t interval_us = CONFIG_HID_COALESCE_MAX_US;
 
-    if (semaphore_saved) {
-        rc = lock_hid_data();
+    if (conn) {
+        conn->conn_itvl = conn_itvl;
     }
 
-    memset(&My_hid_dev, 0, sizeof(struct hid_device_data));
+    // the fastest central is not slowed down by the others
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        if (Hid_conns[i].connected && Hid_conns[i].conn_itvl * 1250 < interval_us) {
+            interval_us = Hid_conns[i].conn_itvl * 1250;
+        }
+    }
+    Coalesce.interval_us = interval_us;
+}
+
+/* zero all fields of the first connection */
+static void
+hid_first_connection(void)
+{
+    if (!Coalesce.timer) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = coalesce_timer_cb,
+            .name = "hid_coalesce"
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &Coalesce.timer));
+    }
+    if (!Tx_started) {
+        hid_tx_init(tx_send, tx_resync);
+        Tx_started = true;
+    }
+    hid_tx_reset();
+
+    esp_timer_stop(Coalesce.timer);
+    Coalesce.timer_armed = false;
+    Coalesce.last_flush_us = 0;
+    Coalesce.changes = 0;
+    Coalesce.notifications = 0;
+    for (size_t i = 0; i < sizeof(Delivery_stats)/sizeof(Delivery_stats[0]); ++i) {
+        Delivery_stats[i].reports = 0;
+        Delivery_stats[i].busy_us = 0;
+    }
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        Notify_data_reports[i].can_indicate = false;
-        Notify_data_reports[i].can_notify = false;
+    portENTER_CRITICAL(&Hid_report_mux);
+    memset(&Mouse_motion, 0, sizeof(Mouse_motion));
+    memset(&Boot_mouse_motion, 0, sizeof(Boot_mouse_motion));
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    for (int i = 0; i < REPORTS_COUNT; ++i) {
+        Notify_data_reports[i].dirty = false;
+        Notify_data_reports[i].ordered_pending = false;
+        memset(Notify_data_reports[i].touched, 0, sizeof(Notify_data_reports[i].touched));
         switch (Notify_data_reports[i].handle_num) {
             case HANDLE_HID_MOUSE_REPORT:
+            case HANDLE_HID_BOOT_MOUSE_REPORT:
+            case HANDLE_HID_MOUSE_FEATURE_REPORT:
             case HANDLE_HID_KB_IN_REPORT:
+            case HANDLE_HID_NKRO_REPORT:
             case HANDLE_HID_KB_OUT_REPORT:
             case HANDLE_HID_CC_REPORT:
+                report_write_begin(&Notify_data_reports[i]);
                 memset(Notify_data_reports[i].buffer, 0, Notify_data_reports[i].buffer_size);
+                report_write_end(&Notify_data_reports[i]);
         }
     }
+}
 
-    if (semaphore_saved) {
-        My_hid_dev.semaphore = semaphore_saved;
-    } else {
-        My_hid_dev.semaphore = xSemaphoreCreateMutex();
-        assert(My_hid_dev.semaphore != NULL);
+/* new connection, other centrals keep their state */
+void
+hid_clean_vars(struct ble_gap_conn_desc *desc)
+{
+    struct hid_conn *conn = NULL;
+    bool first = true;
+
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        if (Hid_conns[i].connected) {
+            first = false;
+        } else if (!conn) {
+            conn = &Hid_conns[i];
+        }
+    }
+    if (!conn) {
+        ESP_LOGE(tag, "%s: no room for conn_handle %d", __FUNCTION__, desc->conn_handle);
+        return;
     }
 
-    My_hid_dev.conn_handle = desc->conn_handle;
-    My_hid_dev.connected = true;
+    if (first) {
+        hid_first_connection();
+    }
+
+    memset(conn, 0, sizeof(struct hid_conn));
+    conn->conn_handle = desc->conn_handle;
+    conn->connected = true;
+
+    hid_set_conn_interval(desc->conn_handle, desc->conn_itvl);
+}
 
-    if (!rc) {
-        unlock_hid_data();
+/* BLE_GAP_EVENT_NOTIFY_TX: NimBLE raises it inside ble_gattc_notify_custom() and
+   ble_gattc_indicate_custom() for every send, failed ones included, and later for
+   confirmation (BLE_HS_EDONE) or timeout of indication */
+void
+hid_notify_tx(uint16_t conn_handle, uint16_t attr_handle, bool indication, int status)
+{
+    if (status == 0) {
+        // traced report is on the air, failed send keeps the trace for retry
+        hid_latency_notify_tx(conn_handle, attr_handle);
     }
+    if (indication && status != 0) {
+        // indication has been confirmed or has failed, the next one can be sent
+        struct hid_conn *conn = conn_find(conn_handle);
+
+        if (conn) {
+            conn->indication_pending = false;
+        }
+    }
+    // gives TX credit back
+    hid_tx_completed(indication, status);
+}
+
+/* number of connected centrals */
+int
+hid_conn_count(void)
+{
+    int count = 0;
+
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        count += Hid_conns[i].connected;
+    }
+    return count;
 }
 
 void
-hid_set_disconnected()
+hid_set_disconnected(uint16_t conn_handle)
 {
-    My_hid_dev.connected = false;
+    struct hid_conn *conn = conn_find(conn_handle);
+
+    if (conn) {
+        conn->connected = false;
+        if (conn->indication_pending) {
+            // entry held for confirmation is dropped now
+            conn->indication_pending = false;
+            hid_tx_wake();
+        }
+    }
+    if (hid_conn_count()) {
+        return;
+    }
+
+    ESP_LOGI(tag, "coalescer: %u report changes, %u notifications, %u saved",
+        Coalesce.changes, Coalesce.notifications, Coalesce.changes - Coalesce.notifications);
+    hid_tx_log_stats();
+    for (size_t i = 0; i < sizeof(Delivery_stats)/sizeof(Delivery_stats[0]); ++i) {
+        struct hid_delivery_stats *stats = &Delivery_stats[i];
+
+        ESP_LOGI(tag, "%s: %u reports, %u reports/s in bursts", stats->name, stats->reports,
+            stats->busy_us ? (uint32_t)((uint64_t)stats->reports * 1000000 / stats->busy_us) : 0);
+    }
+    hid_latency_dump();
 }
 
 bool
-hid_set_suspend(bool need_suspend)
+hid_set_suspend(uint16_t conn_handle, bool need_suspend)
 {
-    bool last_state = My_hid_dev.suspended_state;
-    My_hid_dev.suspended_state = need_suspend;
+    struct hid_conn *conn = conn_find(conn_handle);
+    bool last_state = false;
+
+    if (conn) {
+        last_state = conn->suspended_state;
+        conn->suspended_state = need_suspend;
+    }
     return last_state;
 }
 
 bool
-hid_set_report_mode(bool is_mode_boot)
+hid_set_report_mode(uint16_t conn_handle, bool is_mode_boot)
 {
-    bool old_boot = My_hid_dev.report_mode_boot;
-    My_hid_dev.report_mode_boot = is_mode_boot;
+    struct hid_conn *conn = conn_find(conn_handle);
+    bool old_boot = false;
+
+    if (conn) {
+        old_boot = conn->report_mode_boot;
+        conn->report_mode_boot = is_mode_boot;
+    }
     return old_boot;
 }
 
+bool
+hid_get_report_mode(uint16_t conn_handle)
+{
+    struct hid_conn *conn = conn_find(conn_handle);
+
+    return conn ? conn->report_mode_boot : false;
+}
+
 char outbuf[100];
 
 char * print_buf(uint8_t *buf, int buf_size)
@@ -241,155 +676,539 @@ char * print_buf(uint8_t *buf, int buf_size)
 }
 
 int
-hid_read_buffer(struct os_mbuf *buf, int handle_num)
+hid_read_buffer(uint16_t conn_handle, struct os_mbuf *buf, int handle_num)
 {
-    int rc = 0;
-    int rep_idx = -1;
+    HID_PERF_SCOPE(HID_PERF_READ_BUFFER);
+    uint8_t snapshot[HID_REPORT_MAX_SIZE];
+    struct hid_notify_data *report = report_by_num(handle_num);
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        if (Notify_data_reports[i].handle_num == handle_num ||
-            Notify_data_reports[i].handle_boot_num == handle_num) {
-            rep_idx = i;
-            break;
-        }
+    if (!report) {
+        ESP_LOGW(tag, "%s: handle_num %d not found", __FUNCTION__, handle_num);
+        return 2;
     }
 
-    if (rep_idx != -1 && lock_hid_data() == 0) {
-        rc = os_mbuf_append(buf,
-            Notify_data_reports[rep_idx].buffer,
-            Notify_data_reports[rep_idx].buffer_size);
-        unlock_hid_data();
+    report_snapshot(report, snapshot);
+    if (handle_num == HANDLE_HID_MOUSE_FEATURE_REPORT) {
+        struct hid_conn *conn = conn_find(conn_handle);
 
-        // ESP_LOGI("", "%s read data: %s", __FUNCTION__,
-        //     print_buf(Notify_data_reports[rep_idx].buffer,
-        //         Notify_data_reports[rep_idx].buffer_size));
-    } else {
-        if (rep_idx == -1) ESP_LOGW(tag, "%s: handle_num %d not found", __FUNCTION__, handle_num);
-        return 2;
+        snapshot[0] = conn ? conn->mouse_feature : 0;
     }
 
-    return rc;
+    // ESP_LOGI("", "%s read data: %s", __FUNCTION__,
+    //     print_buf(snapshot, report->buffer_size));
+
+    return os_mbuf_append(buf, snapshot, report->buffer_size);
 }
 
 int
-hid_write_buffer(struct os_mbuf *buf, int handle_num)
+hid_write_buffer(uint16_t conn_handle, struct os_mbuf *buf, int handle_num)
 {
+    uint8_t new_data[HID_REPORT_MAX_SIZE];
     int rc = 0;
 
-    int rep_idx = -1;
+    struct hid_notify_data *report = report_by_num(handle_num);
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        if (Notify_data_reports[i].handle_num == handle_num ||
-            Notify_data_reports[i].handle_boot_num == handle_num) {
-            rep_idx = i;
-            break;
-        }
+    if (!report) {
+        return 2;
     }
-    if (rep_idx != -1 && lock_hid_data() == 0) {
-        if (OS_MBUF_PKTLEN(buf) == Notify_data_reports[rep_idx].buffer_size) {
-            rc = ble_hs_mbuf_to_flat(buf,
-                Notify_data_reports[rep_idx].buffer,
-                OS_MBUF_PKTLEN(buf),
-                NULL);
-        } else {
-            rc = 4;
+    if (OS_MBUF_PKTLEN(buf) != report->buffer_size) {
+        return 4;
+    }
+
+    // flatten data before taking the writers lock, mbuf functions may be slow
+    rc = ble_hs_mbuf_to_flat(buf, new_data, OS_MBUF_PKTLEN(buf), NULL);
+    if (rc == 0 && handle_num == HANDLE_HID_MOUSE_FEATURE_REPORT) {
+        // resolution multiplier is set by every central for itself
+        struct hid_conn *conn = conn_find(conn_handle);
+
+        if (conn) {
+            portENTER_CRITICAL(&Hid_report_mux);
+            conn->mouse_feature = new_data[0];
+            portEXIT_CRITICAL(&Hid_report_mux);
         }
-        unlock_hid_data();
-        if (rc == 0) {
-            if (handle_num == HANDLE_HID_KB_OUT_REPORT) {
-                // change LEDs level when Keyboard out report received
-                set_leds(Leds_buffer[0]);
-            }
+    } else if (rc == 0) {
+        report_write_begin(report);
+        memcpy(report->buffer, new_data, report->buffer_size);
+        report_write_end(report);
+
+        if (handle_num == HANDLE_HID_KB_OUT_REPORT) {
+            // change LEDs level when Keyboard out report received
+            set_leds(new_data[0]);
         }
-    } else {
-        return 2;
     }
 
     return rc;
 }
 
-/*  send report to central using different ways
-    0 - using ble_gattc_indicate_custom     using custom buffer
-    1 - using ble_gattc_indicate            to only one connection
-    2 - using ble_gatts_chr_updated         to all connected centrals
+/* choose indication or notification for report, central has subscribed to one of them at least */
+static bool
+delivery_indicate(const struct hid_notify_data *report, const struct hid_subscription *sub)
+{
+    if (!sub->can_notify) {
+        return true;
+    }
+    if (!sub->can_indicate) {
+        return false;
+    }
+
+    switch (report->delivery) {
+        case HID_DELIVERY_INDICATE:
+            return true;
+        case HID_DELIVERY_ADAPTIVE:
+            // confirmation round trip does not delay anything when TX is idle
+            return hid_tx_idle();
+        default:
+            return false;
+    }
+}
+
+static void
+delivery_account(bool indicate)
+{
+    struct hid_delivery_stats *stats = &Delivery_stats[indicate];
+    int64_t now = esp_timer_get_time();
+
+    if (stats->reports && now - stats->last_us < DELIVERY_BURST_GAP_US) {
+        stats->busy_us += now - stats->last_us;
+    }
+    stats->last_us = now;
+    stats->reports++;
+}
+
+/*
+N-key rollover report is used in report protocol mode when central has subscribed
+to it and it fits into ATT MTU, otherwise classic 6 keys report is sent
 */
-#define SEND_METHOD_CUSTOM  0
-#define SEND_METHOD_STD     1
-#define SEND_METHOD_ALL     2
+static bool
+nkro_report_active(const struct hid_conn *conn)
+{
+    struct hid_notify_data *nkro = report_by_num(HANDLE_HID_NKRO_REPORT);
 
-#define NOTIFY_METHOD SEND_METHOD_STD
+    if (conn->report_mode_boot) {
+        return false;
+    }
 
-/* send report data to central using notify/indicate */
-int
-hid_send_report(int report_handle_num)
+    const struct hid_subscription *sub = &conn->subs[nkro - Notify_data_reports];
+
+    if (!sub->can_notify && !sub->can_indicate) {
+        return false;
+    }
+    return ble_att_mtu(conn->conn_handle) >= nkro->buffer_size + ATT_NOTIFY_HEADER_LEN;
+}
+
+/* central has subscribed to the report and uses it */
+static bool
+conn_gets_report(const struct hid_conn *conn, int report_idx)
 {
-    /* check semaphore, connection and suspend state */
-    if ( !My_hid_dev.semaphore || !My_hid_dev.connected || My_hid_dev.suspended_state) {
-        ESP_LOGI(tag, "%s semaphore %p %d %d", __FUNCTION__,
-            My_hid_dev.semaphore, My_hid_dev.connected, My_hid_dev.suspended_state);
-        return 1;
+    const struct hid_subscription *sub = &conn->subs[report_idx];
+
+    if (!sub->can_notify && !sub->can_indicate) {
+        return false;
     }
 
-    int report_idx = -1;
+    // keyboard and mouse input goes with one of two reports
+    switch (Notify_data_reports[report_idx].handle_num) {
+        case HANDLE_HID_NKRO_REPORT:
+            return nkro_report_active(conn);
+        case HANDLE_HID_KB_IN_REPORT:
+            return !nkro_report_active(conn);
+        case HANDLE_HID_MOUSE_REPORT:
+            return !conn->report_mode_boot;
+        case HANDLE_HID_BOOT_MOUSE_REPORT:
+            return conn->report_mode_boot;
+        default:
+            return true;
+    }
+}
 
-    for (int i = 0; i < sizeof(Notify_data_reports)/sizeof(Notify_data_reports[0]); ++i) {
-        if (report_handle_num == Notify_data_reports[i].handle_num) {
-            report_idx = i;
-            break;
-        }
+/* TX task callback: send report data to central using notify/indicate */
+static int
+tx_send(const struct hid_tx_entry *entry)
+{
+    HID_PERF_SCOPE(HID_PERF_TX_SEND);
+    struct hid_notify_data *report = &Notify_data_reports[entry->report];
+    struct hid_conn *conn = conn_find(entry->conn_handle);
+
+    /* check connection and suspend state, entry may be left from closed connection */
+    if (!conn || conn->suspended_state) {
+        return HID_TX_DROP;
     }
 
-    if (report_idx == -1) {
-        ESP_LOGW(tag, "%s: Unknown report_handle_num %d", __FUNCTION__, report_handle_num);
-        return 2;
+    struct hid_subscription *sub = &conn->subs[entry->report];
+
+    if (!sub->can_indicate && !sub->can_notify) {
+        return HID_TX_DROP;
     }
 
     uint16_t send_handle;
-    int rc = 0;
+    bool indicate = delivery_indicate(report, sub);
+    int rc;
 
-    if (My_hid_dev.report_mode_boot) {
-        send_handle = Svc_char_handles[Notify_data_reports[report_idx].handle_boot_num];
+    if (indicate && conn->indication_pending) {
+        return HID_TX_WAIT;
+    }
+
+    if (conn->report_mode_boot) {
+        send_handle = Svc_char_handles[report->handle_boot_num];
     } else {
-        send_handle = Svc_char_handles[Notify_data_reports[report_idx].handle_num];
+        send_handle = Svc_char_handles[report->handle_num];
     }
 
-    switch (NOTIFY_METHOD) {
-        case SEND_METHOD_CUSTOM: {
-            if (lock_hid_data() == 0) {
-                struct os_mbuf *om = ble_hs_mbuf_from_flat(
-                    Notify_data_reports[report_idx].buffer,
-                    Notify_data_reports[report_idx].buffer_size);
-                unlock_hid_data();
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(entry->data, entry->len);
 
-                if (Notify_data_reports[report_idx].can_indicate) {
-                    rc = ble_gattc_indicate_custom(My_hid_dev.conn_handle, send_handle, om);
-                } else if (Notify_data_reports[report_idx].can_notify) {
-                    rc = ble_gattc_notify_custom(My_hid_dev.conn_handle, send_handle, om);
-                }
+    HID_PERF_ALLOC(om != NULL);
+    if (!om) {
+        flight_rec(FLIGHT_EV_TX_RETRY, entry->report, entry->conn_handle);
+        return HID_TX_RETRY;
+    }
+    if (entry->traced) {
+        // stamped before the call, NOTIFY_TX comes from inside it
+        hid_latency_stack(entry->conn_handle, send_handle);
+    }
+    // om is freed by the stack even on error
+    if (indicate) {
+        // set before sending, confirmation may come before the call returns
+        conn->indication_pending = true;
+        rc = ble_gattc_indicate_custom(entry->conn_handle, send_handle, om);
+        if (rc) {
+            conn->indication_pending = false;
+        }
+    } else {
+        rc = ble_gattc_notify_custom(entry->conn_handle, send_handle, om);
+    }
+
+    if (rc == BLE_HS_ENOMEM) {
+        flight_rec(FLIGHT_EV_TX_RETRY, entry->report, entry->conn_handle);
+        return HID_TX_RETRY;
+    }
+    if (rc) {
+        ESP_LOGE(tag, "%s: %s notify error %d", __FUNCTION__, report->name, rc);
+        return HID_TX_DROP;
+    }
+
+    delivery_account(indicate);
+    flight_rec(FLIGHT_EV_REPORT_SENT, entry->report | (indicate ? 0x80 : 0), entry->conn_handle);
+    return 0;
+}
+
+/* queue report data for TX task to every central which gets it, in one pass,
+   returns 0 if queued (or nobody has subscribed), 1 if no central is active, 3 if queue is full */
+static int
+report_submit(struct hid_notify_data *report, const uint8_t *data)
+{
+    struct hid_tx_entry entry;
+    int report_idx = report - Notify_data_reports;
+    int rc = 1, queued = 0;
+
+    entry.report = report_idx;
+    entry.len = report->buffer_size;
+    memcpy(entry.data, data, report->buffer_size);
+
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        struct hid_conn *conn = &Hid_conns[i];
+
+        if (!conn_active(conn)) {
+            continue;
+        }
+        if (rc == 1) {
+            rc = 0;
+        }
+        if (!conn_gets_report(conn, report_idx)) {
+            continue;
+        }
+
+        entry.conn_handle = conn->conn_handle;
+        entry.traced = hid_latency_submitted();
+        if (report_idx == REPORT_IDX_MOUSE) {
+            mouse_conn_scale(conn, entry.data, data);
+        }
+        if (!hid_tx_submit(&entry)) {
+            // queue is full: latest state of report is sent when there is room
+            flight_rec(FLIGHT_EV_QUEUE_FULL, report_idx, entry.conn_handle);
+            if (report_idx == REPORT_IDX_MOUSE) {
+                mouse_conn_unscale(conn, entry.data, data);
             }
-            break;
+            rc = 3;
+        } else {
+            flight_rec(FLIGHT_EV_REPORT_QUEUED, report_idx, entry.conn_handle);
+            queued++;
         }
+    }
+
+    // resync sends buffer without deltas, so they must not be lost with the data;
+    // when the queue fills in the middle of the pass, centrals which got them keep them
+    if (rc == 3 && !queued) {
+        coalesce_refund(report, data);
+    }
+
+    return rc;
+}
+
+/* TX task callback: queue latest state of report after queue overflow */
+static void
+tx_resync(int report_idx)
+{
+    uint8_t snapshot[HID_REPORT_MAX_SIZE];
+    struct hid_notify_data *report = &Notify_data_reports[report_idx];
+
+    report_snapshot(report, snapshot);
+    report_submit(report, snapshot);
+}
+
+/* send report data to central, 0 - queued, 1 - not connected, 2 - unknown report, 3 - queue full */
+int
+hid_send_report(int report_handle_num)
+{
+    uint8_t snapshot[HID_REPORT_MAX_SIZE];
+    struct hid_notify_data *report = report_by_num(report_handle_num);
+
+    if (!report) {
+        ESP_LOGW(tag, "%s: Unknown report_handle_num %d", __FUNCTION__, report_handle_num);
+        return 2;
+    }
+
+    report_snapshot(report, snapshot);
+    return report_submit(report, snapshot);
+}
+
+static inline bool
+key_touched(const struct hid_notify_data *report, int key)
+{
+    return report->touched[key >> 5] & (1UL << (key & 31));
+}
+
+/* clear coalescer state of report, called with Hid_report_mux held */
+static inline void
+coalesce_clear(struct hid_notify_data *report)
+{
+    report->dirty = false;
+    report->ordered_pending = false;
+    memset(report->touched, 0, sizeof(report->touched));
+}
+
+/* pending state could not be queued: deltas go back to accumulator for the next flush */
+static void
+coalesce_refund(struct hid_notify_data *report, const uint8_t *pending)
+{
+    bool refunded = false;
+
+    if (!report->refund) {
+        return;
+    }
+    portENTER_CRITICAL(&Hid_report_mux);
+    if (report->refund(pending)) {
+        report->dirty = refunded = true;
+    }
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    if (refunded) {
+        coalesce_carry();
+    }
+}
+
+/* copy pending state of dirty report to be sent, called with Hid_report_mux held,
+   returns true if report is left dirty with accumulated deltas */
+static bool
+coalesce_take(struct hid_notify_data *report, uint8_t *pending)
+{
+    // writers hold the same lock, so buffer is consistent here
+    memcpy(pending, report->buffer, report->buffer_size);
+    coalesce_clear(report);
+    Coalesce.notifications++;
+    if (report->fill && report->fill(pending)) {
+        report->dirty = true;
+        return true;
+    }
+    return false;
+}
+
+/* deltas are left after flush, the rest goes on the next one */
+static void
+coalesce_carry(void)
+{
+    bool arm = false;
+
+    portENTER_CRITICAL(&Hid_report_mux);
+    if (Coalesce.timer && !Coalesce.timer_armed) {
+        Coalesce.timer_armed = arm = true;
+    }
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    if (arm) {
+        esp_timer_start_once(Coalesce.timer, Coalesce.interval_us ? Coalesce.interval_us : COALESCE_CARRY_US);
+    }
+}
+
+/*
+Called before report change. If the change can not be collapsed with pending ones,
+pending state is sent first. COALESCE_ANY_KEY flushes any pending change.
+*/
+static void
+coalesce_prepare(struct hid_notify_data *report, int key, bool ordered)
+{
+    uint8_t pending[HID_REPORT_MAX_SIZE];
+    bool flush = false, carry = false;
+
+    portENTER_CRITICAL(&Hid_report_mux);
+    if (report->dirty &&
+        (key == COALESCE_ANY_KEY || key_touched(report, key) || (ordered && report->ordered_pending))) {
+        carry = coalesce_take(report, pending);
+        flush = true;
+    }
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    if (flush) {
+        report_submit(report, pending);
+    }
+    if (carry) {
+        coalesce_carry();
+    }
+}
+
+/* send all dirty reports */
+static int
+coalesce_flush(void)
+{
+    uint8_t pending[REPORTS_COUNT][HID_REPORT_MAX_SIZE];
+    bool flush[REPORTS_COUNT];
+    bool carry = false;
+    int64_t now = esp_timer_get_time();
+    int rc = 0;
 
-        case SEND_METHOD_STD:
-            if (Notify_data_reports[report_idx].can_indicate) {
-                rc = ble_gattc_indicate(My_hid_dev.conn_handle, send_handle);
-            } else if (Notify_data_reports[report_idx].can_notify) {
-                rc = ble_gattc_notify(My_hid_dev.conn_handle, send_handle);
+    portENTER_CRITICAL(&Hid_report_mux);
+    for (int i = 0; i < REPORTS_COUNT; ++i) {
+        flush[i] = Notify_data_reports[i].dirty;
+        if (flush[i]) {
+            carry |= coalesce_take(&Notify_data_reports[i], pending[i]);
+        }
+    }
+    Coalesce.last_flush_us = now;
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    for (int i = 0; i < REPORTS_COUNT; ++i) {
+        if (flush[i]) {
+            int send_rc = report_submit(&Notify_data_reports[i], pending[i]);
+            if (send_rc) {
+                rc = send_rc;
             }
-            break;
+        }
+    }
 
-        case SEND_METHOD_ALL:
-            ble_gatts_chr_updated(send_handle);
-            rc = 0;
-            break;
+    if (carry) {
+        coalesce_carry();
     }
-    if (rc) {
-        ESP_LOGE(tag, "%s: Notify error in function", __FUNCTION__);
+    if (Coalesce.flush_cb) {
+        Coalesce.flush_cb();
+    }
+
+    return rc;
+}
+
+static void
+coalesce_timer_cb(void *arg)
+{
+    (void)arg;
+    portENTER_CRITICAL(&Hid_report_mux);
+    Coalesce.timer_armed = false;
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    coalesce_flush();
+}
+
+/* called after report change */
+static void
+coalesce_mark(struct hid_notify_data *report, int key, bool ordered)
+{
+    portENTER_CRITICAL(&Hid_report_mux);
+    report->dirty = true;
+    report->ordered_pending |= ordered;
+    if (key != COALESCE_ANY_KEY) {
+        report->touched[key >> 5] |= 1UL << (key & 31);
+    }
+    Coalesce.changes++;
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    hid_latency_changed();
+}
+
+/* marked reports are sent now or on the next flush */
+static int
+coalesce_schedule(void)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t wait = 0;
+    bool arm = false, flush_now = false;
+
+    if (!hid_any_active()) {
+        return 1;
+    }
+
+    // input activity keeps connection interval short
+    conn_params_input();
+
+    portENTER_CRITICAL(&Hid_report_mux);
+    Coalesce.last_input_us = now;
+    if (!Coalesce.timer_armed) {
+        wait = Coalesce.last_flush_us + Coalesce.interval_us - now;
+        if (wait > 0) {
+            Coalesce.timer_armed = arm = true;
+        } else {
+            // nothing has been sent during last interval
+            flush_now = true;
+        }
+    }
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    if (arm) {
+        esp_timer_start_once(Coalesce.timer, wait);
+    } else if (flush_now) {
+        return coalesce_flush();
     }
 
     return 0;
 }
 
+void
+hid_set_flush_cb(hid_flush_cb_t cb)
+{
+    Coalesce.flush_cb = cb;
+}
+
+/* true while changes wait for the next connection interval */
+bool
+hid_flush_pending(void)
+{
+    bool pending;
+
+    portENTER_CRITICAL(&Hid_report_mux);
+    pending = Coalesce.timer_armed;
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    return pending;
+}
+
+/* true during input burst: changes wait for flush, reports are in flight or input has changed recently */
+bool
+hid_input_busy(uint32_t quiet_us)
+{
+    bool pending;
+    int64_t last_input_us;
+
+    portENTER_CRITICAL(&Hid_report_mux);
+    pending = Coalesce.timer_armed;
+    last_input_us = Coalesce.last_input_us;
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    return pending || hid_tx_busy() || esp_timer_get_time() - last_input_us < quiet_us;
+}
+
+static int
+coalesce_commit(struct hid_notify_data *report, int key, bool ordered)
+{
+    coalesce_mark(report, key, ordered);
+    return coalesce_schedule();
+}
+
 uint8_t
 hid_battery_level_get(void)
 {
@@ -399,164 +1218,333 @@ hid_battery_level_get(void)
 int
 hid_battery_level_set(uint8_t level)
 {
-    int rc = 0;
+    struct hid_notify_data *report = report_by_num(HANDLE_BATTERY_LEVEL);
 
-    if (lock_hid_data() == 0) {
-        if (Battery_level[0] != level) {
-            Battery_level[0] = level;
-        }
-        unlock_hid_data();
+    // only battery code writes the level, so it is read without seqlock
+    if (Battery_level[0] == level) {
+        return 0;
+    }
 
-        rc = hid_send_report(HANDLE_BATTERY_LEVEL);
-    } else {
-        return -2;
+    report_write_begin(report);
+    Battery_level[0] = level;
+    report_write_end(report);
+
+    return hid_send_report(HANDLE_BATTERY_LEVEL);
+}
+
+static inline int32_t
+motion_add(int32_t sum, int32_t delta)
+{
+    int32_t result;
+
+    if (__builtin_add_overflow(sum, delta, &result)) {
+        result = delta > 0 ? INT32_MAX : INT32_MIN;
     }
+    return result;
+}
 
-    return rc;
+/* takes whole report steps of unit accumulator steps each, as many as fit the report */
+static inline int32_t
+motion_take(int32_t *sum, int32_t max, int32_t unit)
+{
+    int32_t steps = *sum / unit;
+
+    steps = steps > max ? max : steps < -max ? -max : steps;
+    *sum -= steps * unit;
+    return steps;
 }
 
-int
-hid_mouse_change_key(int cmd, int8_t move_x, int8_t move_y, bool pressed)
+static inline void
+put_le16(uint8_t *dst, int32_t value)
 {
-    int rc = 0;
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
 
-    if (lock_hid_data() == 0) {
+static inline int16_t
+get_le16(const uint8_t *src)
+{
+    return (int16_t)(src[0] | src[1] << 8);
+}
 
-        switch (cmd) {
-            case HID_MOUSE_LEFT:
-            case HID_MOUSE_MIDDLE:
-            case HID_MOUSE_RIGHT:
-                if (pressed) {
-                    Mouse_buffer[0] |= 1 << (cmd - HID_MOUSE_LEFT);
-                } else {
-                    Mouse_buffer[0] &= ~(1 << (cmd - HID_MOUSE_LEFT));
-                }
-                break;
-            case HID_MOUSE_WHEEL_UP:
-                Mouse_buffer[3] = 1;
-                break;
-            case HID_MOUSE_WHEEL_DOWN:
-                Mouse_buffer[3] = -1;
-                break;
-            default:
-                rc = 1;
-                ESP_LOGI(tag, "Unknown mouse cmd %d!", cmd);
+/* some active central reads mouse in this protocol mode, called with Hid_report_mux held */
+static bool
+mouse_mode_used(bool boot)
+{
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        if (conn_active(&Hid_conns[i]) && Hid_conns[i].report_mode_boot == boot) {
+            return true;
         }
+    }
+    return false;
+}
 
-        Mouse_buffer[1] = move_x;
-        Mouse_buffer[2] = move_y;
+/* fill callback of mouse report, called with Hid_report_mux held */
+static bool
+mouse_motion_fill(uint8_t *pending)
+{
+    struct mouse_motion *motion = &Mouse_motion;
 
-        unlock_hid_data();
+    if (!mouse_mode_used(false)) {
+        memset(motion, 0, sizeof(*motion));
+        return false;
+    }
+    put_le16(pending + 1, motion_take(&motion->x, MOUSE_DELTA_MAX, 1));
+    put_le16(pending + 3, motion_take(&motion->y, MOUSE_DELTA_MAX, 1));
+    put_le16(pending + 5, motion_take(&motion->wheel, MOUSE_DELTA_MAX, 1));
+    put_le16(pending + 7, motion_take(&motion->pan, MOUSE_DELTA_MAX, 1));
 
-        if (rc == 0 || move_x || move_y) {
-            rc = hid_send_report(HANDLE_HID_MOUSE_REPORT);
-        }
-    } else {
-        rc = 1;
+    return motion->x || motion->y || motion->wheel || motion->pan;
+}
+
+/* fill callback of boot mouse report, it has no wheel */
+static bool
+boot_mouse_motion_fill(uint8_t *pending)
+{
+    struct mouse_motion *motion = &Boot_mouse_motion;
+
+    if (!mouse_mode_used(true)) {
+        memset(motion, 0, sizeof(*motion));
+        return false;
     }
+    pending[1] = motion_take(&motion->x, BOOT_MOUSE_DELTA_MAX, 1);
+    pending[2] = motion_take(&motion->y, BOOT_MOUSE_DELTA_MAX, 1);
+    motion->wheel = motion->pan = 0;
 
-    return rc;
+    return motion->x || motion->y;
 }
 
-int
-hid_cc_build_report(uint8_t *buffer, consumer_cmd_t cmd, bool pressed)
+/* refund callback of mouse report, called with Hid_report_mux held */
+static bool
+mouse_motion_refund(const uint8_t *pending)
 {
-    if (!buffer) {
-        ESP_LOGE(tag, "%s(), the buffer is NULL.", __func__);
-        return 1;
+    struct mouse_motion *motion = &Mouse_motion;
+    int32_t x = get_le16(pending + 1), y = get_le16(pending + 3);
+    int32_t wheel = get_le16(pending + 5), pan = get_le16(pending + 7);
+
+    motion->x = motion_add(motion->x, x);
+    motion->y = motion_add(motion->y, y);
+    motion->wheel = motion_add(motion->wheel, wheel);
+    motion->pan = motion_add(motion->pan, pan);
+
+    return x || y || wheel || pan;
+}
+
+/* wheel and pan of mouse report data for the central: without multiplier host counts
+   whole notches, the rest of a notch waits for more steps in its connection state */
+static void
+mouse_conn_scale(struct hid_conn *conn, uint8_t *dst, const uint8_t *src)
+{
+    int32_t wheel = get_le16(src + 5), pan = get_le16(src + 7);
+
+    portENTER_CRITICAL(&Hid_report_mux);
+    if (!(conn->mouse_feature & 0x03)) {
+        conn->wheel_rest = motion_add(conn->wheel_rest, wheel);
+        wheel = motion_take(&conn->wheel_rest, MOUSE_DELTA_MAX, HID_MOUSE_RES_MULTIPLIER);
+    }
+    if (!(conn->mouse_feature & 0x0C)) {
+        conn->pan_rest = motion_add(conn->pan_rest, pan);
+        pan = motion_take(&conn->pan_rest, MOUSE_DELTA_MAX, HID_MOUSE_RES_MULTIPLIER);
+    }
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    put_le16(dst + 5, wheel);
+    put_le16(dst + 7, pan);
+}
+
+/* entry built by mouse_conn_scale was not queued, its steps leave the connection state */
+static void
+mouse_conn_unscale(struct hid_conn *conn, const uint8_t *dst, const uint8_t *src)
+{
+    portENTER_CRITICAL(&Hid_report_mux);
+    if (!(conn->mouse_feature & 0x03)) {
+        conn->wheel_rest += get_le16(dst + 5) * HID_MOUSE_RES_MULTIPLIER - get_le16(src + 5);
+    }
+    if (!(conn->mouse_feature & 0x0C)) {
+        conn->pan_rest += get_le16(dst + 7) * HID_MOUSE_RES_MULTIPLIER - get_le16(src + 7);
+    }
+    portEXIT_CRITICAL(&Hid_report_mux);
+}
+
+/* refund callback of boot mouse report */
+static bool
+boot_mouse_motion_refund(const uint8_t *pending)
+{
+    struct mouse_motion *motion = &Boot_mouse_motion;
+    int32_t x = (int8_t)pending[1], y = (int8_t)pending[2];
+
+    motion->x = motion_add(motion->x, x);
+    motion->y = motion_add(motion->y, y);
+
+    return x || y;
+}
+
+/* adds deltas to both mouse reports, they are sent on the next flush */
+static int
+mouse_motion_commit(struct hid_notify_data **reports, int32_t x, int32_t y, int32_t wheel, int32_t pan)
+{
+    struct mouse_motion *motions[] = { &Mouse_motion, &Boot_mouse_motion };
+
+    portENTER_CRITICAL(&Hid_report_mux);
+    for (int i = 0; i < 2; ++i) {
+        motions[i]->x = motion_add(motions[i]->x, x);
+        motions[i]->y = motion_add(motions[i]->y, y);
+        motions[i]->wheel = motion_add(motions[i]->wheel, wheel);
+        motions[i]->pan = motion_add(motions[i]->pan, pan);
     }
+    portEXIT_CRITICAL(&Hid_report_mux);
+
+    coalesce_mark(reports[0], COALESCE_ANY_KEY, false);
+    coalesce_mark(reports[1], COALESCE_ANY_KEY, false);
+    return coalesce_schedule();
+}
+
+/* mouse report and boot mouse report */
+static void
+mouse_reports(struct hid_notify_data **reports)
+{
+    reports[0] = report_by_num(HANDLE_HID_MOUSE_REPORT);
+    reports[1] = report_by_num(HANDLE_HID_BOOT_MOUSE_REPORT);
+}
 
+/* buttons are sent at once, motion and wheel are summed and sent once per connection interval */
+int
+hid_mouse_change_key(int cmd, int32_t move_x, int32_t move_y, bool pressed)
+{
+    HID_PERF_SCOPE(HID_PERF_MOUSE);
+    struct hid_notify_data *reports[2];
+    int32_t wheel = 0;
     int rc = 0;
 
-    switch (cmd) {
-        case HID_CONSUMER_CHANNEL_UP:
-            HID_CC_RPT_SET_CHANNEL(buffer, pressed ? HID_CC_RPT_CHANNEL_UP : 0);
-            break;
+    mouse_reports(reports);
 
-        case HID_CONSUMER_CHANNEL_DOWN:
-            HID_CC_RPT_SET_CHANNEL(buffer, pressed ? HID_CC_RPT_CHANNEL_DOWN : 0);
-            break;
+    switch (cmd) {
+        case HID_MOUSE_LEFT:
+        case HID_MOUSE_MIDDLE:
+        case HID_MOUSE_RIGHT:
+            for (int i = 0; i < 2; ++i) {
+                // motion made before the button change goes first
+                coalesce_prepare(reports[i], COALESCE_ANY_KEY, false);
+
+                // buttons byte is the same in both reports
+                report_write_begin(reports[i]);
+                if (pressed) {
+                    reports[i]->buffer[0] |= 1 << (cmd - HID_MOUSE_LEFT);
+                } else {
+                    reports[i]->buffer[0] &= ~(1 << (cmd - HID_MOUSE_LEFT));
+                }
+                report_write_end(reports[i]);
 
-        case HID_CONSUMER_VOLUME_UP:
-            HID_CC_RPT_SET_VOLUME(buffer, pressed ? HID_CC_RPT_VOLUME_UP : 0);
+                coalesce_mark(reports[i], cmd & 0xFF, false);
+            }
+            if (!hid_any_active()) {
+                return 1;
+            }
+            conn_params_input();
+            // button change does not wait for the coalescing window
+            coalesce_prepare(reports[0], COALESCE_ANY_KEY, false);
+            coalesce_prepare(reports[1], COALESCE_ANY_KEY, false);
             break;
-
-        case HID_CONSUMER_VOLUME_DOWN:
-            HID_CC_RPT_SET_VOLUME(buffer, pressed ? HID_CC_RPT_VOLUME_DOWN : 0);
+        case HID_MOUSE_WHEEL_UP:
+            // one notch per click
+            wheel = pressed ? HID_MOUSE_RES_MULTIPLIER : 0;
             break;
-
-        case HID_CONSUMER_MUTE:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_MUTE : 0);
+        case HID_MOUSE_WHEEL_DOWN:
+            wheel = pressed ? -HID_MOUSE_RES_MULTIPLIER : 0;
             break;
-
-        case HID_CONSUMER_POWER:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_POWER : 0);
+        case 0:
+            // motion only
             break;
+        default:
+            ESP_LOGI(tag, "Unknown mouse cmd %d!", cmd);
+            rc = 1;
+    }
 
-        case HID_CONSUMER_RECALL_LAST:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_LAST : 0);
-            break;
+    if (move_x || move_y || wheel) {
+        rc = mouse_motion_commit(reports, move_x, move_y, wheel, 0);
+    }
 
-        case HID_CONSUMER_ASSIGN_SEL:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_ASSIGN_SEL : 0);
-            break;
+    return rc;
+}
 
-        case HID_CONSUMER_PLAY:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_PLAY : 0);
-            break;
+/* wheel and pan in 1/HID_MOUSE_RES_MULTIPLIER notch steps, host gets whole notches
+   unless it has enabled high resolution scrolling */
+int
+hid_mouse_scroll(int32_t wheel, int32_t pan)
+{
+    HID_PERF_SCOPE(HID_PERF_MOUSE);
+    struct hid_notify_data *reports[2];
 
-        case HID_CONSUMER_PAUSE:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_PAUSE : 0);
-            break;
+    mouse_reports(reports);
+    if (!wheel && !pan) {
+        return 0;
+    }
+    return mouse_motion_commit(reports, 0, 0, wheel, pan);
+}
 
-        case HID_CONSUMER_RECORD:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_RECORD : 0);
-            break;
+/* slots of consumer control report */
+#define HID_CC_USAGES (HIDD_LE_REPORT_CC_SIZE / 2)
 
-        case HID_CONSUMER_FAST_FORWARD:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_FAST_FWD : 0);
-            break;
+int
+hid_cc_build_report(uint8_t *buffer, consumer_cmd_t cmd, bool pressed)
+{
+    int slot;
 
-        case HID_CONSUMER_REWIND:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_REWIND : 0);
-            break;
+    if (!buffer) {
+        ESP_LOGE(tag, "%s(), the buffer is NULL.", __func__);
+        return 1;
+    }
 
-        case HID_CONSUMER_SCAN_NEXT_TRK:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_SCAN_NEXT_TRK : 0);
-            break;
+    // usage goes to the report as it is, so any usage of report map range is supported
+    if (cmd == 0 || cmd > HID_CC_USAGE_MAX) {
+        return 2;
+    }
 
-        case HID_CONSUMER_SCAN_PREV_TRK:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_SCAN_PREV_TRK : 0);
-            break;
+    for (slot = 0; slot < HID_CC_USAGES; ++slot) {
+        uint16_t usage = buffer[slot * 2] | buffer[slot * 2 + 1] << 8;
 
-        case HID_CONSUMER_STOP:
-            HID_CC_RPT_SET_BUTTON(buffer, pressed ? HID_CC_RPT_STOP : 0);
+        if (usage == cmd || usage == 0) {
             break;
+        }
+    }
 
-        default:
-            rc = 2;
-            break;
+    if (pressed) {
+        if (slot == HID_CC_USAGES) {
+            // all slots are taken by other pressed usages
+            return 3;
+        }
+        buffer[slot * 2] = cmd & 0xff;
+        buffer[slot * 2 + 1] = cmd >> 8;
+    } else if (slot < HID_CC_USAGES) {
+        // later usages move down, so pressed ones stay at the start of the array
+        memmove(buffer + slot * 2, buffer + slot * 2 + 2, (HID_CC_USAGES - slot - 1) * 2);
+        buffer[HIDD_LE_REPORT_CC_SIZE - 2] = 0;
+        buffer[HIDD_LE_REPORT_CC_SIZE - 1] = 0;
     }
 
-    return rc;
+    return 0;
 }
 
 int
 hid_cc_change_key(int key, bool pressed)
 {
+    HID_PERF_SCOPE(HID_PERF_CC);
+    struct hid_notify_data *report = report_by_num(HANDLE_HID_CC_REPORT);
     int rc = 0;
 
-    if (lock_hid_data() == 0) {
+    if (key <= 0 || key > HID_CC_USAGE_MAX) {
+        return 2;
+    }
 
-        rc = hid_cc_build_report(CC_buffer, (consumer_cmd_t) key, pressed);
+    // slots are shared by all usages, so pending change is always sent first
+    coalesce_prepare(report, COALESCE_ANY_KEY, true);
 
-        unlock_hid_data();
+    report_write_begin(report);
+    rc = hid_cc_build_report(CC_buffer, (consumer_cmd_t) key, pressed);
+    report_write_end(report);
 
-        if (rc == 0) {
-            rc = hid_send_report(HANDLE_HID_CC_REPORT);
-        }
-    } else {
-        rc = 2;
+    if (rc == 0) {
+        rc = coalesce_commit(report, COALESCE_ANY_KEY, true);
     }
 
     return rc;
@@ -565,60 +1553,101 @@ hid_cc_change_key(int key, bool pressed)
 int
 hid_keyboard_change_key(uint8_t key, bool pressed)
 {
+    HID_PERF_SCOPE(HID_PERF_KEYBOARD);
+    struct hid_notify_data *report = report_by_num(HANDLE_HID_KB_IN_REPORT);
+    struct hid_notify_data *nkro = report_by_num(HANDLE_HID_NKRO_REPORT);
     int rc = 0;
+    bool nkro_used = false, kb_used = false;
+    bool is_modifier = key >= HID_KEY_LEFT_CTRL && key <= HID_KEY_RIGHT_GUI;
+    // bitmap report loses order of keys pressed together, array report keeps it
+    bool ordered = pressed && !is_modifier;
+
+    // every central gets keyboard input with one of two reports
+    for (int i = 0; i < HID_MAX_CONNECTIONS; ++i) {
+        if (conn_active(&Hid_conns[i])) {
+            if (nkro_report_active(&Hid_conns[i])) {
+                nkro_used = true;
+            } else {
+                kb_used = true;
+            }
+        }
+    }
 
-    if (lock_hid_data() == 0) {
+    if (nkro_used) {
+        coalesce_prepare(nkro, key, ordered);
+    }
+    if (kb_used) {
+        coalesce_prepare(report, key, false);
+    }
 
-        if (key >= HID_KEY_LEFT_CTRL && key <= HID_KEY_RIGHT_GUI) {
-            // it is modifier (Ctrl Shift Alt or Winkey)
-            if (pressed) {
-                Keyboard_buffer[0] |= 1 << ( key - HID_KEY_LEFT_CTRL );
-            } else {
-                Keyboard_buffer[0] &= ~( 1 << ( key - HID_KEY_LEFT_CTRL ));
+    // bitmap report, O(1) for any key
+    if (key < HIDD_LE_REPORT_NKRO_KEYS) {
+        report_write_begin(nkro);
+        if (pressed) {
+            Nkro_buffer[key >> 3] |= 1 << (key & 7);
+        } else {
+            Nkro_buffer[key >> 3] &= ~(1 << (key & 7));
+        }
+        report_write_end(nkro);
+    }
+
+    report_write_begin(report);
+
+    if (is_modifier) {
+        // it is modifier (Ctrl Shift Alt or Winkey)
+        if (pressed) {
+            Keyboard_buffer[0] |= 1 << ( key - HID_KEY_LEFT_CTRL );
+        } else {
+            Keyboard_buffer[0] &= ~( 1 << ( key - HID_KEY_LEFT_CTRL ));
+        }
+    } else {
+        // ordinary key
+        bool found = false;
+        if (pressed) {
+            // if pressed, adding key to buffer
+            for (int i = 2; i < HIDD_LE_REPORT_KB_IN_SIZE; ++i) {
+                if (Keyboard_buffer[i] == 0) {
+                    Keyboard_buffer[i] = key;
+                    found = true;
+                    break;
+                }
             }
         } else {
-            // ordinary key
-            bool found = false;
-            if (pressed) {
-                // if pressed, adding key to buffer
-                for (int i = 2; i < HIDD_LE_REPORT_KB_IN_SIZE; ++i) {
-                    if (Keyboard_buffer[i] == 0) {
-                        Keyboard_buffer[i] = key;
+            // if key is released then delete key from buffer
+            for (int i = 2; i < HIDD_LE_REPORT_KB_IN_SIZE; ++i) {
+                if (!found) {
+                    if (Keyboard_buffer[i] == key) {
+                        Keyboard_buffer[i] = 0;
                         found = true;
-                        break;
                     }
-                }
-            } else {
-                // if key is released then delete key from buffer
-                for (int i = 2; i < HIDD_LE_REPORT_KB_IN_SIZE; ++i) {
-                    if (!found) {
-                        if (Keyboard_buffer[i] == key) {
-                            Keyboard_buffer[i] = 0;
-                            found = true;
-                        }
-                    } else {
-                        if (Keyboard_buffer[i] == 0) {
-                            break;
-                        }
-                        // shift other keys to the left
-                        Keyboard_buffer[i-1] = Keyboard_buffer[i];
-                        Keyboard_buffer[i] = 0;
+                } else {
+                    if (Keyboard_buffer[i] == 0) {
+                        break;
                     }
+                    // shift other keys to the left
+                    Keyboard_buffer[i-1] = Keyboard_buffer[i];
+                    Keyboard_buffer[i] = 0;
                 }
             }
-            if (!found) {
-                rc = 1; // no room for new key or key not found
-            }
         }
+        if (!found) {
+            rc = 1; // no room for new key or key not found
+        }
+    }
 
-        unlock_hid_data();
+    report_write_end(report);
 
-        if (rc == 0) {
-            rc = hid_send_report(HANDLE_HID_KB_IN_REPORT);
-        }
-    } else {
-        rc = 2;
+    bool marked = false;
+
+    // six keys limit does not matter for bitmap report
+    if (nkro_used && key < HIDD_LE_REPORT_NKRO_KEYS) {
+        coalesce_mark(nkro, key, ordered);
+        marked = true;
+    }
+    if (kb_used && rc == 0) {
+        coalesce_mark(report, key, false);
+        marked = true;
     }
 
-    return rc;
+    return marked ? coalesce_schedule() : 1;
 }
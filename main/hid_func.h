@@ -4,22 +4,48 @@
 
 #include "host/ble_gap.h"
 
+/* how report is sent when central has subscribed to both notifications and indications */
+enum hid_delivery {
+    HID_DELIVERY_NOTIFY,        // notify, lowest latency
+    HID_DELIVERY_INDICATE,      // indicate, every report waits for confirmation from central
+    HID_DELIVERY_ADAPTIVE,      // indicate while TX is idle, notify during bursts
+};
+
+/* called after coalescer has sent pending reports */
+typedef void (*hid_flush_cb_t)(void);
+
 extern void hid_clean_vars(struct ble_gap_conn_desc *desc);
-extern void hid_set_disconnected();
-extern void hid_set_notify(uint16_t attr_handle, uint8_t cur_notify, uint8_t cur_indicate);
-extern bool hid_set_suspend(bool need_suspend);
-extern bool hid_set_report_mode(bool boot_mode);
+extern void hid_set_disconnected(uint16_t conn_handle);
+extern int hid_conn_count(void);
+extern void hid_set_conn_interval(uint16_t conn_handle, uint16_t conn_itvl);
+/* called for BLE_GAP_EVENT_NOTIFY_TX */
+extern void hid_notify_tx(uint16_t conn_handle, uint16_t attr_handle, bool indication, int status);
+extern void hid_register_report_attr(uint16_t attr_handle, int handle_num);
+extern int hid_set_delivery(int handle_num, enum hid_delivery delivery);
+extern void hid_set_notify(uint16_t conn_handle, uint16_t attr_handle,
+                           uint8_t cur_notify, uint8_t cur_indicate);
+extern bool hid_set_suspend(uint16_t conn_handle, bool need_suspend);
+extern bool hid_set_report_mode(uint16_t conn_handle, bool boot_mode);
+extern bool hid_get_report_mode(uint16_t conn_handle);
+extern void hid_set_flush_cb(hid_flush_cb_t cb);
+extern bool hid_flush_pending(void);
+extern bool hid_input_busy(uint32_t quiet_us);
 
 extern uint8_t hid_battery_level_get(void);
 
+/* notifies the level when it has changed */
 extern int hid_battery_level_set(uint8_t level);
 extern int hid_keyboard_change_key(uint8_t key, bool pressed);
 extern int hid_cc_change_key(int key, bool pressed);
-extern int hid_mouse_change_key(int cmd, int8_t move_x, int8_t move_y, bool pressed);
+/* cmd is HID_MOUSE_* button or wheel, 0 to move only; motion is summed until the next flush */
+extern int hid_mouse_change_key(int cmd, int32_t move_x, int32_t move_y, bool pressed);
+/* wheel and pan in 1/HID_MOUSE_RES_MULTIPLIER notch steps, every central gets them
+   in the resolution it has set with mouse feature report */
+extern int hid_mouse_scroll(int32_t wheel, int32_t pan);
 extern int hid_leds_write(struct os_mbuf *buf);
 
-extern int hid_write_buffer(struct os_mbuf *buf, int handle_num);
+extern int hid_write_buffer(uint16_t conn_handle, struct os_mbuf *buf, int handle_num);
 
-extern int hid_read_buffer(struct os_mbuf *buf, int handle_num);
+extern int hid_read_buffer(uint16_t conn_handle, struct os_mbuf *buf, int handle_num);
 
 #endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "host/ble_hs.h"
+
+#include "hid_latency.h"
+
+#ifdef CONFIG_HID_LATENCY
+
+#include "xtensa/hal.h"
+
+static const char *tag = "NimBLEKBD_LATENCY";
+
+/* trace which has not reached the air in this time is dropped (no central, no subscription) */
+#define LAT_TRACE_TIMEOUT_US 1000000
+
+/* value of latency characteristic: header and histograms, little endian */
+#define LAT_FORMAT_VERSION 1
+
+static const char *Hist_names[HID_LAT_STAGE_COUNT] = {
+    [HID_LAT_HIST_TOTAL]    = "total",
+    [HID_LAT_DEBOUNCED]     = "edge->debounced",
+    [HID_LAT_DEQUEUED]      = "debounced->dequeued",
+    [HID_LAT_CHANGED]       = "dequeued->changed",
+    [HID_LAT_SUBMITTED]     = "changed->submitted",
+    [HID_LAT_STACK]         = "submitted->stack",
+    [HID_LAT_NOTIFY_TX]     = "stack->notify_tx",
+};
+
+static uint32_t Hist[HID_LAT_STAGE_COUNT][HID_LAT_BUCKETS];
+
+_Static_assert(4 + sizeof(Hist) <= 512, "latency characteristic value is too long");
+
+static struct hid_latency_trace {
+    bool active;
+    enum hid_latency_stage stage;   // the last stage stamped
+    uint32_t t_us[HID_LAT_STAGE_COUNT];
+    // notification which carries the trace
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+} Trace;
+
+static struct hid_latency_stats {
+    uint32_t traces;
+    uint32_t busy;                  // events not traced, trace was in progress
+    uint32_t dropped;               // traces which have not reached the air
+    // cost of the instrumentation itself
+    uint32_t calls;
+    uint64_t cycles;
+} Stats;
+
+/* stages are stamped from ISR-free tasks: app_main, timers, TX and BLE host */
+static portMUX_TYPE Lat_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#define LAT_ENTER() \
+    uint32_t lat_start_cycles = xthal_get_ccount(); \
+    portENTER_CRITICAL(&Lat_mux)
+#define LAT_EXIT() \
+    Stats.calls++; \
+    Stats.cycles += xthal_get_ccount() - lat_start_cycles; \
+    portEXIT_CRITICAL(&Lat_mux)
+
+static inline int
+lat_bucket(uint32_t us)
+{
+    int bucket = us ? 31 - __builtin_clz(us) : 0;
+
+    return bucket < HID_LAT_BUCKETS ? bucket : HID_LAT_BUCKETS - 1;
+}
+
+/* stamps stage if trace has just passed the previous one, called with Lat_mux held */
+static bool
+lat_stamp(enum hid_latency_stage stage)
+{
+    if (!Trace.active || Trace.stage != stage - 1) {
+        return false;
+    }
+    Trace.t_us[stage] = HID_LAT_NOW();
+    Trace.stage = stage;
+    return true;
+}
+
+/* trace has reached the air, called with Lat_mux held */
+static void
+lat_complete(void)
+{
+    enum hid_latency_stage first = Trace.t_us[HID_LAT_EDGE] ? HID_LAT_EDGE : HID_LAT_DEBOUNCED;
+
+    for (int stage = first + 1; stage < HID_LAT_STAGE_COUNT; ++stage) {
+        Hist[stage][lat_bucket(Trace.t_us[stage] - Trace.t_us[stage - 1])]++;
+    }
+    Hist[HID_LAT_HIST_TOTAL][lat_bucket(Trace.t_us[HID_LAT_NOTIFY_TX] - Trace.t_us[first])]++;
+    Trace.active = false;
+    Stats.traces++;
+}
+
+void
+hid_latency_begin(uint32_t edge_us, uint32_t debounced_us)
+{
+    uint32_t now = HID_LAT_NOW();
+
+    LAT_ENTER();
+    if (Trace.active && now - Trace.t_us[HID_LAT_DEQUEUED] < LAT_TRACE_TIMEOUT_US) {
+        Stats.busy++;
+    } else {
+        if (Trace.active) {
+            Stats.dropped++;
+        }
+        Trace.active = true;
+        Trace.stage = HID_LAT_DEQUEUED;
+        Trace.t_us[HID_LAT_EDGE] = edge_us;
+        Trace.t_us[HID_LAT_DEBOUNCED] = debounced_us;
+        Trace.t_us[HID_LAT_DEQUEUED] = now;
+    }
+    LAT_EXIT();
+}
+
+void
+hid_latency_changed(void)
+{
+    LAT_ENTER();
+    lat_stamp(HID_LAT_CHANGED);
+    LAT_EXIT();
+}
+
+bool
+hid_latency_submitted(void)
+{
+    bool traced;
+
+    LAT_ENTER();
+    traced = lat_stamp(HID_LAT_SUBMITTED);
+    LAT_EXIT();
+
+    return traced;
+}
+
+void
+hid_latency_stack(uint16_t conn_handle, uint16_t attr_handle)
+{
+    LAT_ENTER();
+    if (lat_stamp(HID_LAT_STACK)) {
+        Trace.conn_handle = conn_handle;
+        Trace.attr_handle = attr_handle;
+    }
+    LAT_EXIT();
+}
+
+void
+hid_latency_notify_tx(uint16_t conn_handle, uint16_t attr_handle)
+{
+    LAT_ENTER();
+    if (Trace.active && Trace.stage == HID_LAT_STACK &&
+        Trace.conn_handle == conn_handle && Trace.attr_handle == attr_handle) {
+        lat_stamp(HID_LAT_NOTIFY_TX);
+        lat_complete();
+    }
+    LAT_EXIT();
+}
+
+int
+hid_latency_read(struct os_mbuf *om)
+{
+    const uint8_t header[4] = { LAT_FORMAT_VERSION, HID_LAT_STAGE_COUNT, HID_LAT_BUCKETS, 0 };
+    uint32_t hist[HID_LAT_STAGE_COUNT][HID_LAT_BUCKETS];
+    int rc;
+
+    portENTER_CRITICAL(&Lat_mux);
+    memcpy(hist, Hist, sizeof(hist));
+    portEXIT_CRITICAL(&Lat_mux);
+
+    rc = os_mbuf_append(om, header, sizeof(header));
+    if (rc == 0) {
+        rc = os_mbuf_append(om, hist, sizeof(hist));
+    }
+    return rc;
+}
+
+void
+hid_latency_command(uint8_t cmd)
+{
+    switch (cmd) {
+        case HID_LAT_CMD_RESET:
+            portENTER_CRITICAL(&Lat_mux);
+            memset(Hist, 0, sizeof(Hist));
+            memset(&Stats, 0, sizeof(Stats));
+            Trace.active = false;
+            portEXIT_CRITICAL(&Lat_mux);
+            ESP_LOGI(tag, "histograms are reset");
+            break;
+
+        case HID_LAT_CMD_DUMP:
+            hid_latency_dump();
+            break;
+
+        default:
+            ESP_LOGW(tag, "unknown command %d", cmd);
+    }
+}
+
+/* upper bound of bucket which holds the quantile, in us */
+static uint32_t
+lat_quantile(const uint32_t *hist, uint32_t count, uint32_t permille)
+{
+    uint32_t rank = ((uint64_t)count * permille + 999) / 1000, seen = 0;
+
+    for (int i = 0; i < HID_LAT_BUCKETS; ++i) {
+        seen += hist[i];
+        if (seen >= rank) {
+            return 2UL << i;
+        }
+    }
+    return 2UL << (HID_LAT_BUCKETS - 1);
+}
+
+void
+hid_latency_dump(void)
+{
+    uint32_t hist[HID_LAT_STAGE_COUNT][HID_LAT_BUCKETS];
+    struct hid_latency_stats stats;
+    char line[HID_LAT_BUCKETS * 11 + 1];
+
+    portENTER_CRITICAL(&Lat_mux);
+    memcpy(hist, Hist, sizeof(hist));
+    stats = Stats;
+    portEXIT_CRITICAL(&Lat_mux);
+
+    ESP_LOGI(tag, "%u traces, %u events not traced, %u traces dropped; "
+        "instrumentation: %u calls, %u cycles per call",
+        stats.traces, stats.busy, stats.dropped, stats.calls,
+        stats.calls ? (uint32_t)(stats.cycles / stats.calls) : 0);
+
+    for (int i = 0; i < HID_LAT_STAGE_COUNT; ++i) {
+        uint32_t count = 0;
+        int len = 0;
+
+        for (int j = 0; j < HID_LAT_BUCKETS; ++j) {
+            count += hist[i][j];
+            len += sprintf(line + len, " %u", hist[i][j]);
+        }
+        if (!count) {
+            continue;
+        }
+        ESP_LOGI(tag, "%s: %u, p50 < %u us, p99 < %u us, log2 us buckets:%s",
+            Hist_names[i], count, lat_quantile(hist[i], count, 500),
+            lat_quantile(hist[i], count, 990), line);
+    }
+}
+
+#endif
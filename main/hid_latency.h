@@ -0,0 +1,69 @@
+#ifndef H_HID_LATENCY_
+#define H_HID_LATENCY_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/*
+Input-to-air latency tracing, enabled by CONFIG_HID_LATENCY. One input event
+at a time is followed through the pipeline and timestamped at every stage,
+events coming while a trace is in progress are not traced. Time between two
+stages goes into a log2 histogram, one more histogram has the whole path.
+Histograms are read from the latency GATT characteristic and printed to log.
+*/
+
+enum hid_latency_stage {
+    HID_LAT_EDGE,               // first edge in gpio_isr_handler1
+    HID_LAT_DEBOUNCED,          // event pushed by gpio_btn_task
+    HID_LAT_DEQUEUED,           // event taken by app_main
+    HID_LAT_CHANGED,            // report buffer changed in hid_*_change_key
+    HID_LAT_SUBMITTED,          // report queued for TX task
+    HID_LAT_STACK,              // notification given to NimBLE, first try of it
+    HID_LAT_NOTIFY_TX,          // BLE_GAP_EVENT_NOTIFY_TX
+    HID_LAT_STAGE_COUNT
+};
+
+/* histogram 0 is the whole path, histogram N is from stage N-1 to stage N */
+#define HID_LAT_HIST_TOTAL 0
+/* bucket K counts times from 2^K to 2^(K+1)-1 us, the last one counts longer times too */
+#define HID_LAT_BUCKETS 18
+
+/* GATT commands written to latency characteristic */
+#define HID_LAT_CMD_RESET 0x01
+#define HID_LAT_CMD_DUMP  0x02
+
+#ifdef CONFIG_HID_LATENCY
+
+#include "esp_timer.h"
+
+struct os_mbuf;
+
+#define HID_LAT_NOW() ((uint32_t)esp_timer_get_time())
+
+/* edge_us is 0 when edge time is not known (matrix keys) */
+extern void hid_latency_begin(uint32_t edge_us, uint32_t debounced_us);
+extern void hid_latency_changed(void);
+/* true if report being queued carries the trace */
+extern bool hid_latency_submitted(void);
+extern void hid_latency_stack(uint16_t conn_handle, uint16_t attr_handle);
+extern void hid_latency_notify_tx(uint16_t conn_handle, uint16_t attr_handle);
+
+extern int hid_latency_read(struct os_mbuf *om);
+extern void hid_latency_command(uint8_t cmd);
+extern void hid_latency_dump(void);
+
+#else
+
+#define HID_LAT_NOW() 0
+#define hid_latency_begin(edge_us, debounced_us) do { } while (0)
+#define hid_latency_changed() do { } while (0)
+#define hid_latency_submitted() false
+#define hid_latency_stack(conn_handle, attr_handle) do { (void)(conn_handle); (void)(attr_handle); } while (0)
+#define hid_latency_notify_tx(conn_handle, attr_handle) do { (void)(conn_handle); (void)(attr_handle); } while (0)
+#define hid_latency_dump() do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "hid_perf.h"
+
+#ifdef CONFIG_HID_PERF
+
+static const char *tag = "NimBLEKBD_PERF";
+
+static const char *Probe_names[HID_PERF_PROBE_COUNT] = {
+    [HID_PERF_KEYBOARD]         = "hid_keyboard_change_key",
+    [HID_PERF_MOUSE]            = "hid_mouse_change_key",
+    [HID_PERF_CC]               = "hid_cc_change_key",
+    [HID_PERF_READ_BUFFER]      = "hid_read_buffer",
+    [HID_PERF_HID_ACCESS]       = "hid_svr_chr_access",
+    [HID_PERF_REPORT_ACCESS]    = "ble_svc_report_access",
+    [HID_PERF_TX_SEND]          = "tx_send",
+};
+
+static struct hid_perf_counter {
+    uint32_t calls;
+    uint32_t cycles_max;
+    uint64_t cycles_total;
+} Counters[HID_PERF_PROBE_COUNT];
+
+static struct hid_perf_allocs {
+    uint32_t allocs;
+    uint32_t failures;
+} Allocs;
+
+/* probes run in app_main, typing, BLE host and TX tasks */
+static portMUX_TYPE Perf_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t Window_start_us;
+static esp_timer_handle_t Dump_timer;
+
+void
+hid_perf_record(enum hid_perf_probe probe, uint32_t cycles)
+{
+    struct hid_perf_counter *counter = &Counters[probe];
+
+    portENTER_CRITICAL(&Perf_mux);
+    counter->calls++;
+    counter->cycles_total += cycles;
+    if (cycles > counter->cycles_max) {
+        counter->cycles_max = cycles;
+    }
+    portEXIT_CRITICAL(&Perf_mux);
+}
+
+void
+hid_perf_alloc(bool ok)
+{
+    portENTER_CRITICAL(&Perf_mux);
+    Allocs.allocs++;
+    Allocs.failures += !ok;
+    portEXIT_CRITICAL(&Perf_mux);
+}
+
+/* print counters of the last period as JSON lines and start a new period */
+static void
+hid_perf_dump(void *arg)
+{
+    (void)arg;
+    struct hid_perf_counter counters[HID_PERF_PROBE_COUNT];
+    struct hid_perf_allocs allocs;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&Perf_mux);
+    memcpy(counters, Counters, sizeof(counters));
+    memset(Counters, 0, sizeof(Counters));
+    allocs = Allocs;
+    memset(&Allocs, 0, sizeof(Allocs));
+    portEXIT_CRITICAL(&Perf_mux);
+
+    int64_t window_us = now - Window_start_us;
+    Window_start_us = now;
+
+    for (int i = 0; i < HID_PERF_PROBE_COUNT; ++i) {
+        struct hid_perf_counter *counter = &counters[i];
+
+        if (!counter->calls) {
+            continue;
+        }
+        printf("{\"perf\":\"%s\",\"t_us\":%" PRId64 ",\"window_us\":%" PRId64 ",\"calls\":%" PRIu32 ","
+            "\"per_sec\":%" PRIu32 ",\"cycles_avg\":%" PRIu32 ",\"cycles_max\":%" PRIu32 "}\n",
+            Probe_names[i], now, window_us, counter->calls,
+            (uint32_t)((uint64_t)counter->calls * 1000000 / window_us),
+            (uint32_t)(counter->cycles_total / counter->calls), counter->cycles_max);
+    }
+    if (allocs.allocs) {
+        printf("{\"perf\":\"mbuf\",\"t_us\":%" PRId64 ",\"window_us\":%" PRId64 ","
+            "\"allocs\":%" PRIu32 ",\"failures\":%" PRIu32 "}\n",
+            now, window_us, allocs.allocs, allocs.failures);
+    }
+}
+
+void
+hid_perf_print(void)
+{
+    hid_perf_dump(NULL);
+}
+
+void
+hid_perf_init(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = hid_perf_dump,
+        .name = "hid_perf"
+    };
+
+    Window_start_us = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &Dump_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(Dump_timer, CONFIG_HID_PERF_PERIOD_S * 1000000ULL));
+    ESP_LOGI(tag, "HID profiling, counters are printed every %d s", CONFIG_HID_PERF_PERIOD_S);
+}
+
+#endif
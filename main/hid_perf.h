@@ -0,0 +1,65 @@
+#ifndef H_HID_PERF_
+#define H_HID_PERF_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/*
+HID pipeline profiling, enabled by CONFIG_HID_PERF. Every probe counts calls
+and CPU cycles of one function, mbuf allocations of the TX path are counted
+too. Counters are printed as JSON lines every CONFIG_HID_PERF_PERIOD_S seconds,
+one object per probe, so logs can be compared between firmware builds.
+Cycle counters of two cores are not synchronized, task moved to the other core
+inside a probe spoils its cycles_max.
+*/
+
+enum hid_perf_probe {
+    HID_PERF_KEYBOARD,          // hid_keyboard_change_key
+    HID_PERF_MOUSE,             // hid_mouse_change_key
+    HID_PERF_CC,                // hid_cc_change_key
+    HID_PERF_READ_BUFFER,       // hid_read_buffer
+    HID_PERF_HID_ACCESS,        // hid_svr_chr_access
+    HID_PERF_REPORT_ACCESS,     // ble_svc_report_access
+    HID_PERF_TX_SEND,           // report notification in TX task
+    HID_PERF_PROBE_COUNT
+};
+
+#ifdef CONFIG_HID_PERF
+
+#include "xtensa/hal.h"
+
+struct hid_perf_scope {
+    enum hid_perf_probe probe;
+    uint32_t start;
+};
+
+extern void hid_perf_init(void);
+extern void hid_perf_record(enum hid_perf_probe probe, uint32_t cycles);
+extern void hid_perf_alloc(bool ok);
+/* prints counters now and starts a new period, for benchmarks which do not wait for the timer */
+extern void hid_perf_print(void);
+
+static inline void
+hid_perf_scope_end(struct hid_perf_scope *scope)
+{
+    hid_perf_record(scope->probe, xthal_get_ccount() - scope->start);
+}
+
+/* measures the rest of the enclosing block, every return included */
+#define HID_PERF_SCOPE(id) \
+    struct hid_perf_scope hid_perf_scope_ __attribute__((cleanup(hid_perf_scope_end))) = \
+        { .probe = (id), .start = xthal_get_ccount() }
+#define HID_PERF_ALLOC(ok) hid_perf_alloc(ok)
+
+#else
+
+#define hid_perf_init() do { } while (0)
+#define hid_perf_print() do { } while (0)
+#define HID_PERF_SCOPE(id) do { } while (0)
+#define HID_PERF_ALLOC(ok) do { } while (0)
+
+#endif
+
+#endif
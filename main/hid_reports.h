@@ -0,0 +1,234 @@
+#ifndef H_HID_REPORTS_
+#define H_HID_REPORTS_
+
+/*
+HID report schema. Every report of the HID service is declared once here, the
+report map bytes, report IDs, report sizes, ATT handle indexes, report
+characteristics and their report reference values are generated from it, so
+they can not drift apart.
+
+HID_COLLECTIONS(X) lists top level collections of the report map in map order,
+X(collection, report_id). Descriptor of each one is HID_DESC_<collection>(B, M):
+B() are bytes of global and local items, M(type, size, count, flags) is a main
+item with its report size and count. Report sizes are sums of report size *
+report count of main items, so they follow every change of the descriptor.
+
+HID_REPORTS(X) lists reports, X(report, collection, type): report ID is the one
+of its collection, type is INPUT, OUTPUT or FEATURE. Report characteristics go
+in this order, the boot characteristics sit between HID_REPORTS_BEFORE_BOOT and
+HID_REPORTS_AFTER_BOOT. Bonded hosts cache ATT handles and get no Service
+Changed indication, so existing characteristics must not move: new reports go
+to the end of HID_REPORTS_AFTER_BOOT.
+*/
+
+// HID Report types
+#define HID_REPORT_TYPE_INPUT           1
+#define HID_REPORT_TYPE_OUTPUT          2
+#define HID_REPORT_TYPE_FEATURE         3
+
+// Wheel and pan steps in one notch when host has enabled high resolution
+#define HID_MOUSE_RES_MULTIPLIER        120
+
+#define HID_COLLECTIONS(X)  \
+    X(MOUSE,    1)          \
+    X(KEYBOARD, 2)          \
+    X(CC,       3)          \
+    X(VENDOR,   4)          \
+    X(NKRO,     5)
+
+#define HID_REPORTS_BEFORE_BOOT(X)              \
+    X(MOUSE,            MOUSE,      INPUT)      \
+    X(KB_IN,            KEYBOARD,   INPUT)      \
+    X(KB_OUT,           KEYBOARD,   OUTPUT)     \
+    X(CC,               CC,         INPUT)
+
+#define HID_REPORTS_AFTER_BOOT(X)               \
+    X(FEATURE,          VENDOR,     FEATURE)    \
+    X(NKRO,             NKRO,       INPUT)      \
+    X(MOUSE_FEATURE,    MOUSE,      FEATURE)
+
+#define HID_REPORTS(X) HID_REPORTS_BEFORE_BOOT(X) HID_REPORTS_AFTER_BOOT(X)
+
+/* main item tags */
+#define HID_MAIN_INPUT                  0x81
+#define HID_MAIN_OUTPUT                 0x91
+#define HID_MAIN_FEATURE                0xB1
+
+/* mouse: buttons, 16-bit X, Y, wheel and pan, feature with wheel and pan resolution multipliers */
+#define HID_DESC_MOUSE(B, M)                                                    \
+    B(0x05, 0x01)           /* Usage Page (Generic Desktop) */                  \
+    B(0x09, 0x02)           /* Usage (Mouse) */                                 \
+    B(0xA1, 0x01)           /* Collection (Application) */                      \
+    B(0x85, HID_RPT_ID_MOUSE)   /* Report Id */                                 \
+    B(0x09, 0x01)           /*   Usage (Pointer) */                             \
+    B(0xA1, 0x00)           /*   Collection (Physical) */                       \
+    B(0x05, 0x09)           /*     Usage Page (Buttons) */                      \
+    B(0x19, 0x01)           /*     Usage Minimum (01) - Button 1 */             \
+    B(0x29, 0x03)           /*     Usage Maximum (03) - Button 3 */             \
+    B(0x15, 0x00)           /*     Logical Minimum (0) */                       \
+    B(0x25, 0x01)           /*     Logical Maximum (1) */                       \
+    M(INPUT, 1, 3, 0x02)    /*     Input (Data, Variable, Absolute) - Button states */ \
+    M(INPUT, 5, 1, 0x01)    /*     Input (Constant) - Padding or Reserved bits */ \
+    B(0x05, 0x01)           /*     Usage Page (Generic Desktop) */              \
+    B(0x09, 0x30)           /*     Usage (X) */                                 \
+    B(0x09, 0x31)           /*     Usage (Y) */                                 \
+    B(0x16, 0x01, 0x80)     /*     Logical Minimum (-32767) */                  \
+    B(0x26, 0xFF, 0x7F)     /*     Logical Maximum (32767) */                   \
+    M(INPUT, 16, 2, 0x06)   /*     Input (Data, Variable, Relative) - X, Y */   \
+    /* wheel and its resolution multiplier, host sets it to 1 for high resolution */ \
+    B(0xA1, 0x02)           /*     Collection (Logical) */                      \
+    B(0x09, 0x48)           /*       Usage (Resolution Multiplier) */           \
+    B(0x15, 0x00)           /*       Logical Minimum (0) */                     \
+    B(0x25, 0x01)           /*       Logical Maximum (1) */                     \
+    B(0x35, 0x01)           /*       Physical Minimum (1) */                    \
+    B(0x45, HID_MOUSE_RES_MULTIPLIER)   /* Physical Maximum (120) */            \
+    M(FEATURE, 2, 1, 0x02)  /*       Feature (Data, Variable, Absolute) - wheel multiplier */ \
+    B(0x35, 0x00)           /*       Physical Minimum (0) */                    \
+    B(0x45, 0x00)           /*       Physical Maximum (0) */                    \
+    B(0x09, 0x38)           /*       Usage (Wheel) */                           \
+    B(0x16, 0x01, 0x80)     /*       Logical Minimum (-32767) */                \
+    B(0x26, 0xFF, 0x7F)     /*       Logical Maximum (32767) */                 \
+    M(INPUT, 16, 1, 0x06)   /*       Input (Data, Variable, Relative) - wheel */ \
+    B(0xC0)                 /*     End Collection */                            \
+    /* horizontal pan and its resolution multiplier */                          \
+    B(0xA1, 0x02)           /*     Collection (Logical) */                      \
+    B(0x09, 0x48)           /*       Usage (Resolution Multiplier) */           \
+    B(0x15, 0x00)           /*       Logical Minimum (0) */                     \
+    B(0x25, 0x01)           /*       Logical Maximum (1) */                     \
+    B(0x35, 0x01)           /*       Physical Minimum (1) */                    \
+    B(0x45, HID_MOUSE_RES_MULTIPLIER)   /* Physical Maximum (120) */            \
+    M(FEATURE, 2, 1, 0x02)  /*       Feature (Data, Variable, Absolute) - pan multiplier */ \
+    B(0x35, 0x00)           /*       Physical Minimum (0) */                    \
+    B(0x45, 0x00)           /*       Physical Maximum (0) */                    \
+    B(0x05, 0x0C)           /*       Usage Page (Consumer Devices) */           \
+    B(0x0A, 0x38, 0x02)     /*       Usage (AC Pan) */                          \
+    B(0x16, 0x01, 0x80)     /*       Logical Minimum (-32767) */                \
+    B(0x26, 0xFF, 0x7F)     /*       Logical Maximum (32767) */                 \
+    M(INPUT, 16, 1, 0x06)   /*       Input (Data, Variable, Relative) - pan */  \
+    B(0xC0)                 /*     End Collection */                            \
+    M(FEATURE, 4, 1, 0x01)  /*     Feature (Constant) - padding of multipliers byte */ \
+    B(0xC0)                 /*   End Collection */                              \
+    B(0xC0)                 /* End Collection */
+
+/* keyboard: modifiers, reserved byte, 6 key codes, LEDs output */
+#define HID_DESC_KEYBOARD(B, M)                                                 \
+    B(0x05, 0x01)           /* Usage Pg (Generic Desktop) */                    \
+    B(0x09, 0x06)           /* Usage (Keyboard) */                              \
+    B(0xA1, 0x01)           /* Collection: (Application) */                     \
+    B(0x85, HID_RPT_ID_KEYBOARD)    /* Report Id */                             \
+    B(0x05, 0x07)           /*   Usage Pg (Key Codes) */                        \
+    B(0x19, 0xE0)           /*   Usage Min (224) */                             \
+    B(0x29, 0xE7)           /*   Usage Max (231) */                             \
+    B(0x15, 0x00)           /*   Log Min (0) */                                 \
+    B(0x25, 0x01)           /*   Log Max (1) */                                 \
+    M(INPUT, 1, 8, 0x02)    /*   Input: (Data, Variable, Absolute) - modifier byte */ \
+    M(INPUT, 8, 1, 0x01)    /*   Input: (Constant) - reserved byte */           \
+    B(0x05, 0x08)           /*   Usage Pg (LEDs) */                             \
+    B(0x19, 0x01)           /*   Usage Min (1) */                               \
+    B(0x29, 0x05)           /*   Usage Max (5) */                               \
+    M(OUTPUT, 1, 5, 0x02)   /*   Output: (Data, Variable, Absolute) - LED report */ \
+    M(OUTPUT, 3, 1, 0x01)   /*   Output: (Constant) - LED report padding */     \
+    B(0x15, 0x00)           /*   Log Min (0) */                                 \
+    B(0x25, 0x65)           /*   Log Max (101) */                               \
+    B(0x05, 0x07)           /*   Usage Pg (Key Codes) */                        \
+    B(0x19, 0x00)           /*   Usage Min (0) */                               \
+    B(0x29, 0x65)           /*   Usage Max (101) */                             \
+    M(INPUT, 8, 6, 0x00)    /*   Input: (Data, Array) - key arrays (6 bytes) */ \
+    B(0xC0)                 /* End Collection */
+
+/* consumer control: array of HIDD_LE_REPORT_CC_SIZE / 2 pressed usages, 16-bit, 0 is empty slot.
+   Usages defined in the Consumer page of HUT end well below HID_CC_USAGE_MAX. It is not 0xFFFF:
+   Linux rejects report maps which declare more than HID_MAX_USAGES (12288) usages. */
+#define HID_CC_USAGE_MAX                0x0FFF
+
+#define HID_DESC_CC(B, M)                                                       \
+    B(0x05, 0x0C)           /* Usage Pg (Consumer Devices) */                   \
+    B(0x09, 0x01)           /* Usage (Consumer Control) */                      \
+    B(0xA1, 0x01)           /* Collection (Application) */                      \
+    B(0x85, HID_RPT_ID_CC)  /* Report Id */                                     \
+    B(0x19, 0x00)           /*   Usage Min (0) */                               \
+    B(0x2A, HID_CC_USAGE_MAX & 0xFF, HID_CC_USAGE_MAX >> 8) /* Usage Max */     \
+    B(0x15, 0x00)           /*   Logical Min (0) */                             \
+    B(0x26, HID_CC_USAGE_MAX & 0xFF, HID_CC_USAGE_MAX >> 8) /* Logical Max */   \
+    M(INPUT, 16, 2, 0x00)   /*   Input (Data, Ary, Abs) - two usages */         \
+    B(0xC0)                 /* End Collection */
+
+/* vendor defined feature report with custom data of this device */
+#define HID_DESC_VENDOR(B, M)                                                   \
+    B(0x06, 0x00, 0xFF)     /* Usage Page (Vendor Defined 0xFF00) */            \
+    B(0x09, 0x01)           /* Usage (Vendor Usage 1) */                        \
+    B(0xA1, 0x01)           /* Collection (Application) */                      \
+    B(0x85, HID_RPT_ID_VENDOR)  /* Report Id */                                 \
+    B(0x09, 0x01)           /*   Usage (Vendor Usage 1) */                      \
+    B(0x15, 0x00)           /*   Logical Minimum (0) */                         \
+    B(0x26, 0xFF, 0x00)     /*   Logical Maximum (255) */                       \
+    M(FEATURE, 8, 6, 0x02)  /*   Feature (Data, Variable, Absolute) */          \
+    B(0xC0)                 /* End Collection */
+
+/* N-key rollover keyboard: bitmap of all keys, modifiers are usages 0xE0 to 0xE7 */
+#define HID_DESC_NKRO(B, M)                                                     \
+    B(0x05, 0x01)           /* Usage Pg (Generic Desktop) */                    \
+    B(0x09, 0x06)           /* Usage (Keyboard) */                              \
+    B(0xA1, 0x01)           /* Collection: (Application) */                     \
+    B(0x85, HID_RPT_ID_NKRO)    /* Report Id */                                 \
+    B(0x05, 0x07)           /*   Usage Pg (Key Codes) */                        \
+    B(0x19, 0x00)           /*   Usage Min (0) */                               \
+    B(0x29, 0xE7)           /*   Usage Max (231) */                             \
+    B(0x15, 0x00)           /*   Log Min (0) */                                 \
+    B(0x25, 0x01)           /*   Log Max (1) */                                 \
+    M(INPUT, 1, HIDD_LE_REPORT_NKRO_KEYS, 0x02) /* Input: (Data, Variable, Absolute) */ \
+    B(0xC0)                 /* End Collection */
+
+// N-key rollover keyboard bitmap, usages 0x00 to 0xE7
+#define HIDD_LE_REPORT_NKRO_KEYS        (0xE8)
+
+/* report IDs of collections: HID_RPT_ID_MOUSE, HID_RPT_ID_KEYBOARD, ... */
+#define HID_RPT_ID_ENTRY(coll, id) HID_RPT_ID_##coll = (id),
+enum hid_report_id {
+    HID_COLLECTIONS(HID_RPT_ID_ENTRY)
+};
+
+/* report map bytes */
+#define HID_MAP_BYTES(...) __VA_ARGS__,
+#define HID_MAP_MAIN(type, size, count, flags) 0x75, (size), 0x95, (count), HID_MAIN_##type, (flags),
+#define HID_MAP_COLLECTION(coll, id) HID_DESC_##coll(HID_MAP_BYTES, HID_MAP_MAIN)
+#define HID_REPORT_MAP_BYTES HID_COLLECTIONS(HID_MAP_COLLECTION)
+
+/* bits of one report type in collection */
+#define HID_SKIP_BYTES(...)
+#define HID_BITS_INPUT_INPUT(bits)      + (bits)
+#define HID_BITS_INPUT_OUTPUT(bits)
+#define HID_BITS_INPUT_FEATURE(bits)
+#define HID_BITS_OUTPUT_INPUT(bits)
+#define HID_BITS_OUTPUT_OUTPUT(bits)    + (bits)
+#define HID_BITS_OUTPUT_FEATURE(bits)
+#define HID_BITS_FEATURE_INPUT(bits)
+#define HID_BITS_FEATURE_OUTPUT(bits)
+#define HID_BITS_FEATURE_FEATURE(bits)  + (bits)
+#define HID_BITS_MAIN_INPUT(type, size, count, flags)   HID_BITS_INPUT_##type((size) * (count))
+#define HID_BITS_MAIN_OUTPUT(type, size, count, flags)  HID_BITS_OUTPUT_##type((size) * (count))
+#define HID_BITS_MAIN_FEATURE(type, size, count, flags) HID_BITS_FEATURE_##type((size) * (count))
+#define HID_REPORT_BITS(coll, type) (0 HID_DESC_##coll(HID_SKIP_BYTES, HID_BITS_MAIN_##type))
+
+/* report sizes in bytes: HIDD_LE_REPORT_MOUSE_SIZE, HIDD_LE_REPORT_KB_IN_SIZE, ... */
+#define HID_REPORT_SIZE_ENTRY(report, coll, type) \
+    HIDD_LE_REPORT_##report##_SIZE = HID_REPORT_BITS(coll, type) / 8,
+enum hid_report_size {
+    HID_REPORTS(HID_REPORT_SIZE_ENTRY)
+};
+
+#define HID_REPORT_SIZE_CHECK(report, coll, type) \
+    _Static_assert(HID_REPORT_BITS(coll, type) > 0 && HID_REPORT_BITS(coll, type) % 8 == 0, \
+                   #report " report must be whole bytes");
+HID_REPORTS(HID_REPORT_SIZE_CHECK)
+
+/* report characteristic handle indexes, part of enum attr_handles */
+#define HID_REPORT_HANDLE_ENTRY(report, coll, type) HANDLE_HID_##report##_REPORT,
+#define HID_REPORT_HANDLES HID_REPORTS(HID_REPORT_HANDLE_ENTRY)
+
+/* report reference descriptor values, indexed by enum attr_handles */
+#define HID_REPORT_REF_ENTRY(report, coll, type) \
+    [HANDLE_HID_##report##_REPORT] = { HID_RPT_ID_##coll, HID_REPORT_TYPE_##type },
+#define HID_REPORT_REFS HID_REPORTS(HID_REPORT_REF_ENTRY)
+
+#endif
@@ -0,0 +1,263 @@
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "hid_tx.h"
+
+static const char *tag = "NimBLEKBD_HIDTX";
+
+#define HID_TX_QUEUE_MASK (HID_TX_QUEUE_SIZE - 1)
+
+_Static_assert((HID_TX_QUEUE_SIZE & HID_TX_QUEUE_MASK) == 0, "HID_TX_QUEUE_SIZE must be a power of 2");
+
+/* wait before retry when stack had no memory, in ticks */
+#define HID_TX_RETRY_TICKS 1
+
+/*
+Bounded MPSC queue (D. Vyukov's algorithm): every cell has sequence number,
+producers claim position with CAS and publish the cell by its sequence,
+so producers never wait for each other and never take a lock.
+*/
+static struct hid_tx_cell {
+    atomic_uint seq;
+    struct hid_tx_entry entry;
+} Tx_cells[HID_TX_QUEUE_SIZE];
+
+static struct hid_tx {
+    atomic_uint enqueue_pos;
+    unsigned dequeue_pos;       // TX task only
+    atomic_uint dequeued;       // dequeue_pos for other tasks
+    atomic_int credits;         // notifications which can be sent before NOTIFY_TX
+    atomic_uint resync;         // bitmask of reports which latest state must be sent
+    TaskHandle_t task;
+    hid_tx_send_t send;
+    hid_tx_resync_t resync_cb;
+    bool idle;                  // nothing in flight and nothing queued behind entry being sent
+    bool send_completed;        // NOTIFY_TX of entry being sent has come inside the send call
+    // statistics
+    uint32_t sent;
+    uint32_t retries;
+    uint32_t dropped;
+    uint32_t waits;
+    atomic_uint overflows;
+} Tx;
+
+bool
+hid_tx_submit(const struct hid_tx_entry *entry)
+{
+    unsigned pos = atomic_load_explicit(&Tx.enqueue_pos, memory_order_relaxed);
+    struct hid_tx_cell *cell;
+
+    for (;;) {
+        cell = &Tx_cells[pos & HID_TX_QUEUE_MASK];
+        unsigned seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&Tx.enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // full, the latest state of this report will be sent when queue is drained
+            atomic_fetch_or_explicit(&Tx.resync, 1UL << entry->report, memory_order_relaxed);
+            atomic_fetch_add_explicit(&Tx.overflows, 1, memory_order_relaxed);
+            xTaskNotifyGive(Tx.task);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&Tx.enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->entry = *entry;
+    // release: publish entry data before the cell sequence
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    xTaskNotifyGive(Tx.task);
+    return true;
+}
+
+/* oldest entry or NULL, it stays in queue until tx_pop() */
+static struct hid_tx_entry *
+tx_peek(void)
+{
+    struct hid_tx_cell *cell = &Tx_cells[Tx.dequeue_pos & HID_TX_QUEUE_MASK];
+    unsigned seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+    if (seq != Tx.dequeue_pos + 1) {
+        return NULL;
+    }
+    return &cell->entry;
+}
+
+/* true if one more entry is waiting behind the oldest one */
+static bool
+tx_peek_next(void)
+{
+    unsigned pos = Tx.dequeue_pos + 1;
+    struct hid_tx_cell *cell = &Tx_cells[pos & HID_TX_QUEUE_MASK];
+
+    return atomic_load_explicit(&cell->seq, memory_order_acquire) == pos + 1;
+}
+
+static void
+tx_pop(void)
+{
+    struct hid_tx_cell *cell = &Tx_cells[Tx.dequeue_pos & HID_TX_QUEUE_MASK];
+
+    // release: entry is read, cell can be reused by producers
+    atomic_store_explicit(&cell->seq, Tx.dequeue_pos + HID_TX_QUEUE_SIZE, memory_order_release);
+    Tx.dequeue_pos++;
+    atomic_store_explicit(&Tx.dequeued, Tx.dequeue_pos, memory_order_relaxed);
+}
+
+/* sends while there are credits, returns true if entry must be retried later */
+static bool
+tx_run(void)
+{
+    for (;;) {
+        struct hid_tx_entry *entry = tx_peek();
+
+        if (!entry) {
+            unsigned resync = atomic_exchange_explicit(&Tx.resync, 0, memory_order_relaxed);
+
+            if (!resync) {
+                return false;
+            }
+            while (resync) {
+                Tx.resync_cb(__builtin_ctz(resync));
+                resync &= resync - 1;
+            }
+            continue;
+        }
+
+        int credits = atomic_fetch_sub_explicit(&Tx.credits, 1, memory_order_acquire);
+
+        if (credits <= 0) {
+            // all credits are in flight, NOTIFY_TX will wake us up
+            atomic_fetch_add_explicit(&Tx.credits, 1, memory_order_relaxed);
+            return false;
+        }
+        Tx.idle = credits >= CONFIG_HID_TX_CREDITS && !tx_peek_next();
+        Tx.send_completed = false;
+
+        int rc = Tx.send(entry);
+
+        if (rc == 0) {
+            Tx.sent++;
+        } else {
+            // NimBLE reports failed sends with NOTIFY_TX before returning, the credit is back then
+            if (!Tx.send_completed) {
+                atomic_fetch_add_explicit(&Tx.credits, 1, memory_order_relaxed);
+            }
+            if (rc == HID_TX_RETRY) {
+                Tx.retries++;
+                return true;
+            }
+            if (rc == HID_TX_WAIT) {
+                // order of reports is kept, the queue waits for the confirmation
+                Tx.waits++;
+                return false;
+            }
+            Tx.dropped++;
+        }
+        tx_pop();
+    }
+}
+
+static void
+hid_tx_task(void *param)
+{
+    (void)param;
+    bool retry = false;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, retry ? HID_TX_RETRY_TICKS : portMAX_DELAY);
+        retry = tx_run();
+    }
+}
+
+void
+hid_tx_init(hid_tx_send_t send, hid_tx_resync_t resync)
+{
+    for (unsigned i = 0; i < HID_TX_QUEUE_SIZE; ++i) {
+        atomic_init(&Tx_cells[i].seq, i);
+    }
+    atomic_init(&Tx.enqueue_pos, 0);
+    atomic_init(&Tx.credits, CONFIG_HID_TX_CREDITS);
+    atomic_init(&Tx.resync, 0);
+    atomic_init(&Tx.dequeued, 0);
+    atomic_init(&Tx.overflows, 0);
+    Tx.dequeue_pos = 0;
+    Tx.send = send;
+    Tx.resync_cb = resync;
+
+    if (xTaskCreate(hid_tx_task, "hid_tx_task", 3072, NULL, 9, &Tx.task) != pdPASS) {
+        ESP_LOGE(tag, "Can not create hid_tx_task!");
+        vTaskDelay(pdMS_TO_TICKS(30000));
+        esp_restart();
+    }
+}
+
+bool
+hid_tx_idle(void)
+{
+    return Tx.idle;
+}
+
+int
+hid_tx_credits(void)
+{
+    return atomic_load_explicit(&Tx.credits, memory_order_relaxed);
+}
+
+bool
+hid_tx_busy(void)
+{
+    return atomic_load_explicit(&Tx.credits, memory_order_relaxed) < CONFIG_HID_TX_CREDITS ||
+        atomic_load_explicit(&Tx.enqueue_pos, memory_order_relaxed) !=
+        atomic_load_explicit(&Tx.dequeued, memory_order_relaxed);
+}
+
+void
+hid_tx_reset(void)
+{
+    atomic_store_explicit(&Tx.credits, CONFIG_HID_TX_CREDITS, memory_order_release);
+    xTaskNotifyGive(Tx.task);
+}
+
+void
+hid_tx_completed(bool indication, int status)
+{
+    // indication keeps its credit until confirmation (status is not 0 then)
+    if (indication && status == 0) {
+        return;
+    }
+    if (atomic_fetch_add_explicit(&Tx.credits, 1, memory_order_release) >= CONFIG_HID_TX_CREDITS) {
+        // late completion of previous connection
+        atomic_fetch_sub_explicit(&Tx.credits, 1, memory_order_relaxed);
+    }
+    if (xTaskGetCurrentTaskHandle() == Tx.task) {
+        // called by the stack inside the send call of tx_run()
+        Tx.send_completed = true;
+    }
+    xTaskNotifyGive(Tx.task);
+}
+
+void
+hid_tx_wake(void)
+{
+    xTaskNotifyGive(Tx.task);
+}
+
+void
+hid_tx_log_stats(void)
+{
+    ESP_LOGI(tag, "sent %u, retries %u, dropped %u, waits for confirmation %u, queue overflows %u, credits %d",
+        Tx.sent, Tx.retries, Tx.dropped, Tx.waits,
+        atomic_load_explicit(&Tx.overflows, memory_order_relaxed), hid_tx_credits());
+}
@@ -0,0 +1,66 @@
+#ifndef H_HID_TX_
+#define H_HID_TX_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+HID notification TX stage. Report producers (app_main, coalescer timer, BLE host)
+submit report snapshots through a lock-free multi-producer queue, one TX task
+sends them in order. Number of notifications in flight is limited by credits,
+credits come back with BLE_GAP_EVENT_NOTIFY_TX. When stack has no memory,
+the entry is kept and retried, so release reports are never lost. When queue
+overflows, the latest state of the report is sent after the queue is drained.
+ATT allows one indication in flight per connection, an indication behind an
+unconfirmed one holds the queue until it is confirmed.
+*/
+
+/* number of queue slots, must be a power of 2 */
+#define HID_TX_QUEUE_SIZE 32
+/* the biggest report data in the entry */
+#define HID_TX_DATA_MAX 32
+
+struct hid_tx_entry {
+    uint16_t conn_handle;
+    uint8_t report;             // report index, passed back to send and resync callbacks
+    uint8_t len;
+    bool traced;                // latency trace follows this entry
+    uint8_t data[HID_TX_DATA_MAX];
+};
+
+/* send callback results besides 0 (sent, one credit is used) */
+#define HID_TX_RETRY 1          // no memory in stack, try the same entry later
+#define HID_TX_DROP  2          // can not be sent (no connection, no subscription)
+#define HID_TX_WAIT  3          // previous indication of the connection is not confirmed, entry waits for NOTIFY_TX
+
+/* sends entry to the stack, called from TX task only */
+typedef int (*hid_tx_send_t)(const struct hid_tx_entry *entry);
+/* submits the latest state of the report after queue overflow */
+typedef void (*hid_tx_resync_t)(int report);
+
+extern void hid_tx_init(hid_tx_send_t send, hid_tx_resync_t resync);
+
+/* called from send callback: true if entry being sent is the only one in flight and in queue */
+extern bool hid_tx_idle(void);
+
+/* any task: true while notifications are queued, being sent or in flight */
+extern bool hid_tx_busy(void);
+
+/* any task: credits not in flight, never more than CONFIG_HID_TX_CREDITS */
+extern int hid_tx_credits(void);
+
+/* new connection, all credits are available again */
+extern void hid_tx_reset(void);
+
+/* non-blocking, returns false if queue is full, then report will be resynced */
+extern bool hid_tx_submit(const struct hid_tx_entry *entry);
+
+/* called for BLE_GAP_EVENT_NOTIFY_TX, also when the stack raises it inside the send callback */
+extern void hid_tx_completed(bool indication, int status);
+
+/* entry held by HID_TX_WAIT can be sent now */
+extern void hid_tx_wake(void);
+
+extern void hid_tx_log_stats(void);
+
+#endif
@@ -0,0 +1,421 @@
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+
+#include "hid_codes.h"
+#include "hid_func.h"
+#include "hid_typing.h"
+
+static const char *tag = "NimBLEKBD_TYPING";
+
+/* keys are released when no text comes for this time */
+#define TYPING_IDLE_MS 20
+/* the longest wait for coalescer flush, guards against lost wakeup */
+#define TYPING_FLUSH_WAIT_MS 50
+/* text taken from stream buffer at once */
+#define TYPING_CHUNK_SIZE 64
+
+/* modifier bits as in keyboard report byte 0 */
+#define TYPING_SHIFT (1 << (HID_KEY_LEFT_SHIFT - HID_KEY_LEFT_CTRL))
+#define TYPING_ALTGR (1 << (HID_KEY_RIGHT_ALT - HID_KEY_LEFT_CTRL))
+
+/* printable ASCII, every layout table has entry for each of them */
+#define TYPING_ASCII_FIRST 0x20
+#define TYPING_ASCII_LAST  0x7E
+#define TYPING_ASCII_COUNT (TYPING_ASCII_LAST - TYPING_ASCII_FIRST + 1)
+
+struct typing_key {
+    uint8_t usage;              // 0 - character can not be typed
+    uint8_t mods;
+    bool dead;                  // dead key, space is typed after it to get the character itself
+};
+
+/* character outside of printable ASCII */
+struct typing_char {
+    uint32_t code_point;
+    struct typing_key key;
+};
+
+#define C(ch)   [(ch) - TYPING_ASCII_FIRST]
+#define K(key)  { .usage = HID_KEY_##key }
+#define S(key)  { .usage = HID_KEY_##key, .mods = TYPING_SHIFT }
+#define G(key)  { .usage = HID_KEY_##key, .mods = TYPING_ALTGR }
+#define KD(key) { .usage = HID_KEY_##key, .dead = true }
+#define SD(key) { .usage = HID_KEY_##key, .mods = TYPING_SHIFT, .dead = true }
+#define GD(key) { .usage = HID_KEY_##key, .mods = TYPING_ALTGR, .dead = true }
+/* letter and its capital on the key */
+#define L(ch, key) C(ch) = K(key), C((ch) - 'a' + 'A') = S(key)
+
+static const struct typing_key Ascii_us[TYPING_ASCII_COUNT] = {
+    C(' ') = K(SPACEBAR),
+    C('!') = S(1),          C('"') = S(SGL_QUOTE),  C('#') = S(3),          C('$') = S(4),
+    C('%') = S(5),          C('&') = S(7),          C('\'') = K(SGL_QUOTE), C('(') = S(9),
+    C(')') = S(0),          C('*') = S(8),          C('+') = S(EQUAL),      C(',') = K(COMMA),
+    C('-') = K(MINUS),      C('.') = K(DOT),        C('/') = K(FWD_SLASH),
+    C('0') = K(0), C('1') = K(1), C('2') = K(2), C('3') = K(3), C('4') = K(4),
+    C('5') = K(5), C('6') = K(6), C('7') = K(7), C('8') = K(8), C('9') = K(9),
+    C(':') = S(SEMI_COLON), C(';') = K(SEMI_COLON), C('<') = S(COMMA),      C('=') = K(EQUAL),
+    C('>') = S(DOT),        C('?') = S(FWD_SLASH),  C('@') = S(2),
+    L('a', A), L('b', B), L('c', C), L('d', D), L('e', E), L('f', F), L('g', G),
+    L('h', H), L('i', I), L('j', J), L('k', K), L('l', L), L('m', M), L('n', N),
+    L('o', O), L('p', P), L('q', Q), L('r', R), L('s', S), L('t', T), L('u', U),
+    L('v', V), L('w', W), L('x', X), L('y', Y), L('z', Z),
+    C('[') = K(LEFT_BRKT),  C('\\') = K(BACK_SLASH), C(']') = K(RIGHT_BRKT), C('^') = S(6),
+    C('_') = S(MINUS),      C('`') = K(GRV_ACCENT), C('{') = S(LEFT_BRKT),  C('|') = S(BACK_SLASH),
+    C('}') = S(RIGHT_BRKT), C('~') = S(GRV_ACCENT),
+};
+
+/* German QWERTZ (T1) */
+static const struct typing_key Ascii_de[TYPING_ASCII_COUNT] = {
+    C(' ') = K(SPACEBAR),
+    C('!') = S(1),          C('"') = S(2),          C('#') = K(NON_US_HASH), C('$') = S(4),
+    C('%') = S(5),          C('&') = S(6),          C('\'') = S(NON_US_HASH), C('(') = S(8),
+    C(')') = S(9),          C('*') = S(RIGHT_BRKT), C('+') = K(RIGHT_BRKT), C(',') = K(COMMA),
+    C('-') = K(FWD_SLASH),  C('.') = K(DOT),        C('/') = S(7),
+    C('0') = K(0), C('1') = K(1), C('2') = K(2), C('3') = K(3), C('4') = K(4),
+    C('5') = K(5), C('6') = K(6), C('7') = K(7), C('8') = K(8), C('9') = K(9),
+    C(':') = S(DOT),        C(';') = S(COMMA),      C('<') = K(NON_US_BSLASH), C('=') = S(0),
+    C('>') = S(NON_US_BSLASH), C('?') = S(MINUS),   C('@') = G(Q),
+    L('a', A), L('b', B), L('c', C), L('d', D), L('e', E), L('f', F), L('g', G),
+    L('h', H), L('i', I), L('j', J), L('k', K), L('l', L), L('m', M), L('n', N),
+    L('o', O), L('p', P), L('q', Q), L('r', R), L('s', S), L('t', T), L('u', U),
+    L('v', V), L('w', W), L('x', X), L('y', Z), L('z', Y),
+    C('[') = G(8),          C('\\') = G(MINUS),     C(']') = G(9),          C('^') = KD(GRV_ACCENT),
+    C('_') = S(FWD_SLASH),  C('`') = SD(EQUAL),     C('{') = G(7),          C('|') = G(NON_US_BSLASH),
+    C('}') = G(0),          C('~') = G(RIGHT_BRKT),
+};
+
+static const struct typing_char Extra_de[] = {
+    { 0x00E4, K(SGL_QUOTE) },       // a umlaut
+    { 0x00C4, S(SGL_QUOTE) },
+    { 0x00F6, K(SEMI_COLON) },      // o umlaut
+    { 0x00D6, S(SEMI_COLON) },
+    { 0x00FC, K(LEFT_BRKT) },       // u umlaut
+    { 0x00DC, S(LEFT_BRKT) },
+    { 0x00DF, K(MINUS) },           // sharp s
+    { 0x00A7, S(3) },               // section sign
+    { 0x00B0, S(GRV_ACCENT) },      // degree sign
+    { 0x00B4, KD(EQUAL) },          // acute accent
+    { 0x00B2, G(2) },               // superscript two
+    { 0x00B3, G(3) },               // superscript three
+    { 0x00B5, G(M) },               // micro sign
+    { 0x20AC, G(E) },               // euro sign
+};
+
+/* French AZERTY, Windows variant */
+static const struct typing_key Ascii_fr[TYPING_ASCII_COUNT] = {
+    C(' ') = K(SPACEBAR),
+    C('!') = K(FWD_SLASH),  C('"') = K(3),          C('#') = G(3),          C('$') = K(RIGHT_BRKT),
+    C('%') = S(SGL_QUOTE),  C('&') = K(1),          C('\'') = K(4),         C('(') = K(5),
+    C(')') = K(MINUS),      C('*') = K(NON_US_HASH), C('+') = S(EQUAL),     C(',') = K(M),
+    C('-') = K(6),          C('.') = S(COMMA),      C('/') = S(DOT),
+    C('0') = S(0), C('1') = S(1), C('2') = S(2), C('3') = S(3), C('4') = S(4),
+    C('5') = S(5), C('6') = S(6), C('7') = S(7), C('8') = S(8), C('9') = S(9),
+    C(':') = K(DOT),        C(';') = K(COMMA),      C('<') = K(NON_US_BSLASH), C('=') = K(EQUAL),
+    C('>') = S(NON_US_BSLASH), C('?') = S(M),       C('@') = G(0),
+    L('a', Q), L('b', B), L('c', C), L('d', D), L('e', E), L('f', F), L('g', G),
+    L('h', H), L('i', I), L('j', J), L('k', K), L('l', L), L('m', SEMI_COLON), L('n', N),
+    L('o', O), L('p', P), L('q', A), L('r', R), L('s', S), L('t', T), L('u', U),
+    L('v', V), L('w', Z), L('x', X), L('y', Y), L('z', W),
+    C('[') = G(5),          C('\\') = G(8),         C(']') = G(MINUS),      C('^') = G(9),
+    C('_') = K(8),          C('`') = GD(7),         C('{') = G(4),          C('|') = G(6),
+    C('}') = G(EQUAL),      C('~') = GD(2),
+};
+
+static const struct typing_char Extra_fr[] = {
+    { 0x00E9, K(2) },               // e acute
+    { 0x00E8, K(7) },               // e grave
+    { 0x00E7, K(9) },               // c cedilla
+    { 0x00E0, K(0) },               // a grave
+    { 0x00F9, K(SGL_QUOTE) },       // u grave
+    { 0x00B0, S(MINUS) },           // degree sign
+    { 0x00A8, SD(LEFT_BRKT) },      // diaeresis
+    { 0x00A3, S(RIGHT_BRKT) },      // pound sign
+    { 0x00A4, G(RIGHT_BRKT) },      // currency sign
+    { 0x00B5, S(NON_US_HASH) },     // micro sign
+    { 0x00A7, S(FWD_SLASH) },       // section sign
+    { 0x00B2, K(GRV_ACCENT) },      // superscript two
+    { 0x20AC, G(E) },               // euro sign
+};
+
+static const struct typing_layout {
+    const char *name;
+    const struct typing_key *ascii;
+    const struct typing_char *extra;
+    size_t extra_count;
+} Layouts[] = {
+    [HID_TYPING_LAYOUT_US] = { .name = "US", .ascii = Ascii_us },
+    [HID_TYPING_LAYOUT_DE] = { .name = "DE", .ascii = Ascii_de,
+        .extra = Extra_de, .extra_count = sizeof(Extra_de)/sizeof(Extra_de[0]) },
+    [HID_TYPING_LAYOUT_FR] = { .name = "FR", .ascii = Ascii_fr,
+        .extra = Extra_fr, .extra_count = sizeof(Extra_fr)/sizeof(Extra_fr[0]) },
+};
+
+_Static_assert(sizeof(Layouts)/sizeof(Layouts[0]) == HID_TYPING_LAYOUT_COUNT,
+    "every layout needs a table");
+_Static_assert(TYPING_SHIFT == 0x02 && TYPING_ALTGR == 0x40,
+    "modifier bits must match keyboard report");
+
+/* the same on every layout */
+static const struct typing_key Key_return = K(RETURN);
+static const struct typing_key Key_tab = K(TAB);
+static const struct typing_key Key_space = K(SPACEBAR);
+
+#if defined(CONFIG_TYPING_LAYOUT_DE)
+#define TYPING_DEFAULT_LAYOUT HID_TYPING_LAYOUT_DE
+#elif defined(CONFIG_TYPING_LAYOUT_FR)
+#define TYPING_DEFAULT_LAYOUT HID_TYPING_LAYOUT_FR
+#else
+#define TYPING_DEFAULT_LAYOUT HID_TYPING_LAYOUT_US
+#endif
+
+/* incremental UTF-8 decoder, sequence can be split between writes */
+struct utf8_decoder {
+    uint32_t code_point;
+    int need;                   // continuation bytes still expected
+};
+
+static struct typing {
+    StreamBufferHandle_t stream;
+    SemaphoreHandle_t write_lock;   // stream buffer allows only one writer at a time
+    SemaphoreHandle_t flushed;      // given after every coalescer flush
+    enum hid_typing_layout layout;
+    struct utf8_decoder utf8;
+    // keys pressed by typing task
+    uint8_t key;
+    uint8_t mods;
+    // statistics
+    uint32_t typed;
+    uint32_t unsupported;
+    uint32_t unsupported_logged;
+} Typing = {
+    .layout = TYPING_DEFAULT_LAYOUT,
+};
+
+/* returns true when code_point is complete, invalid sequences are skipped */
+static bool
+utf8_decode(struct utf8_decoder *dec, uint8_t byte, uint32_t *code_point)
+{
+    if (byte < 0x80) {
+        dec->need = 0;
+        *code_point = byte;
+        return true;
+    }
+    if ((byte & 0xC0) == 0x80) {
+        if (!dec->need) {
+            return false;
+        }
+        dec->code_point = (dec->code_point << 6) | (byte & 0x3F);
+        if (--dec->need) {
+            return false;
+        }
+        *code_point = dec->code_point;
+        return true;
+    }
+    if ((byte & 0xE0) == 0xC0) {
+        dec->code_point = byte & 0x1F;
+        dec->need = 1;
+    } else if ((byte & 0xF0) == 0xE0) {
+        dec->code_point = byte & 0x0F;
+        dec->need = 2;
+    } else if ((byte & 0xF8) == 0xF0) {
+        dec->code_point = byte & 0x07;
+        dec->need = 3;
+    } else {
+        dec->need = 0;
+    }
+    return false;
+}
+
+static const struct typing_key *
+typing_lookup(const struct typing_layout *layout, uint32_t code_point)
+{
+    if (code_point >= TYPING_ASCII_FIRST && code_point <= TYPING_ASCII_LAST) {
+        const struct typing_key *key = &layout->ascii[code_point - TYPING_ASCII_FIRST];
+
+        return key->usage ? key : NULL;
+    }
+    switch (code_point) {
+        case '\n':
+            return &Key_return;
+        case '\t':
+            return &Key_tab;
+    }
+    for (size_t i = 0; i < layout->extra_count; ++i) {
+        if (layout->extra[i].code_point == code_point) {
+            return &layout->extra[i].key;
+        }
+    }
+    return NULL;
+}
+
+static void
+typing_flushed(void)
+{
+    xSemaphoreGive(Typing.flushed);
+}
+
+/* one report per connection interval: wait while coalescer holds changes back */
+static void
+typing_pace(void)
+{
+    while (hid_flush_pending() && hid_conn_count()) {
+        xSemaphoreTake(Typing.flushed, pdMS_TO_TICKS(TYPING_FLUSH_WAIT_MS));
+    }
+}
+
+static void
+typing_set_mods(uint8_t mods)
+{
+    uint8_t change = Typing.mods ^ mods;
+
+    while (change) {
+        int bit = __builtin_ctz(change);
+
+        hid_keyboard_change_key(HID_KEY_LEFT_CTRL + bit, mods & (1 << bit));
+        change &= change - 1;
+    }
+    Typing.mods = mods;
+}
+
+static void
+typing_release_key(void)
+{
+    if (Typing.key) {
+        hid_keyboard_change_key(Typing.key, false);
+        Typing.key = 0;
+    }
+}
+
+/*
+Previous key is released, modifiers are changed and the new key is pressed
+together, coalescer sends it as one report.
+*/
+static void
+typing_stroke(const struct typing_key *key)
+{
+    if (Typing.key == key->usage) {
+        // central must see the key released before it is pressed again
+        typing_release_key();
+        typing_pace();
+    }
+    typing_release_key();
+    typing_set_mods(key->mods);
+    hid_keyboard_change_key(key->usage, true);
+    Typing.key = key->usage;
+    typing_pace();
+}
+
+static void
+typing_release_all(void)
+{
+    typing_release_key();
+    typing_set_mods(0);
+    ESP_LOGD(tag, "%u characters typed", Typing.typed);
+
+    if (Typing.unsupported != Typing.unsupported_logged) {
+        ESP_LOGW(tag, "%u characters can not be typed with %s layout",
+            Typing.unsupported - Typing.unsupported_logged, Layouts[Typing.layout].name);
+        Typing.unsupported_logged = Typing.unsupported;
+    }
+}
+
+static void
+typing_char(uint32_t code_point)
+{
+    const struct typing_key *key = typing_lookup(&Layouts[Typing.layout], code_point);
+
+    if (!key) {
+        // '\r' of CR LF line ends is not a mistake
+        if (code_point != '\r') {
+            Typing.unsupported++;
+        }
+        return;
+    }
+    typing_stroke(key);
+    if (key->dead) {
+        typing_stroke(&Key_space);
+    }
+    Typing.typed++;
+}
+
+static void
+hid_typing_task(void *param)
+{
+    (void)param;
+    uint8_t chunk[TYPING_CHUNK_SIZE];
+
+    for (;;) {
+        // keys are held while more text is coming, so chunks are typed without extra reports
+        size_t len = xStreamBufferReceive(Typing.stream, chunk, sizeof(chunk),
+            Typing.key || Typing.mods ? pdMS_TO_TICKS(TYPING_IDLE_MS) : portMAX_DELAY);
+
+        if (!len) {
+            typing_release_all();
+            continue;
+        }
+        for (size_t i = 0; i < len; ++i) {
+            uint32_t code_point;
+
+            if (utf8_decode(&Typing.utf8, chunk[i], &code_point)) {
+                typing_char(code_point);
+            }
+        }
+    }
+}
+
+void
+hid_typing_init(void)
+{
+    Typing.stream = xStreamBufferCreate(CONFIG_TYPING_BUFFER_SIZE, 1);
+    Typing.write_lock = xSemaphoreCreateMutex();
+    Typing.flushed = xSemaphoreCreateBinary();
+
+    if (!Typing.stream || !Typing.write_lock || !Typing.flushed ||
+        xTaskCreate(hid_typing_task, "hid_typing_task", 2048, NULL, 5, NULL) != pdPASS) {
+        ESP_LOGE(tag, "Can not create hid_typing_task!");
+        vTaskDelay(pdMS_TO_TICKS(30000));
+        esp_restart();
+    }
+
+    hid_set_flush_cb(typing_flushed);
+    ESP_LOGI(tag, "typing with %s layout", Layouts[Typing.layout].name);
+}
+
+size_t
+hid_typing_write(const char *text, size_t len)
+{
+    size_t written = 0;
+
+    xSemaphoreTake(Typing.write_lock, portMAX_DELAY);
+    // partial write would break the text in the middle of a line
+    if (xStreamBufferSpacesAvailable(Typing.stream) >= len) {
+        written = xStreamBufferSend(Typing.stream, text, len, 0);
+    }
+    xSemaphoreGive(Typing.write_lock);
+
+    return written;
+}
+
+size_t
+hid_typing_space(void)
+{
+    return xStreamBufferSpacesAvailable(Typing.stream);
+}
+
+int
+hid_typing_set_layout(enum hid_typing_layout layout)
+{
+    if (layout >= HID_TYPING_LAYOUT_COUNT) {
+        return 1;
+    }
+    Typing.layout = layout;
+    ESP_LOGI(tag, "typing with %s layout", Layouts[layout].name);
+    return 0;
+}
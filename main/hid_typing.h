@@ -0,0 +1,34 @@
+#ifndef H_HID_TYPING_
+#define H_HID_TYPING_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Text typing engine. UTF-8 text is written to a stream buffer (by API or over
+the typing GATT characteristic), typing task translates it with the layout
+table of the host and presses keys through hid_keyboard_change_key(). Key of
+the previous character is released in the same report where the next one is
+pressed, modifiers change only when needed, so one character takes one report
+and one connection event. Repeated character takes one extra release report.
+*/
+
+/* keyboard layout set on the host */
+enum hid_typing_layout {
+    HID_TYPING_LAYOUT_US,
+    HID_TYPING_LAYOUT_DE,
+    HID_TYPING_LAYOUT_FR,
+    HID_TYPING_LAYOUT_COUNT
+};
+
+extern void hid_typing_init(void);
+
+/* non-blocking, text is taken whole or not at all, returns bytes taken */
+extern size_t hid_typing_write(const char *text, size_t len);
+
+/* free space in the text buffer, writers use it for flow control */
+extern size_t hid_typing_space(void);
+
+extern int hid_typing_set_layout(enum hid_typing_layout layout);
+
+#endif
@@ -21,13 +21,20 @@
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "driver/gpio.h"
 
 #include "hid_codes.h"
 #include "hid_func.h"
 #include "gpio_func.h"
+#include "btn_ring.h"
+#include "hid_typing.h"
+#include "hid_perf.h"
+#include "hid_latency.h"
+#include "flight_rec.h"
+#include "battery.h"
+#include "boot_time.h"
+#include "dlog.h"
 
 /* for nvs_storage*/
 #define LOCAL_NAMESPACE "storage"
@@ -44,9 +51,60 @@ nvs_handle_t Nvs_storage_handle = 0;
 /* from ble_func.c */
 extern void ble_init();
 
+/* input task is kept off the core of BLE controller and host */
+#define INPUT_TASK_CORE (portNUM_PROCESSORS - 1)
+
+/* button events from gpio_btn_task */
+static struct btn_ring Buttons_ring;
+
+/* send button event from gpio_btn_task to HID */
+static void
+dispatch_button(const struct btn_event *event)
+{
+    uint32_t button = event->button;
+    uint32_t key_to_send;
+
+    hid_latency_begin(event->edge_us, event->debounced_us);
+
+    // released or pressed?
+    bool pressed = true;
+    if (button & BUTTON_RELEASED_BIT) pressed = false;
+
+    // byte 0 has a key code, consumer usages are 16-bit (bytes 0-1),
+    // byte 1 of mouse buttons is X movement
+    if ((button & BUTTON_TYPE_MASK) == BUTTON_TYPE_CC) {
+        key_to_send = button & 0xffff;
+    } else {
+        key_to_send = button & 0xff;
+    }
+
+    DLOG(DLOG_BUTTON, key_to_send, button & BUTTON_TYPE_MASK, button, pressed);
+
+    switch (button & BUTTON_TYPE_MASK) {
+        case BUTTON_TYPE_KEYBOARD:
+            hid_keyboard_change_key(key_to_send, pressed);
+            break;
+
+        case BUTTON_TYPE_CC:
+            hid_cc_change_key(key_to_send, pressed);
+            break;
+
+        case BUTTON_TYPE_MOUSE:
+            hid_mouse_change_key(key_to_send, 0, 0, pressed);
+            break;
+
+        default:
+            ESP_LOGI(tag, "unknown button type %d", (button & BUTTON_TYPE_MASK) >> 24);
+    }
+}
+
 void
 app_main(void)
 {
+    boot_stamp(BOOT_APP_MAIN);
+    dlog_init();
+    flight_rec_init();
+
     /* Initialize NVS — it is used to store PHY calibration data and Nimble bonding data */
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -54,56 +112,49 @@ app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
-    ESP_ERROR_CHECK( nvs_open(LOCAL_NAMESPACE, NVS_READWRITE, &Nvs_storage_handle) );
+    boot_stamp(BOOT_NVS_INIT);
 
+    btn_ring_init(&Buttons_ring, xTaskGetCurrentTaskHandle());
 
-    QueueHandle_t buttons_queue = xQueueCreate(10, sizeof(uint32_t));
-    if (!buttons_queue) {
-        ESP_LOGE(tag, "Can not create queue!");
-        vTaskDelay(pdMS_TO_TICKS(30000));
-        esp_restart();
-    }
-
-    if (xTaskCreate(gpio_btn_task, "gpio_btn_task", 2048, buttons_queue, 10, NULL) != pdPASS) {
+    // unpinned task of higher priority would preempt app_main on this core,
+    // pinned one does gpio_setup on the other core while the controller is started here
+    if (xTaskCreatePinnedToCore(gpio_btn_task, "gpio_btn_task", 2048, &Buttons_ring, 10, NULL,
+            INPUT_TASK_CORE) != pdPASS) {
         ESP_LOGE(tag, "Can not create gpio_btn_task!");
         vTaskDelay(pdMS_TO_TICKS(30000));
         esp_restart();
     }
 
-    ble_init();
-    ESP_LOGI(tag, "BLE init ok, waiting for buttons ...");
-
-    while (1) {
-        uint32_t button, key_to_send;
-        if (xQueueReceive(buttons_queue, &button, portMAX_DELAY) == pdTRUE) {
-
-            // released or pressed?
-            bool pressed = true;
-            if (button & BUTTON_RELEASED_BIT) pressed = false;
-
-            // byte 0 have a key code
-            key_to_send = button & 0xff;
+    // GATT writes may come as soon as advertising starts
+    hid_typing_init();
+    hid_perf_init();
 
-            ESP_LOGI(tag, "button %d type %08X (src %08X) %s",
-                key_to_send, button & BUTTON_TYPE_MASK, button,
-                pressed ? "pressed" : "released");
+    ble_init();
 
-            switch (button & BUTTON_TYPE_MASK) {
-                case BUTTON_TYPE_KEYBOARD:
-                    hid_keyboard_change_key(key_to_send, pressed);
-                    break;
+    // advertising does not wait for these, the host task syncs with controller meanwhile
+    ESP_ERROR_CHECK( nvs_open(LOCAL_NAMESPACE, NVS_READWRITE, &Nvs_storage_handle) );
+    battery_init(NULL, NULL);
+    boot_stamp(BOOT_APP_INIT);
+    ESP_LOGI(tag, "BLE init ok, waiting for buttons ...");
 
-                case BUTTON_TYPE_CC:
-                    hid_cc_change_key(key_to_send, pressed);
-                    break;
+    struct btn_event events[BTN_RING_SIZE];
+    uint32_t overflows_seen = 0;
 
-                case BUTTON_TYPE_MOUSE:
-                    hid_mouse_change_key(key_to_send, 0, 0, pressed);
-                    break;
+    while (1) {
+        // one wakeup takes every pending event
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-                default:
-                    ESP_LOGI(tag, "unknown button type %d", (button & BUTTON_TYPE_MASK) >> 24);
+        int events_count;
+        while ((events_count = btn_ring_drain(&Buttons_ring, events, BTN_RING_SIZE)) > 0) {
+            for (int i = 0; i < events_count; ++i) {
+                dispatch_button(&events[i]);
             }
         }
+
+        uint32_t overflows = btn_ring_overflows(&Buttons_ring);
+        if (overflows != overflows_seen) {
+            ESP_LOGW(tag, "buttons ring overflows: %u", overflows);
+            overflows_seen = overflows;
+        }
     }
 }
@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "matrix.h"
+
+void
+matrix_init(struct matrix *m, int rows, int cols,
+            const struct matrix_hw *hw, uint8_t debounce_scans)
+{
+    memset(m, 0, sizeof(*m));
+    m->rows = rows > MATRIX_MAX_ROWS ? MATRIX_MAX_ROWS : rows;
+    m->cols = cols > MATRIX_MAX_COLS ? MATRIX_MAX_COLS : cols;
+    m->hw = *hw;
+    m->debounce_scans = debounce_scans;
+}
+
+/* more than one bit is set */
+static inline bool
+many_keys(uint32_t row_state)
+{
+    return (row_state & (row_state - 1)) != 0;
+}
+
+/*
+Without diodes three pressed keys in the corners of a rectangle make the
+fourth one look pressed too. Row is ambiguous when it shares a column with
+another row and one of these rows has more than one key pressed.
+*/
+static bool
+row_is_ghosted(const struct matrix *m, int row)
+{
+    uint32_t keys = m->raw[row];
+
+    if (!keys) {
+        return false;
+    }
+    for (int i = 0; i < m->rows; ++i) {
+        if (i == row || !(m->raw[i] & keys)) {
+            continue;
+        }
+        if (many_keys(keys) || many_keys(m->raw[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+matrix_scan(struct matrix *m, matrix_event_t event, void *arg)
+{
+    uint32_t col_mask = m->cols < 32 ? (1UL << m->cols) - 1 : UINT32_MAX;
+    bool active = false;
+
+    m->scans++;
+
+    for (int row = 0; row < m->rows; ++row) {
+        m->hw.select_row(row, m->hw.arg);
+        uint32_t cols = m->hw.read_cols(m->hw.arg) & col_mask;
+        m->hw.unselect_row(row, m->hw.arg);
+
+        if (cols != m->raw[row]) {
+            m->raw[row] = cols;
+            m->stable_scans[row] = 0;
+        } else if (m->stable_scans[row] < UINT8_MAX) {
+            m->stable_scans[row]++;
+        }
+    }
+
+    for (int row = 0; row < m->rows; ++row) {
+        uint32_t diff = m->raw[row] ^ m->state[row];
+
+        if (m->raw[row]) {
+            active = true;
+        }
+        if (!diff) {
+            continue;
+        }
+        active = true;
+
+        if (m->stable_scans[row] < m->debounce_scans) {
+            continue;
+        }
+        if (row_is_ghosted(m, row)) {
+            // keep old state until ambiguity is over
+            m->ghost_blocks++;
+            continue;
+        }
+
+        while (diff) {
+            int col = __builtin_ctz(diff);
+            uint32_t bit = 1UL << col;
+            bool pressed = (m->raw[row] & bit) != 0;
+
+            diff &= ~bit;
+            if (!event(row, col, pressed, arg)) {
+                // not delivered, state bit stays old, so it is retried on next scan
+                continue;
+            }
+            m->state[row] ^= bit;
+            m->events++;
+        }
+    }
+
+    return active;
+}
@@ -0,0 +1,59 @@
+#ifndef H_MATRIX_
+#define H_MATRIX_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Keyboard matrix scanner core. It does not touch hardware, all pin access
+goes through matrix_hw callbacks, so matrix can be simulated.
+Each row state is a bitmask of columns, changes are found with XOR.
+*/
+
+#define MATRIX_MAX_ROWS 16
+#define MATRIX_MAX_COLS 32
+
+/* hardware access, called by matrix_scan() */
+struct matrix_hw {
+    // make row active (drive it low)
+    void (*select_row)(int row, void *arg);
+    // make row inactive
+    void (*unselect_row)(int row, void *arg);
+    // bitmask of columns with pressed keys on the selected row
+    uint32_t (*read_cols)(void *arg);
+    void *arg;
+};
+
+/* called for each debounced key change,
+   returns false if event can not be handled now and must be retried on next scan */
+typedef bool (*matrix_event_t)(int row, int col, bool pressed, void *arg);
+
+struct matrix {
+    int rows;
+    int cols;
+    struct matrix_hw hw;
+
+    // scans with the same raw row state before it is accepted
+    uint8_t debounce_scans;
+
+    // reported (debounced) state of keys
+    uint32_t state[MATRIX_MAX_ROWS];
+    // state read on last scan
+    uint32_t raw[MATRIX_MAX_ROWS];
+    // number of scans raw row state did not change
+    uint8_t stable_scans[MATRIX_MAX_ROWS];
+
+    // statistics
+    uint32_t scans;
+    uint32_t events;
+    uint32_t ghost_blocks;      // scans with row changes blocked by ghosting
+};
+
+extern void matrix_init(struct matrix *m, int rows, int cols,
+                        const struct matrix_hw *hw, uint8_t debounce_scans);
+
+/* one scan pass of all rows, reports changed keys to event callback,
+   returns true while any key is pressed or is not debounced yet */
+extern bool matrix_scan(struct matrix *m, matrix_event_t event, void *arg);
+
+#endif
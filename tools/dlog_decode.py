@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Decode deferred log records of the keyboard firmware.
+
+Records come either from a serial log built with CONFIG_DLOG_BINARY
+(lines with DLOG:<hex>), or from a raw memory dump of the Cells ring in
+main/dlog.c, for example after a crash:
+
+    dlog_decode.py monitor.log
+    idf.py monitor | dlog_decode.py
+    dlog_decode.py --ring cells.bin --ring-size 128
+
+Formats are read from main/dlog_formats.h, so the decoder must use the
+same sources as the firmware.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+MAX_ARGS = 5
+RECORD = struct.Struct("<IHBB%dI" % MAX_ARGS)
+CELL = struct.Struct("<I")
+
+FORMAT_RE = re.compile(r'^DLOG_FORMAT\((\w+),\s*"([^"]*)",\s*"([^"]*)"\)', re.M)
+CONVERSION_RE = re.compile(r"%([-+ 0#]*\d*)([diuxX%])")
+LINE_RE = re.compile(r"DLOG:([0-9a-fA-F]{%d})" % (RECORD.size * 2))
+
+DEFAULT_FORMATS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                               "..", "main", "dlog_formats.h")
+
+
+def load_formats(path):
+    with open(path) as f:
+        return [(tag, fmt) for _, tag, fmt in FORMAT_RE.findall(f.read())]
+
+
+def format_message(fmt, args):
+    args = list(args)
+
+    def convert(match):
+        flags, conv = match.groups()
+        if conv == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if conv in "di" and value >= 1 << 31:
+            value -= 1 << 32
+        return ("%" + flags + ("d" if conv in "iu" else conv)) % value
+
+    return CONVERSION_RE.sub(convert, fmt)
+
+
+def decode(record, formats):
+    time_us, fmt_id, nargs, _, *args = RECORD.unpack(record)
+    if fmt_id >= len(formats):
+        return "? (%u) unknown format %d, args %s" % (time_us // 1000, fmt_id, args[:nargs])
+    tag, fmt = formats[fmt_id]
+    return "I (%u) %s: %s" % (time_us // 1000, tag, format_message(fmt, args[:nargs]))
+
+
+def records_from_log(stream):
+    for line in stream:
+        match = LINE_RE.search(line)
+        if match:
+            yield bytes.fromhex(match.group(1))
+
+
+def records_from_ring(data, ring_size):
+    """Cells hold sequence and record; published cells have seq == pos + 1,
+    printed ones seq == pos + ring_size, unused ones seq == index."""
+    cell_size = CELL.size + RECORD.size
+    found = []
+    for index in range(min(ring_size, len(data) // cell_size)):
+        offset = index * cell_size
+        seq, = CELL.unpack_from(data, offset)
+        if (seq - index) % ring_size == 1:
+            pos = seq - 1
+        elif seq >= ring_size and (seq - index) % ring_size == 0:
+            pos = seq - ring_size
+        else:
+            continue
+        found.append((pos, data[offset + CELL.size:offset + cell_size]))
+    for _, record in sorted(found):
+        yield record
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", help="serial log, stdin if omitted")
+    parser.add_argument("--ring", help="raw memory dump of the dlog ring")
+    parser.add_argument("--ring-size", type=int, default=128, help="CONFIG_DLOG_RING_SIZE")
+    parser.add_argument("--formats", default=DEFAULT_FORMATS, help="path to dlog_formats.h")
+    args = parser.parse_args()
+
+    formats = load_formats(args.formats)
+
+    if args.ring:
+        with open(args.ring, "rb") as f:
+            records = records_from_ring(f.read(), args.ring_size)
+    elif args.log:
+        records = records_from_log(open(args.log, errors="replace"))
+    else:
+        records = records_from_log(sys.stdin)
+
+    for record in records:
+        print(decode(record, formats))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+"""Turn a flight recorder dump of the keyboard firmware into a timeline
+and latency statistics.
+
+The dump comes either from console output (FLIGHT:<hex> lines printed
+after command 0x02 on the flight recorder characteristic), or from a file
+with GATT pages read one after another, or from a file with the plain dump:
+
+    flight_rec.py monitor.log
+    idf.py monitor | flight_rec.py --stats
+    flight_rec.py --pages pages.bin --no-timeline --stats
+
+Dump format is described in main/flight_rec.h.
+"""
+
+import argparse
+import struct
+import sys
+
+HEADER = struct.Struct("<HBBHHII")
+RECORD = struct.Struct("<HBBH")
+PAGE = struct.Struct("<HH")
+MAGIC = 0x5246
+VERSION = 1
+
+# enum flight_event
+EVENTS = [
+    "time", "boot", "gpio_edge", "button", "report_queued", "queue_full",
+    "report_sent", "tx_retry", "notify_tx", "gap", "subscribe", "snapshot_retry",
+    "adv_phase",
+]
+EV = {name: index for index, name in enumerate(EVENTS)}
+
+# Notify_data_reports in main/hid_func.c
+REPORTS = ["mouse", "keyboard", "leds", "consumer control", "feature",
+           "nkro keyboard", "mouse feature", "battery level", "boot mouse"]
+
+# BLE_GAP_EVENT_* of NimBLE
+GAP_EVENTS = {
+    0: "connect", 1: "disconnect", 3: "conn_update", 4: "conn_update_req",
+    5: "l2cap_update_req", 6: "term_failure", 7: "disc", 8: "disc_complete",
+    9: "adv_complete", 10: "enc_change", 11: "passkey_action", 12: "notify_rx",
+    13: "notify_tx", 14: "subscribe", 15: "mtu", 16: "identity_resolved",
+    17: "repeat_pairing", 18: "phy_update_complete",
+}
+
+BUTTON_TYPES = ["?", "keyboard", "consumer", "mouse"]
+
+# enum adv_phase in main/ble_func.c
+ADV_PHASES = ["directed", "accept list", "open"]
+
+
+class DumpError(Exception):
+    pass
+
+
+def dump_from_log(stream):
+    """The last complete FLIGHT:BEGIN .. FLIGHT:END block of console output."""
+    dump, block = None, None
+    for line in stream:
+        pos = line.find("FLIGHT:")
+        if pos < 0:
+            continue
+        data = line[pos + 7:].strip()
+        if data == "BEGIN":
+            block = []
+        elif data == "END":
+            if block is not None:
+                dump = bytes.fromhex("".join(block))
+            block = None
+        elif block is not None:
+            block.append(data)
+    if dump is None:
+        raise DumpError("no FLIGHT:BEGIN .. FLIGHT:END block found")
+    return dump
+
+
+def dump_from_pages(data):
+    """Values of GATT reads: uint16 page, uint16 pages, part of the dump."""
+    pages = {}
+    offset = 0
+    while offset + PAGE.size <= len(data):
+        page, count = PAGE.unpack_from(data, offset)
+        offset += PAGE.size
+        # every page but the last one is full
+        size = 480 if page + 1 < count else len(data) - offset
+        pages[page] = data[offset:offset + size]
+        offset += size
+    if not pages or sorted(pages) != list(range(max(pages) + 1)):
+        raise DumpError("pages are missing: %s" % sorted(pages))
+    return b"".join(pages[page] for page in sorted(pages))
+
+
+def parse(dump):
+    if len(dump) < HEADER.size:
+        raise DumpError("dump is too short")
+    magic, version, record_size, count, flags, base_us, lost = HEADER.unpack_from(dump)
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        raise DumpError("not a flight recorder dump (magic %04x version %d)" % (magic, version))
+    if len(dump) < HEADER.size + count * RECORD.size:
+        raise DumpError("dump is truncated: %d of %d records"
+                        % ((len(dump) - HEADER.size) // RECORD.size, count))
+
+    events = []
+    t_us = base_us
+    for index in range(count):
+        delta_us, type_, arg, payload = RECORD.unpack_from(dump, HEADER.size + index * RECORD.size)
+        t_us += delta_us
+        if type_ == EV["time"]:
+            t_us += payload << 16
+            continue
+        events.append((t_us, type_, arg, payload))
+    return {"flags": flags, "lost": lost, "base_us": base_us}, events
+
+
+def report_name(index):
+    return REPORTS[index] if index < len(REPORTS) else "report %d" % index
+
+
+def describe(type_, arg, payload):
+    if type_ >= len(EVENTS):
+        return "unknown %d arg=%d payload=%d" % (type_, arg, payload)
+    name = EVENTS[type_]
+    if name == "boot":
+        return "boot reset_reason=%d" % arg
+    if name == "gpio_edge":
+        return "gpio_edge button=%d %s" % (arg, "debounce" if payload else "rattle")
+    if name == "button":
+        index = (arg >> 2 & 0x1f) - 1
+        return "button %s code=0x%04x %s%s" % (
+            BUTTON_TYPES[arg & 3], payload, "released" if arg & 0x80 else "pressed",
+            "" if index < 0 else " button=%d" % index)
+    if name in ("report_queued", "queue_full", "tx_retry"):
+        return "%s %s conn=%d" % (name, report_name(arg), payload)
+    if name == "report_sent":
+        return "report_sent %s conn=%d%s" % (
+            report_name(arg & 0x7f), payload, " indication" if arg & 0x80 else "")
+    if name == "notify_tx":
+        return "notify_tx conn=%d status=%d" % (payload, arg)
+    if name == "gap":
+        return "gap %s payload=%d" % (GAP_EVENTS.get(arg, "event %d" % arg), payload)
+    if name == "subscribe":
+        return "subscribe %s conn=%d notify=%d indicate=%d" % (
+            report_name(arg & 0x3f), payload, arg >> 6 & 1, arg >> 7)
+    if name == "snapshot_retry":
+        return "snapshot_retry %s retries=%d" % (report_name(arg), payload)
+    if name == "adv_phase":
+        return "adv_phase %s bonds=%d" % (
+            ADV_PHASES[arg] if arg < len(ADV_PHASES) else "phase %d" % arg, payload)
+    return name
+
+
+def print_timeline(events):
+    start = events[0][0] if events else 0
+    prev = start
+    for t_us, type_, arg, payload in events:
+        print("%12.3f ms %+10.3f  %s" % ((t_us - start) / 1000, (t_us - prev) / 1000,
+                                        describe(type_, arg, payload)))
+        prev = t_us
+
+
+def latencies(events):
+    """Pairs stages of the input path: gpio edge -> button -> report queued
+    -> report sent to the stack -> notification transmitted, and time to
+    reconnect after the link is lost."""
+    stats = {name: [] for name in ("edge->button", "button->queued", "queued->sent",
+                                   "sent->notify_tx", "button->notify_tx", "disconnect->connect")}
+    edges = {}          # button index -> time of edge which started debounce
+    pending_button = None
+    queued = {}         # (report, conn) -> times of queued reports
+    sent = {}           # conn -> (time, time of button) of sent notifications
+    queued_button = {}  # (report, conn) -> time of button which caused the report
+    lost = None         # time of disconnect which nothing has reconnected yet
+
+    for t_us, type_, arg, payload in events:
+        if type_ == EV["gpio_edge"] and payload:
+            edges.setdefault(arg, t_us)
+        elif type_ == EV["button"]:
+            index = (arg >> 2 & 0x1f) - 1
+            if index in edges:
+                stats["edge->button"].append(t_us - edges.pop(index))
+            pending_button = t_us
+        elif type_ == EV["report_queued"]:
+            key = (arg, payload)
+            queued.setdefault(key, []).append(t_us)
+            if pending_button is not None:
+                stats["button->queued"].append(t_us - pending_button)
+                queued_button[key] = pending_button
+                pending_button = None
+        elif type_ == EV["report_sent"]:
+            key = (arg & 0x7f, payload)
+            if queued.get(key):
+                stats["queued->sent"].append(t_us - queued[key].pop(0))
+            sent.setdefault(payload, []).append((t_us, queued_button.pop(key, None)))
+        elif type_ == EV["notify_tx"]:
+            if sent.get(payload):
+                sent_us, button_us = sent[payload].pop(0)
+                stats["sent->notify_tx"].append(t_us - sent_us)
+                if button_us is not None:
+                    stats["button->notify_tx"].append(t_us - button_us)
+        elif type_ == EV["gap"] and GAP_EVENTS.get(arg) == "disconnect":
+            queued.clear()
+            sent.clear()
+            queued_button.clear()
+            if lost is None:
+                lost = t_us
+        elif type_ == EV["gap"] and GAP_EVENTS.get(arg) == "connect" and lost is not None:
+            stats["disconnect->connect"].append(t_us - lost)
+            lost = None
+    return stats
+
+
+def percentile(values, fraction):
+    return values[min(len(values) - 1, int(len(values) * fraction))]
+
+
+def print_stats(info, events):
+    if events:
+        span = (events[-1][0] - events[0][0]) / 1e6
+        print("%d events in %.3f s, %d records lost%s" % (
+            len(events), span, info["lost"], ", ring has wrapped" if info["flags"] & 1 else ""))
+
+    counts = {}
+    for _, type_, _, _ in events:
+        name = EVENTS[type_] if type_ < len(EVENTS) else "unknown"
+        counts[name] = counts.get(name, 0) + 1
+    print("events: " + ", ".join("%s %d" % item for item in sorted(counts.items())))
+
+    print("%-18s %7s %9s %9s %9s %9s %9s" % ("latency, us", "count", "min", "p50", "p90", "p99", "max"))
+    for name, values in latencies(events).items():
+        if not values:
+            continue
+        values.sort()
+        print("%-18s %7d %9d %9d %9d %9d %9d" % (
+            name, len(values), values[0], percentile(values, 0.5), percentile(values, 0.9),
+            percentile(values, 0.99), values[-1]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="console log or dump file, stdin if omitted")
+    parser.add_argument("--pages", action="store_true", help="input is GATT page reads")
+    parser.add_argument("--raw", action="store_true", help="input is the plain dump")
+    parser.add_argument("--no-timeline", action="store_true", help="do not print the timeline")
+    parser.add_argument("--stats", action="store_true", help="print latency statistics")
+    args = parser.parse_args()
+
+    try:
+        if args.pages or args.raw:
+            with open(args.input, "rb") if args.input else sys.stdin.buffer as f:
+                data = f.read()
+            dump = dump_from_pages(data) if args.pages else data
+        elif args.input:
+            with open(args.input, errors="replace") as f:
+                dump = dump_from_log(f)
+        else:
+            dump = dump_from_log(sys.stdin)
+        info, events = parse(dump)
+    except (DumpError, ValueError) as e:
+        sys.exit("flight_rec.py: %s" % e)
+
+    if not args.no_timeline:
+        print_timeline(events)
+    if args.stats:
+        print_stats(info, events)
+
+
+if __name__ == "__main__":
+    main()